@@ -0,0 +1,27 @@
+#pragma once
+#include <cstddef>
+
+#include "utils.h"
+
+/**
+ * @brief Number of heap allocations since the program started.
+ * Only counted when built with HW1_COUNT_ALLOCATIONS, otherwise always 0. With glibc the malloc family is counted,
+ * which covers Eigen's dense storage and operator new. Elsewhere only operator new is, so Eigen is not seen.
+ *
+ */
+std::size_t getAllocationCount() noexcept;
+
+/**
+ * @brief Count the heap allocations made while the object is alive.
+ *
+ */
+class AllocationScope final {
+ public:
+  DELETE_COPY(AllocationScope)
+  DELETE_MOVE(AllocationScope)
+  AllocationScope() noexcept : start(getAllocationCount()) {}
+  std::size_t count() const noexcept { return getAllocationCount() - start; }
+
+ private:
+  std::size_t start;
+};
@@ -0,0 +1,82 @@
+#pragma once
+#include <array>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/SparseCore>
+
+#include "cloth.h"
+#include "integrator.h"
+#include "utils.h"
+
+/**
+ * @brief Linearized backward Euler of Baraff and Witkin, for stiff springs.
+ * Solves (M - h df/dv - h^2 df/dx) dv = h (f + h df/dx v) for the cloth with a warm-started Jacobi preconditioned
+ * conjugate gradient, then x += h (v + dv). Fixed particles keep dv = 0. Other particles use explicit Euler.
+ * The spring Jacobians are written into a sparse matrix whose pattern is kept until the cloth changes.
+ */
+class BackwardEuler final : public Integrator {
+ public:
+  /**
+   * @brief Construct a new BackwardEuler object.
+   *
+   * @param cloth_ The cloth whose springs form the linear system, must outlive the integrator.
+   */
+  explicit BackwardEuler(Cloth &cloth_) noexcept : cloth(cloth_) {}
+  void integrate(const std::vector<Particles *> &particles, std::function<void(void)> simulateOneStep) const override;
+  template <class Step>
+  void step(const std::vector<Particles *> &particles, Step &&simulateOneStep) const;
+  CONSTEXPR_VIRTUAL Type getType() const override { return Type::BACKWARD_EULER; }
+  /**
+   * @brief Get the conjugate gradient iterations of the last step.
+   *
+   */
+  int lastIterationCount() const { return iterationCount; }
+
+ private:
+  /**
+   * @brief Create the sparsity pattern: one 3x3 block per particle and two per spring.
+   *
+   */
+  void buildPattern() const;
+  /**
+   * @brief Write the system matrix, the right hand side and the preconditioner of the current state.
+   *
+   */
+  void assemble() const;
+  /**
+   * @brief Solve the system into velocityChange, starting from its last value.
+   *
+   */
+  void solve() const;
+  /**
+   * @brief q = A p, split across the thread pool by rows.
+   *
+   */
+  void multiply(const Eigen::VectorXf &p, Eigen::VectorXf &q) const;
+  void integrateCloth() const;
+
+  Cloth &cloth;
+  mutable Eigen::SparseMatrix<float, Eigen::RowMajor> system;
+  // Offset into system's values of the first entry in each of the 3 rows of a block.
+  mutable std::vector<std::array<int, 3>> diagonalBlocks;
+  mutable std::vector<std::array<int, 3>> startEndBlocks, endStartBlocks;
+  // Solver vectors of 3 floats per particle, kept between steps. velocityChange is the warm start.
+  mutable Eigen::VectorXf rhs, velocityChange, residual, direction, preconditioned, product, inverseDiagonal;
+  // Cloth::layoutRevision() the pattern was built for, a W x H and an H x W cloth have the same sizes.
+  mutable int patternRevision = -1;
+  mutable int iterationCount = 0;
+};
+
+template <class Step>
+void BackwardEuler::step(const std::vector<Particles *> &particles, Step &&) const {
+  // The forces of the step are already computed, the solve only needs their Jacobians.
+  for (const auto &p : particles) {
+    if (p == &cloth.particles()) {
+      integrateCloth();
+      continue;
+    }
+    p->statePosition() += deltaTime * p->velocity();
+    p->velocity() += deltaTime * p->acceleration();
+  }
+}
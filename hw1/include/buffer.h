@@ -1,4 +1,5 @@
 #pragma once
+#include <cstddef>
 #include <vector>
 
 #include <glad/gl.h>
@@ -46,6 +47,12 @@ class Buffer {
    * @param usage One of the buffer usage macro. GL_[STATIC/DYNAMIC/STREAM]_[READ/COPY/DRAW]
    */
   void allocate_load(GLsizeiptr _size, const void* data, GLenum usage = GL_STATIC_DRAW) const noexcept;
+  /**
+   * @brief Bind the buffer to an indexed shader storage binding point, any type of buffer can be used.
+   *
+   * @param index Shader storage binding index.
+   */
+  void bindStorage(GLuint index) const noexcept;
   /**
    * @brief Get the type string
    *
@@ -108,6 +115,99 @@ class ElementArrayBuffer final : public Buffer {
   CONSTEXPR_VIRTUAL GLenum getType() const noexcept override { return GL_ELEMENT_ARRAY_BUFFER; }
 };
 
+class ShaderStorageBuffer final : public Buffer {
+ public:
+  /**
+   * @brief Get the type string
+   *
+   * @return String description of the buffer type.
+   */
+  CONSTEXPR_VIRTUAL const char* getTypeName() const noexcept override { return "Shader storage buffer"; }
+  /**
+   * @brief Get the type enum
+   *
+   * @return OpenGL enum of the buffer type.
+   */
+  CONSTEXPR_VIRTUAL GLenum getType() const noexcept override { return GL_SHADER_STORAGE_BUFFER; }
+};
+
+/**
+ * @brief Array buffer for vertex data rewritten every frame.
+ * With buffer storage (OpenGL 4.4+) it holds regionCount regions that stay mapped persistently and coherently, the
+ * CPU writes one region while the GPU may still read the others and a fence guards each region before its reuse.
+ * On older contexts there is a single region, orphaned and mapped again in every write.
+ * The storage is immutable in the persistent mode, do not call allocate() or load() on it.
+ */
+class StreamingArrayBuffer final : public Buffer {
+ public:
+  DELETE_COPY(StreamingArrayBuffer)
+  DELETE_MOVE(StreamingArrayBuffer)
+  static constexpr int regionCount = 3;
+  StreamingArrayBuffer() noexcept = default;
+  /**
+   * @brief Destroy the StreamingArrayBuffer object. Unmap and release the fences.
+   *
+   */
+  ~StreamingArrayBuffer() override;
+  /**
+   * @brief Allocate the regions, the previous content is lost.
+   * The persistent mode creates a new handle, so attribute pointers must be set again after this.
+   *
+   * @param regionSize Size of data written per frame in bytes.
+   */
+  void allocateRegions(GLsizeiptr regionSize);
+  /**
+   * @brief Move to the next region and map it, waits until the GPU has finished the commands reading it.
+   *
+   * @return Pointer to regionSize() writable bytes.
+   */
+  void* beginWrite() const;
+  /**
+   * @brief Finish the write started by beginWrite().
+   *
+   * @return Offset of the written region in bytes, for the attribute pointers.
+   */
+  GLintptr endWrite() const;
+  /**
+   * @brief Copy data into the next region, same as beginWrite() + memcpy + endWrite().
+   *
+   * @param data Pointer to the data to be written.
+   * @param _size The size of the data in bytes, at most regionSize().
+   * @return Offset of the written region in bytes.
+   */
+  GLintptr write(const void* data, GLsizeiptr _size) const;
+  /**
+   * @brief Bind the current region to an indexed shader storage binding point.
+   *
+   * @param index Shader storage binding index.
+   */
+  void bindStorageRegion(GLuint index) const noexcept;
+  GLintptr regionOffset() const noexcept { return currentRegion * _regionSize; }
+  GLsizeiptr regionSize() const noexcept { return _regionSize; }
+  bool isPersistent() const noexcept { return mapped != nullptr; }
+  /**
+   * @brief Get the type string
+   *
+   * @return String description of the buffer type.
+   */
+  CONSTEXPR_VIRTUAL const char* getTypeName() const noexcept override { return "Streaming array buffer"; }
+  /**
+   * @brief Get the type enum
+   *
+   * @return OpenGL enum of the buffer type.
+   */
+  CONSTEXPR_VIRTUAL GLenum getType() const noexcept override { return GL_ARRAY_BUFFER; }
+
+ private:
+  void releaseStorage() const noexcept;
+
+  mutable GLsizeiptr _regionSize = 0;
+  mutable int currentRegion = 0;
+  // Start of the persistent mapping, nullptr in the orphaning mode.
+  mutable std::byte* mapped = nullptr;
+  mutable GLsync fences[regionCount] = {};
+};
+
 class UniformBuffer final : public Buffer {
  public:
   /**
@@ -36,6 +36,10 @@ class Camera {
    * @brief Get the 4*4 view matrix of the camera.
    */
   Eigen::Ref<Eigen::Matrix4f> viewMatrix() { return _viewMatrix; }
+  /**
+   * @brief Get the rotation of the camera.
+   */
+  const Eigen::Quaternionf& rotation() const { return _rotation; }
   /**
    * @brief Projection * view.
    */
@@ -47,6 +51,13 @@ class Camera {
    * @return true if the event move the camera.
    */
   bool move(GLFWwindow* window);
+  /**
+   * @brief Place the camera directly, e.g. from a recording.
+   *
+   * @param position The position of the camera. This w value should be 1.0f
+   * @param rotation The rotation of the camera, as rotation() returns it.
+   */
+  void setPose(const Eigen::Ref<const Eigen::Vector4f>& position, const Eigen::Quaternionf& rotation);
   /**
    * @brief Recalculate the projection matrix. Need to be call when window size changes.
    *
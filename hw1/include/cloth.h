@@ -1,8 +1,12 @@
 #pragma once
 #include <glad/gl.h>
+#include <array>
+#include <cstdint>
+#include <memory>
 #include <vector>
 
 #include "buffer.h"
+#include "configs.h"
 #include "shape.h"
 #include "spring.h"
 #include "utils.h"
@@ -12,18 +16,72 @@ class Cloth final : public Shape {
  public:
   MOVE_ONLY(Cloth)
   enum class DrawType { FULL, STRUCTURAL, SHEAR, BEND, PARTICLE };
-  Cloth();
+  /**
+   * @brief Construct a cloth of width * height particles.
+   *
+   * @param width Particles per row, clamped to [2, maxParticlesPerEdge].
+   * @param height Particles per column, clamped to [2, maxParticlesPerEdge].
+   */
+  explicit Cloth(int width = defaultParticlesPerEdge, int height = defaultParticlesPerEdge);
+  /**
+   * @brief Rebuild the cloth with a new resolution, the cloth is reset to its initial state.
+   *
+   * @param width Particles per row, clamped to [2, maxParticlesPerEdge].
+   * @param height Particles per column, clamped to [2, maxParticlesPerEdge].
+   */
+  void resize(int width, int height);
+  int width() const { return _width; }
+  int height() const { return _height; }
+  /**
+   * @brief Changed by every resize, so caches of the particle and spring layout know when to rebuild.
+   *
+   */
+  int layoutRevision() const { return _layoutRevision; }
   /**
    * @brief Get the springs.
    *
    */
   std::vector<Spring>& springs() { return _springs; }
   /**
-   * @brief Render the cloth based on the given type.
+   * @brief Get the packed springs, ordered in batches that share no particle.
+   *
+   */
+  const SpringArrays& springArrays() const { return _springArrays; }
+  const std::vector<int>& springBatchOffsets() const { return _springBatchOffsets; }
+  /**
+   * @brief Upper bound of the spring matrix's eigenvalues over mass, per unit springCoef (or damperCoef).
+   * Used to estimate the stable step size.
+   *
+   */
+  float maxStiffnessPerMass() const { return _maxStiffnessPerMass; }
+  float minRestLength() const { return _minRestLength; }
+  /**
+   * @brief Get the OpenGL buffers of positions and normals, nullptr in headless mode.
+   *
+   */
+  const StreamingArrayBuffer* positionBuffer() const { return render ? &render->positionBuffer : nullptr; }
+  const ArrayBuffer* normalBuffer() const { return render ? &render->normalBuffer : nullptr; }
+  /**
+   * @brief Mark the position buffer as written on the GPU, streamPosition() does nothing until it is cleared.
+   *
+   */
+  void setPositionOnGPU(bool isOnGPU) { isPositionOnGPU = isOnGPU; }
+  /**
+   * @brief Write the positions into the next region of the position buffer, call once per frame before draw().
+   *
+   */
+  void streamPosition() const;
+  /**
+   * @brief Render the cloth based on the given type. Does nothing in headless mode.
    *
    * @param type The render type.
    */
   void draw(DrawType type) const;
+  /**
+   * @brief Render the enabled spring types as lines in one multi-draw. Does nothing in headless mode.
+   *
+   */
+  void drawSprings(bool isStructural, bool isShear, bool isBend) const;
   /**
    * @brief Compute the internal force produce by the springs.
    * Which includes spring force and damper force.
@@ -32,9 +90,12 @@ class Cloth final : public Shape {
   void computeSpringForce();
   /**
    * @brief Compute the smooth normal of the surface. Only called when draw type is FULL
+   * Redone every normalUpdateInterval calls, and only for the rows near particles that moved more than
+   * normalUpdateThreshold when it is positive.
    *
+   * @param isForced Recompute all rows now, e.g. after the positions are reset.
    */
-  void computeNormal();
+  void computeNormal(bool isForced = false);
   /**
    * @brief Cloth collide with unknown shape
    *
@@ -59,9 +120,56 @@ class Cloth final : public Shape {
    *
    */
   void initializeSpring();
+  /**
+   * @brief Reorder the springs into batches that share no particle, so a batch can be accumulated in parallel.
+   *
+   */
+  void colorSprings();
+  /**
+   * @brief Accumulate the force of springs in [begin, end) into the particles' acceleration.
+   *
+   */
+  void computeSpringForce(int begin, int end);
+  /**
+   * @brief Mark the rows whose normals are changed by particles moving beyond normalUpdateThreshold.
+   *
+   * @return false if there is no reference positions yet, all rows need an update then.
+   */
+  bool findMovedRows();
+  /**
+   * @brief Update maxStiffnessPerMass() and minRestLength() after the springs or masses change.
+   *
+   */
+  void computeStabilityBounds();
+  int _width;
+  int _height;
+  int _layoutRevision = 0;
   std::vector<Spring> _springs;
-  VertexArray vao;
-  ArrayBuffer positionBuffer;
-  ArrayBuffer normalBuffer;
-  ElementArrayBuffer ebo, structuralSpring, shearSpring, bendSpring;
+  // Springs in [_springBatchOffsets[i], _springBatchOffsets[i + 1]) touch each particle at most once.
+  std::vector<int> _springBatchOffsets;
+  SpringArrays _springArrays;
+  // Per-spring scratch of computeSpringForce: end - start position / velocity and the resulting force scale.
+  Eigen::ArrayXf _springDx, _springDy, _springDz;
+  Eigen::ArrayXf _springDvx, _springDvy, _springDvz;
+  Eigen::ArrayXf _springLength, _springInverseLength, _springForceScale;
+  Eigen::Matrix4Xf _normals;
+  // Positions the normals were computed from, only kept when normalUpdateThreshold is positive.
+  Eigen::Matrix4Xf _normalReference;
+  std::vector<std::uint8_t> _rowsMoved, _rowsToUpdate;
+  int normalFrameCount = 0;
+  float _maxStiffnessPerMass = 0.0f;
+  float _minRestLength = 0.0f;
+  bool isNormalOutdated = true;
+  // OpenGL objects, not created in headless mode.
+  struct RenderResources {
+    VertexArray vao;
+    StreamingArrayBuffer positionBuffer;
+    ArrayBuffer normalBuffer;
+    ElementArrayBuffer ebo;
+    // Spring lines of type t are indices [springRanges[t], springRanges[t + 1]) of springEBO.
+    ElementArrayBuffer springEBO;
+    std::array<GLsizei, 4> springRanges{};
+  };
+  std::unique_ptr<RenderResources> render;
+  bool isPositionOnGPU = false;
 };
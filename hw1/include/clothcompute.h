@@ -0,0 +1,78 @@
+#pragma once
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "buffer.h"
+#include "cloth.h"
+#include "shader.h"
+#include "simulation.h"
+#include "sphere.h"
+#include "utils.h"
+
+/**
+ * @brief Run the cloth on the GPU with compute shaders, needs OpenGL 4.3.
+ * The particle state stays in shader storage buffers, positions and normals are written into the cloth's own
+ * vertex buffers (the current region of the streaming position buffer) so drawing needs no upload.
+ * The spheres are simulated on the CPU. Each cloth step collides with them where they were at that step, and what the
+ * contacts give back to the spheres is read back and applied at the end of the frame, so they react a frame late.
+ */
+class ClothCompute final {
+ public:
+  DELETE_COPY(ClothCompute)
+  DELETE_MOVE(ClothCompute)
+  /**
+   * @brief Compile the compute programs.
+   *
+   */
+  ClothCompute() noexcept;
+  /**
+   * @brief Copy the cloth state to the GPU, call again after the cloth is resized or reset.
+   *
+   * @param cloth The cloth to be simulated, must not be headless.
+   */
+  void upload(Cloth& cloth);
+  /**
+   * @brief Copy the GPU state back into the cloth, the cloth is simulated on the CPU again.
+   *
+   */
+  void download();
+  /**
+   * @brief Whether a cloth is uploaded and not downloaded yet.
+   *
+   */
+  bool isResident() const { return cloth != nullptr; }
+  /**
+   * @brief Simulate steps with explicit Euler, same as the fused CPU path, together with the spheres.
+   *
+   * @param simulation Steps the spheres on the CPU.
+   * @param spheres Spheres to collide with, the cloth's impulses are added to them after the steps.
+   * @param stepCount Number of steps.
+   */
+  void simulate(Simulation& simulation, Spheres& spheres, int stepCount);
+  /**
+   * @brief Compute the smooth normal of the surface into the cloth's normal buffer.
+   *
+   */
+  void computeNormal();
+
+ private:
+  void bindStorage() const;
+
+  ShaderProgram springProgram;
+  ShaderProgram integrateProgram;
+  ShaderProgram normalProgram;
+  ShaderStorageBuffer velocityBuffer;
+  ShaderStorageBuffer accelerationBuffer;
+  ShaderStorageBuffer inverseMassBuffer;
+  ShaderStorageBuffer springIndexBuffer;
+  ShaderStorageBuffer springParameterBuffer;
+  ShaderStorageBuffer sphereBuffer;
+  ShaderStorageBuffer sphereFeedbackBuffer;
+  Cloth* cloth = nullptr;
+  std::vector<int> springBatchOffsets;
+  // Three vec4 per sphere and step, see the integrate shader, reused between calls.
+  std::vector<Eigen::Vector4f> sphereData;
+  // Velocity, position and rotation change of each sphere in fixed point.
+  std::vector<Eigen::Vector4i> sphereFeedback;
+};
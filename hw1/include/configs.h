@@ -1,14 +1,21 @@
 #pragma once
+#include <cstddef>
+
 #include <Eigen/Core>
 
 // constants
-inline constexpr int particlesPerEdge = 25;
+inline constexpr int defaultParticlesPerEdge = 25;
+inline constexpr int maxParticlesPerEdge = 512;
 inline constexpr int clothWidth = 2;
 inline constexpr int clothHeight = 2;
 inline constexpr float particleMass = 1.0f;
 inline constexpr float sphereDensity = 1e3f;
 inline constexpr float baseSpeed = 1e-3f;
 
+// Frames kept for rewinding and the bytes they may take, see StateHistory
+inline constexpr int historyMaxFrameCount = 600;
+inline constexpr std::size_t historyMemoryBudget = std::size_t{256} << 20;
+
 inline constexpr int sphereSlice = 36;
 inline constexpr int sphereStack = 18;
 
@@ -23,6 +30,30 @@ extern float keyboardMoveSpeed;
 
 extern float deltaTime;
 extern int simulationPerFrame;
+extern int simulationThreadCount;
+// Pick the step count of each frame from the stability estimate of the springs, see Simulation::simulateAdaptive
+extern bool isAdaptiveTimeStep;
+// Scale of the estimated stable step, the row-sum bound is about 2.5 times too strict on the cloth grid
+extern float adaptiveSafetyFactor;
+extern int maxAdaptiveStepCount;
+// Steps taken by the last adaptive frame
+extern int adaptiveStepCount;
+// operator new calls made by the last frame of simulation, see allocationcounter.h
+extern int frameAllocationCount;
+
+// Recompute the cloth normals every this many frames.
+extern int normalUpdateInterval;
+// Only recompute the normals of rows with a particle moved further than this, 0 to always recompute.
+extern float normalUpdateThreshold;
+
+// Relative residual and iteration limit of the backward Euler's conjugate gradient
+extern float backwardEulerTolerance;
+extern int backwardEulerMaxIterations;
+// Conjugate gradient iterations of the last backward Euler step
+extern int backwardEulerIterationCount;
+
+// Constraint sweeps per XPBD step
+extern int xpbdIterationCount;
 
 extern float springCoef;
 extern float damperCoef;
@@ -41,5 +72,24 @@ extern bool isDrawingBendSprings;
 extern bool isDrawingCloth;
 extern bool isPaused;
 extern bool isStateSwitched;
+// Frames recorded, and the one to rewind to while paused (0 is the newest)
+extern int historyFrameCount;
+extern int historySeekAge;
+extern bool isHistorySeeked;
+extern bool isSphereBroadPhaseEnabled;
+extern bool isExplicitEulerFused;
+// Record the stage times of each frame, see profiler.h
+extern bool isProfilerEnabled;
+// Skip all OpenGL objects of the shapes, set before creating them. Used by the benchmark.
+extern bool isHeadless;
+// Simulate the cloth with compute shaders, only available when isComputeShaderSupported.
+extern bool isGPUSimulationEnabled;
+extern bool isComputeShaderSupported;
+// Stream vertex uploads through persistently mapped buffers (OpenGL 4.4+), set before creating the shapes.
+extern bool isBufferStorageSupported;
 
 extern int currentIntegrator;
+
+extern int clothParticlesWidth;
+extern int clothParticlesHeight;
+extern bool isClothResolutionChanged;
@@ -20,6 +20,10 @@ class OpenGLContext final {
   int getRefreshRate() const { return refreshRate; }
   /// @return The OpenGL context version.
   int getOpenGLVersion() const { return majorVersion * 10 + minorVersion; }
+  /// @return Whether compute shaders and shader storage buffers are available (OpenGL 4.3+).
+  bool isComputeShaderSupported() const { return getOpenGLVersion() >= 43; }
+  /// @return Whether glBufferStorage and persistent mapping are available (OpenGL 4.4+).
+  bool isBufferStorageSupported() const { return getOpenGLVersion() >= 44; }
   /// @brief Print the system information.
   void printSystemInfo() const;
   /// @brief Enable OpenGL's debug callback, useful for debugging.
@@ -1,12 +1,20 @@
 #pragma once
 
+#include "allocationcounter.h"
+#include "backwardeuler.h"
 #include "buffer.h"
 #include "camera.h"
 #include "cloth.h"
+#include "clothcompute.h"
 #include "configs.h"
 #include "glcontext.h"
 #include "gui.h"
 #include "integrator.h"
+#include "profiler.h"
+#include "recording.h"
 #include "shader.h"
+#include "simulation.h"
 #include "sphere.h"
+#include "statehistory.h"
 #include "utils.h"
+#include "xpbd.h"
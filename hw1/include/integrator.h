@@ -3,6 +3,7 @@
 #include <functional>
 #include <vector>
 
+#include "configs.h"
 #include "particles.h"
 #include "utils.h"
 
@@ -11,7 +12,7 @@ class Integrator {
   Integrator() noexcept {}
   DELETE_COPY(Integrator)
   DELETE_MOVE(Integrator)
-  enum class Type { EXPLICIT_EULER, IMPLICIT_EULER, MIDPOINT_EULER, RUNGE_KUTTA_FOURTH };
+  enum class Type { EXPLICIT_EULER, IMPLICIT_EULER, MIDPOINT_EULER, RUNGE_KUTTA_FOURTH, BACKWARD_EULER };
   /**
    * @brief Integrate the ODE of acceleration and velocity.
    *
@@ -20,29 +21,153 @@ class Integrator {
    */
   virtual void integrate(const std::vector<Particles *> &particles,
                          std::function<void(void)> simulateOneStep) const = 0;
+  // Every integrator also has a non-virtual template step(particles, simulateOneStep) with the same meaning.
+  // Calling it on the concrete type lets the compiler inline simulateOneStep into the integration stages.
   CONSTEXPR_VIRTUAL virtual Type getType() const = 0;
+
+ protected:
+  /**
+   * @brief Copy the particles into backup. The storage is reused unless the particle count changes.
+   *
+   * @param particles A vector of particles to be saved.
+   */
+  void saveBackup(const std::vector<Particles *> &particles) const;
+  // Scratch state kept between calls, so the steady-state loop does not allocate.
+  mutable std::vector<ParticleState> backup;
 };
 
 class ExplicitEuler : public Integrator {
  public:
   void integrate(const std::vector<Particles *> &particles, std::function<void(void)> simulateOneStep) const override;
+  template <class Step>
+  void step(const std::vector<Particles *> &particles, Step &&simulateOneStep) const;
   CONSTEXPR_VIRTUAL Type getType() const override { return Type::EXPLICIT_EULER; }
 };
 
 class ImplicitEuler : public Integrator {
  public:
   void integrate(const std::vector<Particles *> &particles, std::function<void(void)> simulateOneStep) const override;
+  template <class Step>
+  void step(const std::vector<Particles *> &particles, Step &&simulateOneStep) const;
   CONSTEXPR_VIRTUAL Type getType() const override { return Type::IMPLICIT_EULER; }
 };
 
 class MidpointEuler : public Integrator {
  public:
   void integrate(const std::vector<Particles *> &particles, std::function<void(void)> simulateOneStep) const override;
+  template <class Step>
+  void step(const std::vector<Particles *> &particles, Step &&simulateOneStep) const;
   CONSTEXPR_VIRTUAL Type getType() const override { return Type::MIDPOINT_EULER; }
 };
 
 class RungeKuttaFourth : public Integrator {
  public:
   void integrate(const std::vector<Particles *> &particles, std::function<void(void)> simulateOneStep) const override;
+  template <class Step>
+  void step(const std::vector<Particles *> &particles, Step &&simulateOneStep) const;
   CONSTEXPR_VIRTUAL Type getType() const override { return Type::RUNGE_KUTTA_FOURTH; }
+
+ private:
+  mutable std::vector<StateMatrix> k1, k2, k3, k4;
 };
+
+template <class Step>
+void ExplicitEuler::step(const std::vector<Particles *> &particles, Step &&) const {
+  // TODO: Integrate velocity and acceleration
+  //   1. Integrate velocity.
+  //   2. Integrate acceleration.
+  //   3. You should not compute position using acceleration. Since some part only update velocity. (e.g. impulse)
+  // Note:
+  //   1. You don't need the simulation function in explicit euler.
+  //   2. You should do this first because it is very simple. Then you can chech your collision is correct or not.
+  //   3. This can be done in 2 lines. (Hint: You can add / multiply all particles at once since it is a large matrix.)
+  for (const auto &p : particles) {
+    // Write code here!
+    p->statePosition() += deltaTime * p->velocity();
+    p->velocity() += deltaTime * p->acceleration();
+  }
+}
+
+template <class Step>
+void ImplicitEuler::step(const std::vector<Particles *> &particles, Step &&simulateOneStep) const {
+  // TODO: Integrate velocity and acceleration
+  //   1. Backup original particles' data.
+  //   2. Integrate velocity and acceleration using explicit euler to get Xn+1.
+  //   3. Compute refined Xn+1 using (1.) and (2.).
+  // Note:
+  //   1. Use simulateOneStep with modified position and velocity to get Xn+1.
+  // Write code here!
+  saveBackup(particles);
+  simulateOneStep();
+  int i = 0;
+  for (const auto &p : particles) {
+    p->statePosition() = backup[i].position.topRows<stateRows>() + p->velocity() * deltaTime;
+    p->velocity() = backup[i].velocity + p->acceleration() * deltaTime;
+    i++;
+  }
+}
+
+template <class Step>
+void MidpointEuler::step(const std::vector<Particles *> &particles, Step &&simulateOneStep) const {
+  // TODO: Integrate velocity and acceleration
+  //   1. Backup original particles' data.
+  //   2. Integrate velocity and acceleration using explicit euler to get Xn+1.
+  //   3. Compute refined Xn+1 using (1.) and (2.).
+  // Note:
+  //   1. Use simulateOneStep with modified position and velocity to get Xn+1.
+
+  // Write code here!
+  saveBackup(particles);
+  simulateOneStep();
+  int i = 0;
+  for (const auto &p : particles) {
+    p->statePosition() = backup[i].position.topRows<stateRows>() + (p->velocity() + backup[i].velocity) / 2 * deltaTime;
+    p->velocity() = backup[i].velocity + (p->acceleration() + backup[i].acceleration) / 2 * deltaTime;
+    i++;
+  }
+}
+
+template <class Step>
+void RungeKuttaFourth::step(const std::vector<Particles *> &particles, Step &&simulateOneStep) const {
+  // TODO: Integrate velocity and acceleration
+  //   1. Backup original particles' data.
+  //   2. Compute k1, k2, k3, k4
+  //   3. Compute refined Xn+1 using (1.) and (2.).
+  // Note:
+  //   1. Use simulateOneStep with modified position and velocity to get Xn+1.
+
+  // Write code here!
+  saveBackup(particles);
+  for (auto *k : {&k1, &k2, &k3, &k4}) k->resize(particles.size());
+  int i = 0;
+  for (const auto &p : particles) {
+    k1[i] = deltaTime * p->velocity();
+    p->statePosition() += k1[i]/2;
+    i++;
+  }
+  simulateOneStep();
+   i = 0;
+  for (const auto &p : particles) {
+    k2[i] = deltaTime * (p->velocity() + backup[i].velocity) / 2;
+    p->statePosition() = backup[i].position.topRows<stateRows>() + k2[i] / 2;
+    p->velocity() = backup[i].velocity;
+    i++;
+  }
+  
+  simulateOneStep();
+  i = 0;
+  for (const auto &p : particles) {
+    k3[i] = deltaTime * (p->velocity() + backup[i].velocity) / 2;
+    p->statePosition() = backup[i].position.topRows<stateRows>() + k3[i];
+    p->velocity() = backup[i].velocity+deltaTime*backup[i].acceleration;
+    k4[i] = deltaTime * p->velocity();
+    i++;
+  }
+  simulateOneStep();
+  i = 0;
+  for (const auto &p : particles) {
+    p->statePosition() = backup[i].position.topRows<stateRows>() + k1[i];
+    p->velocity() = backup[i].velocity + backup[i].acceleration * deltaTime;
+    i++;
+  }
+}
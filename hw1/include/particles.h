@@ -1,26 +1,80 @@
 #pragma once
 #include <Eigen/Core>
+#include <Eigen/Geometry>
 #include <vector>
 
+// Rows of velocity, acceleration and rotation. HW1_COMPACT_PARTICLES drops their w lane, which is always 0, so the
+// simulation passes stream a quarter less. Positions keep 4 rows with w = 1 for OpenGL.
+#ifdef HW1_COMPACT_PARTICLES
+inline constexpr int stateRows = 3;
+#else
+inline constexpr int stateRows = 4;
+#endif
+using StateMatrix = Eigen::Matrix<float, stateRows, Eigen::Dynamic>;
+using StateVector = Eigen::Matrix<float, stateRows, 1>;
+
+/**
+ * @brief Cross product of the xyz parts, the w lane stays 0 when there is one.
+ *
+ */
+inline StateVector stateCross(const StateVector& a, const StateVector& b) {
+  if constexpr (stateRows == 4)
+    return a.cross3(b);
+  else
+    return a.cross(b);
+}
+
+/**
+ * @brief The part of Particles changed by the simulation, used for backups and snapshots.
+ *
+ */
+struct ParticleState {
+  Eigen::Matrix4Xf position;
+  StateMatrix velocity;
+  StateMatrix acceleration;
+  StateMatrix rotation;
+};
+
 class Particles {
  public:
   Particles(int size = -1, float mass_ = 0.0f) noexcept;
   void resize(int newSize);
   void setZero();
+  /**
+   * @brief Copy the state into a snapshot. Its storage is reused unless the particle count changed.
+   *
+   */
+  void save(ParticleState& state) const;
+  /**
+   * @brief Copy a snapshot back, it must be saved from particles of the same capacity.
+   *
+   */
+  void restore(const ParticleState& state);
 
   int getCapacity() const { return static_cast<int>(_position.cols()); }
   // Get all particles.
   Eigen::Ref<Eigen::Matrix4Xf> position() { return _position; }
-  Eigen::Ref<Eigen::Matrix4Xf> velocity() { return _velocity; }
-  Eigen::Ref<Eigen::Matrix4Xf> acceleration() { return _acceleration; }
-  std::vector<float>& mass() { return _mass; }
+  Eigen::Ref<StateMatrix> velocity() { return _velocity; }
+  Eigen::Ref<StateMatrix> acceleration() { return _acceleration; }
+  // The rows of position matching velocity, for integrating it. All 4 rows without HW1_COMPACT_PARTICLES.
+  auto statePosition() { return _position.topRows<stateRows>(); }
+  const std::vector<float>& mass() const { return _mass; }
+  // Inverse mass of all particles, 0 for pinned ones (m == 0). Kept in sync by setMass and resize.
+  const Eigen::ArrayXf& inverseMass() const { return _inverseMass; }
   // Get specific particle by index.
   Eigen::Ref<Eigen::Vector4f> position(int i) { return _position.col(i); }
-  Eigen::Ref<Eigen::Vector4f> velocity(int i) { return _velocity.col(i); }
-  Eigen::Ref<Eigen::Vector4f> acceleration(int i) { return _acceleration.col(i); }
-  Eigen::Ref<Eigen::Vector4f> rotation(int i) { return _rotation.col(i); }
-  float& mass(int i) { return _mass[i]; }
-  float inverseMass(int i) { return (_mass[i] == 0.0f) ? 0.0f : 1.0f / _mass[i]; }
+  Eigen::Ref<StateVector> velocity(int i) { return _velocity.col(i); }
+  Eigen::Ref<StateVector> acceleration(int i) { return _acceleration.col(i); }
+  Eigen::Ref<StateVector> rotation(int i) { return _rotation.col(i); }
+  auto statePosition(int i) { return _position.col(i).head<stateRows>(); }
+  float mass(int i) const { return _mass[i]; }
+  float inverseMass(int i) const { return _inverseMass[i]; }
+  // Set the mass of all particles / particle i, m == 0 pins the particle.
+  void setMass(float mass_);
+  void setMass(int i, float mass_) {
+    _mass[i] = mass_;
+    _inverseMass[i] = computeInverseMass(mass_);
+  }
 
   const float* getPositionData() const { return _position.data(); }
   const float* getVelocityData() const { return _velocity.data(); }
@@ -28,9 +82,11 @@ class Particles {
   const float* getMassData() const { return _mass.data(); }
 
  private:
+  static float computeInverseMass(float mass_) { return (mass_ == 0.0f) ? 0.0f : 1.0f / mass_; }
   Eigen::Matrix4Xf _position;
-  Eigen::Matrix4Xf _velocity;
-  Eigen::Matrix4Xf _acceleration;
+  StateMatrix _velocity;
+  StateMatrix _acceleration;
   std::vector<float> _mass;
-  Eigen::Matrix4Xf _rotation;
+  Eigen::ArrayXf _inverseMass;
+  StateMatrix _rotation;
 };
@@ -0,0 +1,137 @@
+#pragma once
+#include <array>
+#include <chrono>
+#include <cstdint>
+
+#include <glad/gl.h>
+
+#include "utils.h"
+
+class ScopedTimer;
+
+/**
+ * @brief Per-frame time of the simulation and rendering stages, kept for the last historyLength frames.
+ * CPU stages are measured with ScopedTimer, GPU stages with ScopedGPUTimer (GL_TIME_ELAPSED queries).
+ * Only records while isProfilerEnabled, and only from the main thread.
+ */
+class Profiler final {
+ public:
+  DELETE_COPY(Profiler)
+  DELETE_MOVE(Profiler)
+  enum Stage : int {
+    EXTERNAL_FORCE,
+    SPRING_FORCE,
+    SPHERE_CLOTH_COLLISION,
+    SPHERE_COLLISION,
+    INTEGRATOR,
+    NORMAL,
+    // GPU stages, measured with timer queries.
+    GPU_SIMULATION,
+    GPU_NORMAL,
+    CLOTH_DRAW,
+    SPHERE_DRAW,
+    // Time between two endFrame() calls.
+    FRAME,
+    STAGE_COUNT
+  };
+  static constexpr int historyLength = 256;
+  // Frames a timer query may take before its result is read.
+  static constexpr int queryLatency = 4;
+  /**
+   * @brief Get the profiler shared by the simulation and the renderer.
+   *
+   */
+  static Profiler& getProfiler();
+  ~Profiler();
+  /**
+   * @brief Store the times measured since the last call as a new frame, call once per frame.
+   *
+   */
+  void endFrame();
+  /**
+   * @brief Forget all frames.
+   *
+   */
+  void clear();
+  static const char* getStageName(Stage stage);
+  static constexpr bool isGPUStage(Stage stage) { return stage >= GPU_SIMULATION && stage < FRAME; }
+  /**
+   * @brief Get the times of a stage in milliseconds, oldest first from historyOffset(), suits ImGui::PlotLines.
+   *
+   */
+  const float* history(Stage stage) const { return _history[stage].data(); }
+  int historyOffset() const { return nextFrame; }
+  // Number of stored frames, at most historyLength.
+  int frameCount() const { return _frameCount; }
+  float latest(Stage stage) const;
+  float average(Stage stage) const;
+  float max(Stage stage) const;
+  /**
+   * @brief Write the stored frames as CSV, one row per frame and one column per stage in milliseconds.
+   *
+   * @param path File to be written.
+   * @return Whether the file is written.
+   */
+  bool dumpCSV(const char* path) const;
+
+ private:
+  friend class ScopedTimer;
+  friend class ScopedGPUTimer;
+  Profiler() = default;
+  // Returns false when no query is free or another one is running, endQuery() must not be called then.
+  bool beginQuery(Stage stage);
+  void endQuery();
+  // Read the finished queries into the frame being recorded.
+  void collectQueries();
+
+  std::array<std::array<float, historyLength>, STAGE_COUNT> _history{};
+  // Times of the frame being recorded, in nanoseconds.
+  std::array<std::int64_t, STAGE_COUNT> current{};
+  int nextFrame = 0;
+  int _frameCount = 0;
+  std::chrono::steady_clock::time_point lastFrame{};
+  // Innermost running CPU timer, its children's time is not counted for it.
+  ScopedTimer* activeTimer = nullptr;
+  // One ring of queries per GPU stage, a query is pending until its result is read.
+  GLuint queries[STAGE_COUNT][queryLatency] = {};
+  bool isQueryPending[STAGE_COUNT][queryLatency] = {};
+  int nextQuery[STAGE_COUNT] = {};
+  bool isQueryCreated = false;
+  // GL_TIME_ELAPSED queries cannot be nested, a second begin would fail and leave its slot pending forever.
+  bool isQueryRunning = false;
+};
+
+/**
+ * @brief Add the CPU time of its lifetime to a stage, excluding the time of the timers nested in it.
+ *
+ */
+class ScopedTimer final {
+ public:
+  DELETE_COPY(ScopedTimer)
+  DELETE_MOVE(ScopedTimer)
+  explicit ScopedTimer(Profiler::Stage stage) noexcept;
+  ~ScopedTimer();
+
+ private:
+  friend class Profiler;
+  Profiler::Stage stage;
+  bool isActive;
+  ScopedTimer* parent = nullptr;
+  std::chrono::steady_clock::time_point start;
+  std::int64_t childNanoseconds = 0;
+};
+
+/**
+ * @brief Measure the GPU time of the commands issued in its lifetime, cannot be nested.
+ *
+ */
+class ScopedGPUTimer final {
+ public:
+  DELETE_COPY(ScopedGPUTimer)
+  DELETE_MOVE(ScopedGPUTimer)
+  explicit ScopedGPUTimer(Profiler::Stage stage) noexcept;
+  ~ScopedGPUTimer();
+
+ private:
+  bool isActive;
+};
@@ -0,0 +1,143 @@
+#pragma once
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "camera.h"
+#include "particles.h"
+#include "utils.h"
+
+/**
+ * @brief Write the inputs of every frame of the main loop, to replay the same session later.
+ * The file is a 16 byte header (magic "HW1R", version, config field count, 0), then one record per frame: the
+ * configs the GUI changed, the camera if it moved and, every keyframeInterval frames, the particle positions and
+ * velocities. Only what changed since the previous frame is written, a keyframe is XOR-ed with the previous one so
+ * particles that barely moved take a few bytes. Values are in native byte order.
+ */
+class Recorder final {
+ public:
+  DELETE_COPY(Recorder)
+  DELETE_MOVE(Recorder)
+  /**
+   * @brief Construct a new Recorder object.
+   *
+   * @param particles_ The particles of the keyframes, must outlive the recorder.
+   */
+  explicit Recorder(std::vector<Particles*> particles_);
+  ~Recorder() { close(); }
+  /**
+   * @brief Start a recording, closing the current one.
+   *
+   * @param path File to write.
+   * @param keyframeInterval_ Frames between two keyframes, 0 for none.
+   * @return false if the file cannot be written.
+   */
+  bool open(const char* path, int keyframeInterval_);
+  void close();
+  bool isOpen() const { return file != nullptr; }
+  /**
+   * @brief Record the configs and the camera a frame runs with, call after the camera moved.
+   *
+   */
+  void beginFrame(Camera& camera);
+  /**
+   * @brief Add a keyframe when one is due, then write the frame. Call after the simulation of the frame.
+   *
+   * @param isOnGPU The cloth is simulated on the GPU, its particles are not up to date and no keyframe is written.
+   * @return false if the file cannot be written, the recording is closed then.
+   */
+  bool endFrame(bool isOnGPU);
+
+ private:
+  std::vector<Particles*> particles;
+  std::FILE* file = nullptr;
+  int keyframeInterval = 0;
+  int frameIndex = 0;
+  // The config values and the camera of the last frame written, empty before the first one.
+  std::vector<unsigned char> lastConfigs;
+  std::vector<float> lastCamera;
+  // The record being built and the last keyframe of each particles.
+  std::vector<unsigned char> record;
+  std::vector<std::vector<std::uint32_t>> references;
+  std::vector<std::uint32_t> words;
+};
+
+/**
+ * @brief Drive the main loop from a file written by Recorder, faster than real time.
+ * The file is read into memory when opened, so replaying does no I/O. The recorded configs and camera replace the
+ * live ones every frame, and the particles are compared with the recorded keyframes.
+ */
+class Replayer final {
+ public:
+  DELETE_COPY(Replayer)
+  DELETE_MOVE(Replayer)
+  /**
+   * @brief Construct a new Replayer object.
+   *
+   * @param particles_ The same particles the recorder had, must outlive the replayer.
+   */
+  explicit Replayer(std::vector<Particles*> particles_);
+  /**
+   * @brief Load a recording.
+   *
+   * @return false if the file cannot be read or is not a recording.
+   */
+  bool open(const char* path);
+  bool isOpen() const { return !data.empty(); }
+  /**
+   * @brief Apply the configs and the camera of the next frame.
+   *
+   * @return false when the recording ended or is broken, the frame should not run.
+   */
+  bool beginFrame(Camera& camera);
+  // Whether the camera was moved by the last beginFrame.
+  bool isCameraMoved() const { return cameraMoved; }
+  /**
+   * @brief Compare the particles with the keyframe of the frame, if it has one.
+   *
+   * @param isOnGPU The cloth is simulated on the GPU, its particles are not compared.
+   */
+  void endFrame(bool isOnGPU);
+  // Whether the replay stopped at a broken record instead of the end of the file.
+  bool hasError() const { return isBroken; }
+  int frameCount() const { return static_cast<int>(frameTimes.size()); }
+  // Keyframes compared, and the ones whose particles were not exactly the recorded ones.
+  int keyframeCount() const { return comparedKeyframes; }
+  int divergedKeyframeCount() const { return divergedKeyframes; }
+  // Largest difference of a particle coordinate to a keyframe.
+  float maxDivergence() const { return _maxDivergence; }
+  // Mean time between two beginFrame calls in milliseconds.
+  double averageFrameTime() const;
+  /**
+   * @brief Write the time of each frame as CSV, to compare builds replaying the same recording.
+   *
+   * @param path File to be written.
+   * @return Whether the file is written.
+   */
+  bool writeTrace(const char* path) const;
+
+ private:
+  bool read(void* value, std::size_t size);
+
+  std::vector<Particles*> particles;
+  std::vector<unsigned char> data;
+  std::size_t cursor = 0;
+  int fieldCount = 0;
+  bool isFirstFrame = true;
+  bool cameraMoved = false;
+  bool isBroken = false;
+  // The recorded config values, applied in full every frame.
+  std::vector<unsigned char> configs;
+  // The keyframe of the current frame, decoded against the previous one of each particles.
+  bool hasKeyframe = false;
+  std::vector<std::vector<std::uint32_t>> references;
+  int comparedKeyframes = 0;
+  int divergedKeyframes = 0;
+  float _maxDivergence = 0.0f;
+  std::vector<std::uint32_t> words;
+  // Milliseconds of each frame replayed.
+  std::vector<float> frameTimes;
+  std::chrono::steady_clock::time_point lastFrame{};
+};
@@ -21,6 +21,12 @@ class Shape {
    *
    */
   void computeExternalForce();
+  /**
+   * @brief Add gravity and viscous force to the accumulated acceleration and do an explicit Euler step, in one pass.
+   * The acceleration must only hold the accumulated forces (e.g. springs) and is cleared for the next step.
+   *
+   */
+  void integrateExplicitFused();
   virtual void collide(Shape* shape) = 0;
   virtual void collide(Cloth*) { return; }
   virtual void collide(Spheres*) { return; }
@@ -0,0 +1,84 @@
+#pragma once
+#include <vector>
+
+#include "backwardeuler.h"
+#include "cloth.h"
+#include "integrator.h"
+#include "sphere.h"
+#include "utils.h"
+#include "xpbd.h"
+
+class Simulation final {
+ public:
+  DELETE_COPY(Simulation)
+  DELETE_MOVE(Simulation)
+  /**
+   * @brief Simulate a cloth with spheres, both must outlive the simulation.
+   *
+   */
+  Simulation(Cloth& cloth, Spheres& spheres);
+  /**
+   * @brief Do one step simulation: external force, spring force and collisions. Used in some implicit methods.
+   *
+   */
+  void simulateOneStep();
+  /**
+   * @brief Simulate some steps and integrate each of them.
+   *
+   * @param integrator Index of the integrator, same as currentIntegrator. 0 uses the fused path if isExplicitEulerFused.
+   * 4 is the backward Euler, 5 is XPBD.
+   * @param stepCount Number of steps.
+   */
+  void simulate(int integrator, int stepCount);
+  /**
+   * @brief Simulate the spheres only with explicit Euler, used when the cloth is simulated elsewhere (e.g. on GPU).
+   *
+   * @param stepCount Number of steps.
+   */
+  void simulateSpheres(int stepCount);
+  /**
+   * @brief Simulate frameTime seconds with as few steps as the stability estimate allows.
+   * deltaTime is changed during the call and restored after it.
+   *
+   * @param integrator Index of the integrator, same as simulate().
+   * @param frameTime Simulated time in seconds.
+   * @return Number of steps taken.
+   */
+  int simulateAdaptive(int integrator, float frameTime);
+  /**
+   * @brief Estimate the largest stable step from the springs and the current velocities.
+   * Backward Euler and XPBD are stable at any step, only the collision bound of the velocities applies to them.
+   *
+   * @param integrator Index of the integrator, same as simulate().
+   * @return Step size in seconds, the spring bound already scaled by adaptiveSafetyFactor.
+   */
+  float estimateStableTimeStep(int integrator) const;
+  /**
+   * @brief Get the conjugate gradient iterations of the last backward Euler step.
+   *
+   */
+  int backwardEulerIterationCount() const { return backwardEuler.lastIterationCount(); }
+
+ private:
+  template <class IntegratorType>
+  void simulate(const IntegratorType& integrator, int stepCount);
+  /**
+   * @brief Explicit Euler with gravity, damping and the update done in one sweep, after springs and collisions.
+   *
+   */
+  void simulateFused(int stepCount);
+  // The spring bound of the integrators that evaluate forces at explicit predictions.
+  float estimateExplicitTimeStep() const;
+
+  Cloth& cloth;
+  Spheres& spheres;
+  std::vector<Particles*> particles;
+  std::vector<Particles*> sphereParticles;
+  ExplicitEuler explicitEuler;
+  ImplicitEuler implicitEuler;
+  MidpointEuler midpointEuler;
+  RungeKuttaFourth rk4;
+  BackwardEuler backwardEuler;
+  XPBD xpbd;
+  bool wasExplicitEulerFused = false;
+};
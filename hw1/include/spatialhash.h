@@ -0,0 +1,47 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+
+/**
+ * @brief Uniform grid over a point set, stored as a hashed table of cells.
+ *
+ */
+class SpatialHash {
+ public:
+  /**
+   * @brief Bin the points into cells. Only rebuilds the table if some point has changed its cell.
+   *
+   * @param points The points to be binned, one per column.
+   * @param cellSize Edge length of a cell, the grid is a single cell if it is not positive.
+   */
+  void update(const Eigen::Ref<const Eigen::Matrix4Xf>& points, float cellSize);
+  /**
+   * @brief Append the points in cells overlapping the box to candidates. A point may be appended more than once.
+   *
+   * @param lower The minimum corner of the box.
+   * @param upper The maximum corner of the box.
+   * @param candidates Indices of the points found.
+   */
+  void query(const Eigen::Ref<const Eigen::Vector4f>& lower, const Eigen::Ref<const Eigen::Vector4f>& upper,
+             std::vector<int>& candidates) const;
+
+ private:
+  int cell(float x) const { return static_cast<int>(std::floor(x * inverseCellSize)); }
+  std::uint32_t bucket(int x, int y, int z) const {
+    return ((static_cast<std::uint32_t>(x) * 73856093u) ^ (static_cast<std::uint32_t>(y) * 19349663u) ^
+            (static_cast<std::uint32_t>(z) * 83492791u)) &
+           (tableSize - 1);
+  }
+
+  float cellSize = 0.0f;
+  float inverseCellSize = 0.0f;
+  std::uint32_t tableSize = 0;
+  // Bucket of each point from the last update.
+  std::vector<std::uint32_t> pointBuckets;
+  // Points of bucket b are sortedPoints[bucketStart[b], bucketStart[b + 1]).
+  std::vector<int> bucketStart;
+  std::vector<int> sortedPoints;
+};
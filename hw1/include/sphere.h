@@ -1,9 +1,12 @@
 #pragma once
 #include <Eigen/Core>
+#include <memory>
 #include <vector>
 
 #include "buffer.h"
 #include "shape.h"
+#include "spatialhash.h"
+#include "sweepandprune.h"
 #include "utils.h"
 #include "vertexarray.h"
 
@@ -12,6 +15,12 @@ class Spheres final : public Shape {
   MOVE_ONLY(Spheres)
   static Spheres& initSpheres();
   void addSphere(const Eigen::Ref<const Eigen::Vector4f>& position, float size);
+  /**
+   * @brief Remove all spheres, the allocated capacity is kept.
+   *
+   */
+  void clear();
+  int count() const { return sphereCount; }
   void draw() const;
   void collide(Shape* shape) override;
   void collide(Cloth* cloth) override;
@@ -20,12 +29,27 @@ class Spheres final : public Shape {
 
  private:
   Spheres();
+  /**
+   * @brief Narrow phase of collide(), resolve sphere j and i if they overlap.
+   *
+   */
+  void resolveCollision(int j, int i);
 
   int sphereCount;
   std::vector<float> _radius;
-  VertexArray vao;
-  ArrayBuffer vbo;
-  ArrayBuffer offsets;
-  ArrayBuffer sizes;
-  ElementArrayBuffer ebo;
+  // Broad phase of collide(Cloth*), reused across steps.
+  SpatialHash clothGrid;
+  std::vector<int> contactCandidates;
+  std::vector<float> clothDrift;
+  // Broad phase of collide(), reused across steps.
+  SweepAndPrune broadPhase;
+  // OpenGL objects, not created in headless mode.
+  struct RenderResources {
+    VertexArray vao;
+    ArrayBuffer vbo;
+    StreamingArrayBuffer offsets;
+    ArrayBuffer sizes;
+    ElementArrayBuffer ebo;
+  };
+  std::unique_ptr<RenderResources> render;
 };
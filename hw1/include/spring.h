@@ -1,4 +1,7 @@
 #pragma once
+#include <vector>
+
+#include <Eigen/Core>
 
 class Spring {
  public:
@@ -17,3 +20,30 @@ class Spring {
   float _length;
   Type _springType;
 };
+
+/**
+ * @brief Structure-of-arrays copy of the springs, packed for the vectorized force kernel.
+ *
+ */
+class SpringArrays {
+ public:
+  /**
+   * @brief Rebuild the arrays from the given springs.
+   *
+   * @param springs The springs to be packed.
+   * @param typeStiffness Multiplier of springCoef for each spring type, indexed by Spring::Type.
+   */
+  void assign(const std::vector<Spring>& springs, const float (&typeStiffness)[3]);
+  int size() const { return static_cast<int>(_startIndex.size()); }
+
+  const std::vector<int>& startIndex() const { return _startIndex; }
+  const std::vector<int>& endIndex() const { return _endIndex; }
+  const Eigen::ArrayXf& restLength() const { return _restLength; }
+  const Eigen::ArrayXf& stiffness() const { return _stiffness; }
+
+ private:
+  std::vector<int> _startIndex;
+  std::vector<int> _endIndex;
+  Eigen::ArrayXf _restLength;
+  Eigen::ArrayXf _stiffness;
+};
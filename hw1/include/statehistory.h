@@ -0,0 +1,58 @@
+#pragma once
+#include <cstddef>
+#include <vector>
+
+#include "particles.h"
+#include "utils.h"
+
+/**
+ * @brief Ring of the recent frames of some particles, for rewinding and scrubbing.
+ * Every slot is allocated the first time it is written and reused after that, so recording does not allocate
+ * while the particle counts stay the same.
+ */
+class StateHistory final {
+ public:
+  DELETE_COPY(StateHistory)
+  DELETE_MOVE(StateHistory)
+  /**
+   * @brief Construct a new StateHistory object.
+   *
+   * @param particles_ The particles to record, must outlive the history.
+   * @param maxFrameCount_ Most frames kept.
+   * @param memoryBudget_ Most bytes used by the frames, the frame count is lowered to fit.
+   */
+  StateHistory(std::vector<Particles*> particles_, int maxFrameCount_, std::size_t memoryBudget_);
+  /**
+   * @brief Record the current state as the newest frame. Frames newer than the one seeked to are dropped first.
+   *
+   */
+  void push();
+  /**
+   * @brief Restore a recorded frame, the frames are kept until the next push.
+   *
+   * @param age Frames before the newest one, 0 is the newest.
+   * @return false if there is no such frame.
+   */
+  bool seek(int age);
+  /**
+   * @brief Drop all frames, must be called when the particle count changes.
+   *
+   */
+  void clear();
+  // Number of frames recorded.
+  int size() const { return frameCount; }
+  // Age of the last frame seeked to, 0 after a push.
+  int position() const { return seekAge; }
+
+ private:
+  int capacity() const;
+
+  std::vector<Particles*> particles;
+  int maxFrameCount;
+  std::size_t memoryBudget;
+  // frames[slot][k] is particles[k] in that slot.
+  std::vector<std::vector<ParticleState>> frames;
+  int newestSlot = -1;
+  int frameCount = 0;
+  int seekAge = 0;
+};
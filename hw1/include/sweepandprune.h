@@ -0,0 +1,33 @@
+#pragma once
+#include <utility>
+#include <vector>
+
+#include <Eigen/Core>
+
+/**
+ * @brief Sort-and-sweep broad phase over spheres. The sorted axis is kept between updates,
+ * so a frame-to-frame coherent scene is re-sorted in nearly linear time.
+ *
+ */
+class SweepAndPrune {
+ public:
+  /**
+   * @brief Find all pairs of spheres whose bounding boxes overlap.
+   *
+   * @param position Sphere centers, one per column.
+   * @param radius Sphere radii.
+   * @param count The number of spheres in use.
+   */
+  void update(const Eigen::Ref<const Eigen::Matrix4Xf>& position, const std::vector<float>& radius, int count);
+  /**
+   * @brief Candidate pairs (j, i) with j < i from the last update, sorted by j and then i.
+   *
+   */
+  const std::vector<std::pair<int, int>>& pairs() const { return _pairs; }
+
+ private:
+  // Sphere indices sorted by the lower end of their interval on the x axis.
+  std::vector<int> order;
+  std::vector<float> lowerX;
+  std::vector<std::pair<int, int>> _pairs;
+};
@@ -0,0 +1,64 @@
+#pragma once
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "utils.h"
+
+class ThreadPool final {
+ public:
+  DELETE_COPY(ThreadPool)
+  DELETE_MOVE(ThreadPool)
+  ~ThreadPool();
+  /**
+   * @brief Get the thread pool shared by the simulation.
+   *
+   */
+  static ThreadPool& getPool();
+  /**
+   * @brief Set how many threads run a parallel loop, including the calling thread.
+   *
+   * @param count Thread count, clamped to at least 1.
+   */
+  void setThreadCount(int count);
+  int getThreadCount() const { return static_cast<int>(workers.size()) + 1; }
+  /**
+   * @brief Split [0, count) into contiguous chunks and call func(begin, end) on each. Blocks until all are done.
+   *
+   * @param count The number of items.
+   * @param func Callable with signature void(int begin, int end), must be safe to call concurrently.
+   * @param grainSize Minimum items per chunk, small loops run on the calling thread only.
+   */
+  template <class Func>
+  void parallelFor(int count, Func&& func, int grainSize = 256) {
+    using FuncType = std::remove_reference_t<Func>;
+    auto invoke = [](void* context, int begin, int end) { (*static_cast<FuncType*>(context))(begin, end); };
+    run(count, grainSize, invoke, const_cast<void*>(static_cast<const void*>(&func)));
+  }
+
+ private:
+  using Task = void (*)(void*, int, int);
+  explicit ThreadPool(int count);
+  void run(int count, int grainSize, Task task, void* context);
+  void workerLoop();
+  void work();
+  void stopWorkers();
+
+  std::vector<std::thread> workers;
+  std::mutex mutex;
+  std::condition_variable wakeCondition;
+  std::condition_variable doneCondition;
+  bool isStopping = false;
+  unsigned int generation = 0;
+  int activeWorkers = 0;
+  // Current job, written under the mutex before waking the workers.
+  Task task = nullptr;
+  void* context = nullptr;
+  int itemCount = 0;
+  int chunkSize = 0;
+  int chunkCount = 0;
+  std::atomic<int> nextChunk = 0;
+};
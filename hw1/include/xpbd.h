@@ -0,0 +1,67 @@
+#pragma once
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "cloth.h"
+#include "spatialhash.h"
+#include "sphere.h"
+#include "utils.h"
+
+/**
+ * @brief Extended position based dynamics (Macklin et al. 2016), an alternative to the force based integrators.
+ * The springs are distance constraints with compliance 1 / (springCoef * stiffness) and damping damperCoef, the
+ * spheres are contact constraints. Each step does xpbdIterationCount Gauss-Seidel sweeps over the spring color
+ * batches, so the cost of a step is fixed. The spheres still collide with each other through Spheres::collide().
+ */
+class XPBD final {
+ public:
+  DELETE_COPY(XPBD)
+  DELETE_MOVE(XPBD)
+  /**
+   * @brief Construct a new XPBD object.
+   *
+   * @param cloth_ The cloth whose springs become distance constraints, must outlive the solver.
+   * @param spheres_ The spheres the cloth collides with, must outlive the solver.
+   */
+  XPBD(Cloth& cloth_, Spheres& spheres_) noexcept : cloth(cloth_), spheres(spheres_) {}
+  /**
+   * @brief Simulate steps of deltaTime.
+   *
+   * @param stepCount Number of steps.
+   */
+  void simulate(int stepCount);
+
+ private:
+  /**
+   * @brief Apply the external forces to the velocities and move the particles by them.
+   *
+   */
+  void predict();
+  /**
+   * @brief Project the springs in [begin, end) of one color batch.
+   *
+   */
+  void solveDistanceConstraints(int begin, int end);
+  /**
+   * @brief Push the cloth particles out of the spheres with friction, both sides moved by their inverse mass.
+   *
+   */
+  void solveContacts();
+  /**
+   * @brief Find the cloth particles that may touch each sphere during the step.
+   *
+   */
+  void findContacts();
+
+  Cloth& cloth;
+  Spheres& spheres;
+  // Positions at the start of the step, the velocity is the displacement over deltaTime.
+  Eigen::Matrix4Xf previousCloth, previousSpheres;
+  // Lagrange multiplier of each spring, cleared every step.
+  Eigen::ArrayXf lambda;
+  SpatialHash clothGrid;
+  // Candidates of sphere j are contactCandidates[contactOffsets[j], contactOffsets[j + 1]).
+  std::vector<int> contactCandidates;
+  std::vector<int> contactOffsets;
+};
@@ -0,0 +1,123 @@
+#include "allocationcounter.h"
+
+#ifdef HW1_COUNT_ALLOCATIONS
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <new>
+
+namespace {
+std::atomic<std::size_t> allocationCount = 0;
+}  // namespace
+
+std::size_t getAllocationCount() noexcept { return allocationCount.load(std::memory_order_relaxed); }
+
+#ifdef __GLIBC__
+// Eigen allocates its dense storage with malloc directly, and operator new calls malloc too, so count malloc itself.
+// The blocks come from glibc's own allocator, its free releases them.
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* pointer, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+
+void* malloc(std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+void* calloc(std::size_t count, std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+void* realloc(void* pointer, std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(pointer, size);
+}
+void* aligned_alloc(std::size_t alignment, std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+int posix_memalign(void** pointer, std::size_t alignment, std::size_t size) noexcept {
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  *pointer = __libc_memalign(alignment, size);
+  return *pointer || size == 0 ? 0 : ENOMEM;
+}
+}
+#else
+namespace {
+void* countedAllocate(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return std::malloc(size == 0 ? 1 : size);
+}
+
+void* countedAllocate(std::size_t size, std::align_val_t alignment) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  std::size_t align = static_cast<std::size_t>(alignment);
+#ifdef _WIN32
+  return _aligned_malloc(size == 0 ? 1 : size, align);
+#else
+  // aligned_alloc requires size to be a multiple of the alignment
+  return std::aligned_alloc(align, (size + align - 1) / align * align);
+#endif
+}
+
+void countedFree(void* pointer, std::align_val_t) noexcept {
+#ifdef _WIN32
+  _aligned_free(pointer);
+#else
+  std::free(pointer);
+#endif
+}
+}  // namespace
+
+// Without glibc's malloc to wrap, only operator new is counted.
+void* operator new(std::size_t size) {
+  if (void* pointer = countedAllocate(size)) return pointer;
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t size) {
+  if (void* pointer = countedAllocate(size)) return pointer;
+  throw std::bad_alloc();
+}
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size); }
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept { return countedAllocate(size); }
+void* operator new(std::size_t size, std::align_val_t alignment) {
+  if (void* pointer = countedAllocate(size, alignment)) return pointer;
+  throw std::bad_alloc();
+}
+void* operator new[](std::size_t size, std::align_val_t alignment) {
+  if (void* pointer = countedAllocate(size, alignment)) return pointer;
+  throw std::bad_alloc();
+}
+void* operator new(std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return countedAllocate(size, alignment);
+}
+void* operator new[](std::size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  return countedAllocate(size, alignment);
+}
+
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete[](void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, std::size_t) noexcept { std::free(pointer); }
+void operator delete(void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete[](void* pointer, const std::nothrow_t&) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::align_val_t alignment) noexcept { countedFree(pointer, alignment); }
+void operator delete[](void* pointer, std::align_val_t alignment) noexcept { countedFree(pointer, alignment); }
+void operator delete(void* pointer, std::size_t, std::align_val_t alignment) noexcept {
+  countedFree(pointer, alignment);
+}
+void operator delete[](void* pointer, std::size_t, std::align_val_t alignment) noexcept {
+  countedFree(pointer, alignment);
+}
+void operator delete(void* pointer, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  countedFree(pointer, alignment);
+}
+void operator delete[](void* pointer, std::align_val_t alignment, const std::nothrow_t&) noexcept {
+  countedFree(pointer, alignment);
+}
+#endif
+#else
+std::size_t getAllocationCount() noexcept { return 0; }
+#endif
@@ -0,0 +1,184 @@
+#include "backwardeuler.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "configs.h"
+#include "threadpool.h"
+
+namespace {
+// Offsets of the block (row, column) in a row major matrix whose pattern has full 3x3 blocks.
+std::array<int, 3> findBlock(const Eigen::SparseMatrix<float, Eigen::RowMajor>& matrix, int row, int column) {
+  std::array<int, 3> offsets{};
+  for (int k = 0; k < 3; ++k) {
+    const int* begin = matrix.innerIndexPtr() + matrix.outerIndexPtr()[3 * row + k];
+    const int* end = matrix.innerIndexPtr() + matrix.outerIndexPtr()[3 * row + k + 1];
+    offsets[k] = static_cast<int>(std::lower_bound(begin, end, 3 * column) - matrix.innerIndexPtr());
+  }
+  return offsets;
+}
+
+// Add (or subtract) a 3x3 matrix into a block.
+template <int Sign>
+void addBlock(float* values, const std::array<int, 3>& offsets, const Eigen::Matrix3f& block) {
+  for (int k = 0; k < 3; ++k) {
+    for (int l = 0; l < 3; ++l) values[offsets[k] + l] += Sign * block(k, l);
+  }
+}
+}  // namespace
+
+void BackwardEuler::integrate(const std::vector<Particles*>& particles,
+                              std::function<void(void)> simulateOneStep) const {
+  step(particles, simulateOneStep);
+}
+
+void BackwardEuler::buildPattern() const {
+  const SpringArrays& springs = cloth.springArrays();
+  const int particleCount = cloth.particles().getCapacity();
+  std::vector<Eigen::Triplet<float>> entries;
+  entries.reserve(9 * (particleCount + 2 * springs.size()));
+  auto addEntries = [&entries](int row, int column) {
+    for (int k = 0; k < 3; ++k) {
+      for (int l = 0; l < 3; ++l) entries.emplace_back(3 * row + k, 3 * column + l, 0.0f);
+    }
+  };
+  for (int i = 0; i < particleCount; ++i) addEntries(i, i);
+  for (int s = 0; s < springs.size(); ++s) {
+    addEntries(springs.startIndex()[s], springs.endIndex()[s]);
+    addEntries(springs.endIndex()[s], springs.startIndex()[s]);
+  }
+  system.resize(3 * particleCount, 3 * particleCount);
+  system.setFromTriplets(entries.begin(), entries.end());
+  system.makeCompressed();
+
+  diagonalBlocks.resize(particleCount);
+  for (int i = 0; i < particleCount; ++i) diagonalBlocks[i] = findBlock(system, i, i);
+  startEndBlocks.resize(springs.size());
+  endStartBlocks.resize(springs.size());
+  for (int s = 0; s < springs.size(); ++s) {
+    startEndBlocks[s] = findBlock(system, springs.startIndex()[s], springs.endIndex()[s]);
+    endStartBlocks[s] = findBlock(system, springs.endIndex()[s], springs.startIndex()[s]);
+  }
+  for (auto* vector : {&rhs, &velocityChange, &residual, &direction, &preconditioned, &product, &inverseDiagonal})
+    vector->setZero(3 * particleCount);
+  patternRevision = cloth.layoutRevision();
+}
+
+void BackwardEuler::assemble() const {
+  const SpringArrays& springs = cloth.springArrays();
+  const std::vector<int>& batchOffsets = cloth.springBatchOffsets();
+  Particles& particles = cloth.particles();
+  const float h = deltaTime;
+  float* values = system.valuePtr();
+  std::fill(values, values + system.nonZeros(), 0.0f);
+
+  // Mass and viscosity on the diagonal, f = m a of the step already computed on the right hand side.
+  auto initialize = [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      float inverseMass = particles.inverseMass(i);
+      if (inverseMass == 0.0f) {
+        // Fixed: the row becomes dv_i = 0.
+        for (int k = 0; k < 3; ++k) values[diagonalBlocks[i][k] + k] = 1.0f;
+        rhs.segment<3>(3 * i).setZero();
+        continue;
+      }
+      float mass = 1.0f / inverseMass;
+      for (int k = 0; k < 3; ++k) values[diagonalBlocks[i][k] + k] = mass + h * viscousCoef;
+      rhs.segment<3>(3 * i) = h * mass * particles.acceleration(i).head<3>();
+    }
+  };
+  ThreadPool::getPool().parallelFor(particles.getCapacity(), initialize, 1024);
+
+  // Springs of a batch share no particle, so their diagonal blocks and right hand sides are written race free.
+  for (size_t batch = 0; batch + 1 < batchOffsets.size(); ++batch) {
+    auto accumulate = [&](int begin, int end) {
+      for (int s = begin; s < end; ++s) {
+        int i = springs.startIndex()[s], j = springs.endIndex()[s];
+        Eigen::Vector3f d = (particles.position(j) - particles.position(i)).head<3>();
+        float length = d.norm();
+        if (length == 0.0f) continue;
+        Eigen::Vector3f u = d / length;
+        Eigen::Matrix3f uu = u * u.transpose();
+        // df_i/dx_j of the spring, the transverse part is dropped in compression to keep the system definite.
+        float stiffness = springCoef * springs.stiffness()[s];
+        float transverse = std::max(0.0f, 1.0f - springs.restLength()[s] / length);
+        Eigen::Matrix3f forceJacobian = stiffness * (uu + transverse * (Eigen::Matrix3f::Identity() - uu));
+        Eigen::Matrix3f block = h * damperCoef * uu + h * h * forceJacobian;
+        // h^2 df/dx v, the change of the spring force along the current velocities.
+        Eigen::Vector3f stretchRate =
+            h * h * (forceJacobian * (particles.velocity(j) - particles.velocity(i)).head<3>());
+        bool isStartFree = particles.inverseMass(i) != 0.0f;
+        bool isEndFree = particles.inverseMass(j) != 0.0f;
+        if (isStartFree) {
+          addBlock<1>(values, diagonalBlocks[i], block);
+          rhs.segment<3>(3 * i) += stretchRate;
+        }
+        if (isEndFree) {
+          addBlock<1>(values, diagonalBlocks[j], block);
+          rhs.segment<3>(3 * j) -= stretchRate;
+        }
+        if (isStartFree && isEndFree) {
+          addBlock<-1>(values, startEndBlocks[s], block);
+          addBlock<-1>(values, endStartBlocks[s], block);
+        }
+      }
+    };
+    ThreadPool::getPool().parallelFor(batchOffsets[batch + 1] - batchOffsets[batch],
+                                      [&](int begin, int end) {
+                                        accumulate(begin + batchOffsets[batch], end + batchOffsets[batch]);
+                                      },
+                                      512);
+  }
+  for (int i = 0; i < particles.getCapacity(); ++i) {
+    for (int k = 0; k < 3; ++k) inverseDiagonal[3 * i + k] = 1.0f / values[diagonalBlocks[i][k] + k];
+  }
+}
+
+void BackwardEuler::multiply(const Eigen::VectorXf& p, Eigen::VectorXf& q) const {
+  const int* outer = system.outerIndexPtr();
+  const int* inner = system.innerIndexPtr();
+  const float* values = system.valuePtr();
+  auto rows = [&](int begin, int end) {
+    for (int row = begin; row < end; ++row) {
+      float sum = 0.0f;
+      for (int k = outer[row]; k < outer[row + 1]; ++k) sum += values[k] * p[inner[k]];
+      q[row] = sum;
+    }
+  };
+  ThreadPool::getPool().parallelFor(static_cast<int>(system.rows()), rows, 1024);
+}
+
+void BackwardEuler::solve() const {
+  // Preconditioned conjugate gradient, see Shewchuk's "An Introduction to the Conjugate Gradient Method".
+  multiply(velocityChange, product);
+  residual = rhs - product;
+  preconditioned = inverseDiagonal.cwiseProduct(residual);
+  direction = preconditioned;
+  float delta = residual.dot(preconditioned);
+  const float target = backwardEulerTolerance * backwardEulerTolerance * rhs.squaredNorm();
+  iterationCount = 0;
+  while (iterationCount < backwardEulerMaxIterations && residual.squaredNorm() > target) {
+    multiply(direction, product);
+    float curvature = direction.dot(product);
+    if (curvature <= 0.0f) break;
+    float alpha = delta / curvature;
+    velocityChange += alpha * direction;
+    residual -= alpha * product;
+    preconditioned = inverseDiagonal.cwiseProduct(residual);
+    float nextDelta = residual.dot(preconditioned);
+    direction = preconditioned + (nextDelta / delta) * direction;
+    delta = nextDelta;
+    ++iterationCount;
+  }
+}
+
+void BackwardEuler::integrateCloth() const {
+  Particles& particles = cloth.particles();
+  if (patternRevision != cloth.layoutRevision()) buildPattern();
+  assemble();
+  solve();
+  for (int i = 0; i < particles.getCapacity(); ++i) {
+    particles.velocity(i).head<3>() += velocityChange.segment<3>(3 * i);
+    particles.statePosition(i) += deltaTime * particles.velocity(i);
+  }
+}
@@ -0,0 +1,207 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#define GLAD_GL_IMPLEMENTATION
+#include <glad/gl.h>
+#undef GLAD_GL_IMPLEMENTATION
+
+#include "allocationcounter.h"
+#include "cloth.h"
+#include "configs.h"
+#include "simulation.h"
+#include "sphere.h"
+#include "threadpool.h"
+
+namespace {
+// Index 0 - 5 are the same as currentIntegrator, fused is explicit Euler with isExplicitEulerFused.
+constexpr const char* integratorNames[] = {"explicit", "implicit", "midpoint", "rk4", "backward", "xpbd", "fused"};
+constexpr int integratorTypeCount = 7;
+constexpr int fusedIntegrator = 6;
+
+struct ClothSize {
+  int width;
+  int height;
+};
+
+struct BenchmarkOptions {
+  std::vector<ClothSize> clothSizes{{25, 25}, {50, 50}, {100, 100}};
+  std::vector<int> sphereCounts{4};
+  std::vector<int> integrators{0, 1, 2, 3, 4, 5, 6};
+  int stepCount = 2000;
+  int warmupCount = 100;
+  bool isJson = false;
+};
+
+struct BenchmarkResult {
+  int integrator;
+  ClothSize clothSize;
+  int sphereCount;
+  int springCount;
+  int threadCount;
+  int stepCount;
+  double seconds;
+  std::size_t allocationCount;
+};
+
+void printUsage(const char* program) {
+  std::cerr << "Usage: " << program << " [--cloth N|WxH,...] [--spheres N,...] [--integrator NAME,...|all]"
+            << " [--steps N] [--warmup N] [--threads N] [--format csv|json]\n"
+            << "  integrators: explicit, implicit, midpoint, rk4, backward, xpbd, fused" << std::endl;
+  exit(EXIT_FAILURE);
+}
+
+std::vector<std::string> split(const char* list) {
+  std::vector<std::string> items;
+  std::string current;
+  for (const char* c = list; *c != '\0'; ++c) {
+    if (*c == ',') {
+      items.push_back(current);
+      current.clear();
+    } else {
+      current.push_back(*c);
+    }
+  }
+  items.push_back(current);
+  return items;
+}
+
+BenchmarkOptions parseArguments(int argc, char** argv) {
+  BenchmarkOptions options;
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 >= argc) printUsage(argv[0]);
+    const char* value = argv[++i];
+    if (std::strcmp(argv[i - 1], "--cloth") == 0) {
+      // Same format as HW1 --cloth, but a comma separated list
+      options.clothSizes.clear();
+      for (const auto& item : split(value)) {
+        char* end = nullptr;
+        int width = static_cast<int>(std::strtol(item.c_str(), &end, 10));
+        int height = (*end == 'x') ? static_cast<int>(std::strtol(end + 1, nullptr, 10)) : width;
+        options.clothSizes.push_back(
+            {std::clamp(width, 2, maxParticlesPerEdge), std::clamp(height, 2, maxParticlesPerEdge)});
+      }
+    } else if (std::strcmp(argv[i - 1], "--spheres") == 0) {
+      options.sphereCounts.clear();
+      for (const auto& item : split(value)) options.sphereCounts.push_back(std::max(0, std::atoi(item.c_str())));
+    } else if (std::strcmp(argv[i - 1], "--integrator") == 0) {
+      options.integrators.clear();
+      for (const auto& item : split(value)) {
+        if (item == "all") {
+          for (int type = 0; type < integratorTypeCount; ++type) options.integrators.push_back(type);
+          continue;
+        }
+        auto found = std::find_if(std::begin(integratorNames), std::end(integratorNames),
+                                  [&item](const char* name) { return item == name; });
+        if (found == std::end(integratorNames)) printUsage(argv[0]);
+        options.integrators.push_back(static_cast<int>(found - std::begin(integratorNames)));
+      }
+    } else if (std::strcmp(argv[i - 1], "--steps") == 0) {
+      options.stepCount = std::max(1, std::atoi(value));
+    } else if (std::strcmp(argv[i - 1], "--warmup") == 0) {
+      options.warmupCount = std::max(0, std::atoi(value));
+    } else if (std::strcmp(argv[i - 1], "--threads") == 0) {
+      simulationThreadCount = std::max(1, std::atoi(value));
+      ThreadPool::getPool().setThreadCount(simulationThreadCount);
+    } else if (std::strcmp(argv[i - 1], "--format") == 0) {
+      if (std::strcmp(value, "csv") != 0 && std::strcmp(value, "json") != 0) printUsage(argv[0]);
+      options.isJson = std::strcmp(value, "json") == 0;
+    } else {
+      printUsage(argv[0]);
+    }
+  }
+  return options;
+}
+
+void resetSpheres(Spheres& spheres, int count) {
+  spheres.clear();
+  // The first four are the spheres of HW1, the others are small ones in layers above the cloth.
+  const Eigen::Vector4f defaultPositions[] = {{-0.75f, 1, -0.75f, 1}, {0.75f, 1, -0.75f, 1},
+                                              {-0.75f, 1, 0.75f, 1}, {0.75f, 1, 0.75f, 1}};
+  for (int i = 0; i < count; ++i) {
+    if (i < 4) {
+      spheres.addSphere(defaultPositions[i], 0.5f);
+      continue;
+    }
+    int k = i - 4;
+    Eigen::Vector4f position(-1.8f + 0.4f * (k % 10), 1.75f + 0.25f * (k / 100), -1.8f + 0.4f * (k / 10 % 10), 1);
+    spheres.addSphere(position, 0.1f);
+  }
+}
+
+BenchmarkResult run(Cloth& cloth, Spheres& spheres, const BenchmarkOptions& options, int integrator,
+                    ClothSize clothSize, int sphereCount) {
+  cloth.resize(clothSize.width, clothSize.height);
+  resetSpheres(spheres, sphereCount);
+  isExplicitEulerFused = integrator == fusedIntegrator;
+  int integratorIndex = isExplicitEulerFused ? 0 : integrator;
+
+  Simulation simulation(cloth, spheres);
+  // Let the scratch buffers and broad phases reach their steady size.
+  simulation.simulate(integratorIndex, options.warmupCount);
+  AllocationScope allocations;
+  auto start = std::chrono::steady_clock::now();
+  simulation.simulate(integratorIndex, options.stepCount);
+  std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+  return {integrator,
+          clothSize,
+          sphereCount,
+          static_cast<int>(cloth.springs().size()),
+          ThreadPool::getPool().getThreadCount(),
+          options.stepCount,
+          elapsed.count(),
+          allocations.count()};
+}
+
+void printResults(const std::vector<BenchmarkResult>& results, bool isJson) {
+  if (!isJson) {
+    std::printf(
+        "integrator,width,height,particles,springs,spheres,threads,steps,seconds,steps_per_second,"
+        "ns_per_particle_step,ns_per_spring_step,allocations\n");
+  } else {
+    std::printf("[\n");
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& result = results[i];
+    int particleCount = result.clothSize.width * result.clothSize.height;
+    double nanoseconds = result.seconds * 1e9 / result.stepCount;
+    const char* format =
+        isJson ? "  {\"integrator\": \"%s\", \"width\": %d, \"height\": %d, \"particles\": %d, \"springs\": %d, "
+                 "\"spheres\": %d, \"threads\": %d, \"steps\": %d, \"seconds\": %.6f, \"steps_per_second\": %.2f, "
+                 "\"ns_per_particle_step\": %.3f, \"ns_per_spring_step\": %.3f, \"allocations\": %zu}%s\n"
+               : "%s,%d,%d,%d,%d,%d,%d,%d,%.6f,%.2f,%.3f,%.3f,%zu%s\n";
+    const char* separator = !isJson ? "" : (i + 1 < results.size() ? "," : "");
+    std::printf(format, integratorNames[result.integrator], result.clothSize.width, result.clothSize.height,
+                particleCount, result.springCount, result.sphereCount, result.threadCount, result.stepCount,
+                result.seconds, result.stepCount / result.seconds, nanoseconds / particleCount,
+                nanoseconds / std::max(1, result.springCount), result.allocationCount, separator);
+  }
+  if (isJson) std::printf("]\n");
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchmarkOptions options = parseArguments(argc, argv);
+  // No window and no OpenGL context, the shapes only keep the simulation state.
+  isHeadless = true;
+  Cloth cloth(options.clothSizes.front().width, options.clothSizes.front().height);
+  Spheres& spheres = Spheres::initSpheres();
+
+  std::vector<BenchmarkResult> results;
+  for (ClothSize clothSize : options.clothSizes) {
+    for (int sphereCount : options.sphereCounts) {
+      for (int integrator : options.integrators) {
+        results.push_back(run(cloth, spheres, options, integrator, clothSize, sphereCount));
+      }
+    }
+  }
+  printResults(results, options.isJson);
+  return 0;
+}
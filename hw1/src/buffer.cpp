@@ -1,5 +1,14 @@
 #include "buffer.h"
 
+#include <cstring>
+
+#include "configs.h"
+
+namespace {
+// Keeps every region offset valid for glBindBufferRange on shader storage buffers too.
+constexpr GLsizeiptr regionAlignment = 256;
+}  // namespace
+
 Buffer::Buffer() noexcept : _handle(0), _size(0) { glGenBuffers(1, &_handle); }
 
 Buffer::~Buffer() { glDeleteBuffers(1, &_handle); }
@@ -23,6 +32,8 @@ void Buffer::allocate_load(GLsizeiptr size_, const void* data, GLenum usage) con
   glBufferData(getType(), _size, data, usage);
 }
 
+void Buffer::bindStorage(GLuint index) const noexcept { glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, _handle); }
+
 void UniformBuffer::bindUniformBlockIndex(GLuint index, GLuint offset, GLuint size_) const noexcept {
   bind();
   glBindBufferRange(GL_UNIFORM_BUFFER, index, _handle, offset, size_);
@@ -34,3 +45,78 @@ void UniformBuffer::bindUniformBlockIndex(GLuint index) const noexcept {
   glBindBufferBase(GL_UNIFORM_BUFFER, index, _handle);
   glBindBuffer(GL_UNIFORM_BUFFER, 0);
 }
+
+StreamingArrayBuffer::~StreamingArrayBuffer() { releaseStorage(); }
+
+void StreamingArrayBuffer::releaseStorage() const noexcept {
+  for (GLsync& fence : fences) {
+    if (fence) glDeleteSync(fence);
+    fence = nullptr;
+  }
+  if (mapped) {
+    bind();
+    glUnmapBuffer(GL_ARRAY_BUFFER);
+    mapped = nullptr;
+  }
+}
+
+void StreamingArrayBuffer::allocateRegions(GLsizeiptr regionSize_) {
+  releaseStorage();
+  _regionSize = (regionSize_ + regionAlignment - 1) / regionAlignment * regionAlignment;
+  // The last region, so the first write goes to region 0.
+  currentRegion = isBufferStorageSupported ? regionCount - 1 : 0;
+  if (!isBufferStorageSupported) {
+    allocate(_regionSize, GL_STREAM_DRAW);
+    return;
+  }
+  // Immutable storage cannot be resized, replace the whole buffer.
+  glDeleteBuffers(1, &_handle);
+  glGenBuffers(1, &_handle);
+  bind();
+  _size = regionCount * _regionSize;
+  constexpr GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+  glBufferStorage(GL_ARRAY_BUFFER, _size, nullptr, flags);
+  mapped = static_cast<std::byte*>(glMapBufferRange(GL_ARRAY_BUFFER, 0, _size, flags));
+  if (!mapped) {
+    // Should not happen, fall back to the orphaning mode on a mutable buffer.
+    glDeleteBuffers(1, &_handle);
+    glGenBuffers(1, &_handle);
+    currentRegion = 0;
+    allocate(_regionSize, GL_STREAM_DRAW);
+  }
+}
+
+void* StreamingArrayBuffer::beginWrite() const {
+  bind();
+  if (!mapped) {
+    // Orphan the old storage so the driver does not wait for the draws still reading it.
+    glBufferData(GL_ARRAY_BUFFER, _regionSize, nullptr, GL_STREAM_DRAW);
+    return glMapBufferRange(GL_ARRAY_BUFFER, 0, _regionSize, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  }
+  // Everything issued so far may read the current region.
+  if (fences[currentRegion]) glDeleteSync(fences[currentRegion]);
+  fences[currentRegion] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  currentRegion = (currentRegion + 1) % regionCount;
+  if (GLsync& fence = fences[currentRegion]; fence) {
+    GLbitfield waitFlags = GL_SYNC_FLUSH_COMMANDS_BIT;
+    while (glClientWaitSync(fence, waitFlags, 1000000) == GL_TIMEOUT_EXPIRED) waitFlags = 0;
+    glDeleteSync(fence);
+    fence = nullptr;
+  }
+  return mapped + regionOffset();
+}
+
+GLintptr StreamingArrayBuffer::endWrite() const {
+  if (!mapped) glUnmapBuffer(GL_ARRAY_BUFFER);
+  return regionOffset();
+}
+
+GLintptr StreamingArrayBuffer::write(const void* data, GLsizeiptr size_) const {
+  // Mapping only fails on a lost context, nothing to draw then.
+  if (void* target = beginWrite()) std::memcpy(target, data, size_);
+  return endWrite();
+}
+
+void StreamingArrayBuffer::bindStorageRegion(GLuint index) const noexcept {
+  glBindBufferRange(GL_SHADER_STORAGE_BUFFER, index, _handle, regionOffset(), _regionSize);
+}
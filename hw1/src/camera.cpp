@@ -61,6 +61,12 @@ bool Camera::move(GLFWwindow* window) {
   return ismoved;
 }
 
+void Camera::setPose(const Eigen::Ref<const Eigen::Vector4f>& position, const Eigen::Quaternionf& rotation) {
+  _position = position;
+  _rotation = rotation;
+  updateView();
+}
+
 void Camera::updateView() {
   _front.head<3>() = _rotation * Vector3f::UnitZ();
   _up.head<3>() = _rotation * Vector3f::UnitY();
@@ -1,85 +1,208 @@
 #include "cloth.h"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <utility>
 #include <Eigen/Geometry>
 
 #include "configs.h"
 #include "sphere.h"
+#include "threadpool.h"
 
-Cloth::Cloth() : Shape(particlesPerEdge * particlesPerEdge, particleMass) {
+namespace {
+// Multiplier of springCoef per spring type, indexed by Spring::Type.
+constexpr float springTypeStiffness[3] = {1.0f, 1.0f, 1.0f};
+
+// gatherNormals keeps two rows of faces on the stack, sized for maxParticlesPerEdge.
+int clampEdge(int particles) { return std::clamp(particles, 2, maxParticlesPerEdge); }
+
+// Normal of the vertices in rows [rowBegin, rowEnd): the sum of the faces touching each vertex, normalized.
+// Each vertex only reads its neighbours and writes itself, so rows can be split between threads. The face normals of
+// the quad rows above and below the current row are kept, so each triangle is still computed about once.
+// Width is the particles per row known at compile time, or 0 to use runtimeWidth.
+template <int Width>
+void gatherNormals(const Eigen::Ref<const Eigen::Matrix4Xf>& position, Eigen::Matrix4Xf& normals, int runtimeWidth,
+                   int height, int rowBegin, int rowEnd) {
+  const int width = Width > 0 ? Width : runtimeWidth;
+  // Two triangles per quad, the same ones as the index buffer: faces[2 * qx] and faces[2 * qx + 1].
+  auto computeFaces = [&position, width](int qy, Eigen::Vector4f* faces) {
+    int offset = qy * width;
+    for (int qx = 0; qx < width - 1; ++qx) {
+      Eigen::Vector4f lowerLeft = position.col(offset + qx + width);
+      Eigen::Vector4f v1 = position.col(offset + qx) - lowerLeft;
+      Eigen::Vector4f v2 = position.col(offset + qx + 1) - lowerLeft;
+      Eigen::Vector4f v3 = position.col(offset + qx + width + 1) - lowerLeft;
+      faces[2 * qx] = v2.cross3(v1);
+      faces[2 * qx + 1] = v3.cross3(v2);
+    }
+  };
+  assert(width <= maxParticlesPerEdge);
+  Eigen::Vector4f faceRows[2][2 * maxParticlesPerEdge];
+  Eigen::Vector4f* above = faceRows[0];
+  Eigen::Vector4f* below = faceRows[1];
+  if (rowBegin > 0) computeFaces(rowBegin - 1, above);
+  for (int y = rowBegin; y < rowEnd; ++y) {
+    if (y < height - 1) computeFaces(y, below);
+    for (int x = 0; x < width; ++x) {
+      // Same summation order as scattering quad by quad, the first triangle misses the lower-right corner and the
+      // second one misses the upper-left corner.
+      Eigen::Vector4f n = Eigen::Vector4f::Zero();
+      if (y > 0) {
+        if (x > 0) n += above[2 * x - 1];
+        if (x < width - 1) {
+          n += above[2 * x];
+          n += above[2 * x + 1];
+        }
+      }
+      if (y < height - 1) {
+        if (x > 0) {
+          n += below[2 * x - 2];
+          n += below[2 * x - 1];
+        }
+        if (x < width - 1) n += below[2 * x];
+      }
+      n.normalize();
+      normals.col(y * width + x) = n;
+    }
+    std::swap(above, below);
+  }
+}
+
+}  // namespace
+
+Cloth::Cloth(int width, int height) :
+    Shape(clampEdge(width) * clampEdge(height), particleMass),
+    _width(clampEdge(width)),
+    _height(clampEdge(height)),
+    render(isHeadless ? nullptr : std::make_unique<RenderResources>()) {
+  initializeVertex();
+  initializeSpring();
+}
+
+void Cloth::resize(int width, int height) {
+  _width = clampEdge(width);
+  _height = clampEdge(height);
+  ++_layoutRevision;
+  _particles.resize(_width * _height);
+  _particles.setZero();
+  _particles.setMass(particleMass);
+  _springs.clear();
   initializeVertex();
   initializeSpring();
 }
 
 void Cloth::draw(DrawType type) const {
-  vao.bind();
-  positionBuffer.load(0, 4 * particlesPerEdge * particlesPerEdge * sizeof(GLfloat), _particles.getPositionData());
-  const ElementArrayBuffer* currentEBO = nullptr;
+  if (!render) return;
   switch (type) {
-    case DrawType::PARTICLE: [[fallthrough]];
-    case DrawType::FULL: currentEBO = &ebo; break;
-    case DrawType::STRUCTURAL: currentEBO = &structuralSpring; break;
-    case DrawType::SHEAR: currentEBO = &shearSpring; break;
-    case DrawType::BEND: currentEBO = &bendSpring;
-  }
-  currentEBO->bind();
-  GLsizei indexCount = static_cast<GLsizei>(currentEBO->size() / sizeof(GLuint));
-  if (type == DrawType::FULL)
-    glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr);
-  else if (type == DrawType::PARTICLE)
-    glDrawArrays(GL_POINTS, 0, particlesPerEdge * particlesPerEdge);
-  else
-    glDrawElements(GL_LINES, indexCount, GL_UNSIGNED_INT, nullptr);
+    case DrawType::STRUCTURAL: drawSprings(true, false, false); return;
+    case DrawType::SHEAR: drawSprings(false, true, false); return;
+    case DrawType::BEND: drawSprings(false, false, true); return;
+    default: break;
+  }
+  render->vao.bind();
+  if (type == DrawType::FULL) {
+    render->ebo.bind();
+    glDrawElements(GL_TRIANGLES, static_cast<GLsizei>(render->ebo.size() / sizeof(GLuint)), GL_UNSIGNED_INT, nullptr);
+  } else {
+    glDrawArrays(GL_POINTS, 0, _particles.getCapacity());
+  }
+  glBindVertexArray(0);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+void Cloth::drawSprings(bool isStructural, bool isShear, bool isBend) const {
+  if (!render) return;
+  const bool isEnabled[3] = {isStructural, isShear, isBend};
+  // Enabled types next to each other in the buffer are merged into one range.
+  std::array<GLsizei, 3> counts{};
+  std::array<const void*, 3> offsets{};
+  GLsizei drawCount = 0;
+  for (int type = 0; type < 3; ++type) {
+    if (!isEnabled[type]) continue;
+    GLsizei count = render->springRanges[type + 1] - render->springRanges[type];
+    if (drawCount > 0 && type > 0 && isEnabled[type - 1]) {
+      counts[drawCount - 1] += count;
+      continue;
+    }
+    counts[drawCount] = count;
+    offsets[drawCount] = reinterpret_cast<const void*>(render->springRanges[type] * sizeof(GLuint));
+    ++drawCount;
+  }
+  if (drawCount == 0) return;
+  render->vao.bind();
+  render->springEBO.bind();
+  glMultiDrawElements(GL_LINES, counts.data(), GL_UNSIGNED_INT, offsets.data(), drawCount);
   glBindVertexArray(0);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
+void Cloth::streamPosition() const {
+  if (!render || isPositionOnGPU) return;
+  GLintptr offset =
+      render->positionBuffer.write(_particles.getPositionData(), 4 * _particles.getCapacity() * sizeof(GLfloat));
+  // The region moves every frame, so does the attribute pointer.
+  render->vao.bind();
+  render->positionBuffer.bind();
+  render->vao.setAttributePointer(0, 4, 4, static_cast<int>(offset / sizeof(GLfloat)));
+  glBindVertexArray(0);
+  glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
 void Cloth::initializeVertex() {
-  float wStep = 2.0f * clothWidth / (particlesPerEdge - 1);
-  float hStep = 2.0f * clothHeight / (particlesPerEdge - 1);
+  float wStep = 2.0f * clothWidth / (_width - 1);
+  float hStep = 2.0f * clothHeight / (_height - 1);
 
   int current = 0;
-  for (int i = 0; i < particlesPerEdge; ++i) {
-    for (int j = 0; j < particlesPerEdge; ++j) {
+  for (int i = 0; i < _height; ++i) {
+    for (int j = 0; j < _width; ++j) {
       _particles.position(current++) = Eigen::Vector4f(-clothWidth + j * wStep, 0, -clothHeight + i * hStep, 1);
     }
   }
   // Four corners will not move
-  _particles.mass(0) = 0.0f;
-  _particles.mass(particlesPerEdge - 1) = 0.0f;
-  _particles.mass(particlesPerEdge * (particlesPerEdge - 1)) = 0.0f;
-  _particles.mass(particlesPerEdge * particlesPerEdge - 1) = 0.0f;
+  _particles.setMass(0, 0.0f);
+  _particles.setMass(_width - 1, 0.0f);
+  _particles.setMass(_width * (_height - 1), 0.0f);
+  _particles.setMass(_width * _height - 1, 0.0f);
+  _normals.resize(4, _width * _height);
+  _rowsMoved.resize(_height);
+  _rowsToUpdate.resize(_height);
+  isNormalOutdated = true;
+  if (!render) return;
 
   std::vector<GLuint> indices;
-  indices.reserve((particlesPerEdge - 1) * (2 * particlesPerEdge + 1));
-  for (int i = 0; i < particlesPerEdge - 1; ++i) {
-    int offset = i * (particlesPerEdge);
-    for (int j = 0; j < particlesPerEdge - 1; ++j) {
+  indices.reserve(6 * (_width - 1) * (_height - 1));
+  for (int i = 0; i < _height - 1; ++i) {
+    int offset = i * _width;
+    for (int j = 0; j < _width - 1; ++j) {
       indices.emplace_back(offset + j);
-      indices.emplace_back(offset + j + particlesPerEdge);
+      indices.emplace_back(offset + j + _width);
       indices.emplace_back(offset + j + 1);
 
       indices.emplace_back(offset + j + 1);
-      indices.emplace_back(offset + j + particlesPerEdge);
-      indices.emplace_back(offset + j + particlesPerEdge + 1);
+      indices.emplace_back(offset + j + _width);
+      indices.emplace_back(offset + j + _width + 1);
     }
   }
 
-  int vboSize = particlesPerEdge * particlesPerEdge * sizeof(GLfloat);
-  positionBuffer.allocate_load(vboSize * 4, _particles.getPositionData());
-  normalBuffer.allocate(particlesPerEdge * particlesPerEdge * sizeof(float) * 4);
+  int vboSize = _width * _height * sizeof(GLfloat);
+  render->positionBuffer.allocateRegions(vboSize * 4);
+  render->normalBuffer.allocate(vboSize * 4);
 
-  ebo.allocate_load(indices.size() * sizeof(GLuint), indices.data());
+  render->ebo.allocate_load(indices.size() * sizeof(GLuint), indices.data());
 
-  vao.bind();
-  positionBuffer.bind();
-  vao.enable(0);
-  vao.setAttributePointer(0, 4, 4, 0);
-  normalBuffer.bind();
-  vao.enable(1);
-  vao.setAttributePointer(1, 4, 4, 0);
+  render->vao.bind();
+  render->vao.enable(0);
+  render->normalBuffer.bind();
+  render->vao.enable(1);
+  render->vao.setAttributePointer(1, 4, 4, 0);
 
   glBindVertexArray(0);
   glBindBuffer(GL_ARRAY_BUFFER, 0);
   glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+  // Sets the position attribute pointer.
+  streamPosition();
 }
 
 void Cloth::initializeSpring() {
@@ -89,63 +212,68 @@ void Cloth::initializeSpring() {
   // Note:
   //   1. The particles index:
   //   ===============================================
-  //   0 1 2 3 ... particlesPerEdge
-  //   particlesPerEdge + 1 ....
-  //   ... ... particlesPerEdge * particlesPerEdge - 1
+  //   0 1 2 3 ... width - 1
+  //   width width + 1 ....
+  //   ... ... width * height - 1
   //   ===============================================
   // Here is a simple example which connects the horizontal structrual springs.
   float structrualLength = (_particles.position(0) - _particles.position(1)).norm();
-  for (int i = 0; i < particlesPerEdge; ++i) {
-    for (int j = 0; j < particlesPerEdge; ++j) {
-      int index = i * particlesPerEdge + j;
-      if (j < particlesPerEdge - 1)
+  float verticalLength = (_particles.position(0) - _particles.position(_width)).norm();
+  float shearLength = std::hypot(structrualLength, verticalLength);
+  for (int i = 0; i < _height; ++i) {
+    for (int j = 0; j < _width; ++j) {
+      int index = i * _width + j;
+      if (j < _width - 1)
         _springs.emplace_back(index, index + 1, structrualLength, Spring::Type::STRUCTURAL);
-      if (i < particlesPerEdge - 1) {
-        _springs.emplace_back(index, index + particlesPerEdge, structrualLength, Spring::Type::STRUCTURAL);
+      if (i < _height - 1) {
+        _springs.emplace_back(index, index + _width, verticalLength, Spring::Type::STRUCTURAL);
       }
     }
   }
 
-  for (int i = 0; i < particlesPerEdge; ++i) {
-    for (int j = 0; j < particlesPerEdge; ++j) {
-      int index = i * particlesPerEdge + j;
-      if (j < particlesPerEdge - 2)
+  for (int i = 0; i < _height; ++i) {
+    for (int j = 0; j < _width; ++j) {
+      int index = i * _width + j;
+      if (j < _width - 2)
         _springs.emplace_back(index, index + 2, 2*structrualLength, Spring::Type::BEND);
-      if (i < particlesPerEdge - 2) {
-        _springs.emplace_back(index, index + 2*particlesPerEdge, 2*structrualLength, Spring::Type::BEND);
+      if (i < _height - 2) {
+        _springs.emplace_back(index, index + 2*_width, 2*verticalLength, Spring::Type::BEND);
       }
     }
   }
 
-  for (int i = 0; i < particlesPerEdge - 1; ++i) {
-    for (int j = 0; j < particlesPerEdge; ++j) {
-      int index = i * particlesPerEdge + j;
-      if (j != 0) _springs.emplace_back(index, index + particlesPerEdge - 1, 1.414 * structrualLength, Spring::Type::SHEAR);
-      if (j != particlesPerEdge - 1) _springs.emplace_back(index, index + particlesPerEdge + 1, 1.414 * structrualLength, Spring::Type::SHEAR);
+  for (int i = 0; i < _height - 1; ++i) {
+    for (int j = 0; j < _width; ++j) {
+      int index = i * _width + j;
+      if (j != 0) _springs.emplace_back(index, index + _width - 1, shearLength, Spring::Type::SHEAR);
+      if (j != _width - 1) _springs.emplace_back(index, index + _width + 1, shearLength, Spring::Type::SHEAR);
     }
   }
   // Write code here!
+  colorSprings();
+  _springArrays.assign(_springs, springTypeStiffness);
+  int springCount = _springArrays.size();
+  for (auto* scratch : {&_springDx, &_springDy, &_springDz, &_springDvx, &_springDvy, &_springDvz, &_springLength,
+                        &_springInverseLength, &_springForceScale})
+    scratch->resize(springCount);
+  computeStabilityBounds();
+  if (!render) return;
 
-  std::vector<GLuint> structrualIndices, shearIndices, bendIndices;
+  // One buffer for all the springs, the types are contiguous ranges in the order of Spring::Type.
+  std::vector<GLuint> indices[3];
   for (const auto& spring : _springs) {
-    switch (spring.type()) {
-      case Spring::Type::STRUCTURAL:
-        structrualIndices.emplace_back(spring.startParticleIndex());
-        structrualIndices.emplace_back(spring.endParticleIndex());
-        break;
-      case Spring::Type::SHEAR:
-        shearIndices.emplace_back(spring.startParticleIndex());
-        shearIndices.emplace_back(spring.endParticleIndex());
-        break;
-      case Spring::Type::BEND:
-        bendIndices.emplace_back(spring.startParticleIndex());
-        bendIndices.emplace_back(spring.endParticleIndex());
-        break;
-    }
+    auto& typeIndices = indices[static_cast<int>(spring.type())];
+    typeIndices.emplace_back(spring.startParticleIndex());
+    typeIndices.emplace_back(spring.endParticleIndex());
+  }
+  std::vector<GLuint> springIndices;
+  springIndices.reserve(2 * _springs.size());
+  render->springRanges[0] = 0;
+  for (int type = 0; type < 3; ++type) {
+    springIndices.insert(springIndices.end(), indices[type].begin(), indices[type].end());
+    render->springRanges[type + 1] = static_cast<GLsizei>(springIndices.size());
   }
-  structuralSpring.allocate_load(structrualIndices.size() * sizeof(GLuint), structrualIndices.data());
-  shearSpring.allocate_load(shearIndices.size() * sizeof(GLuint), shearIndices.data());
-  bendSpring.allocate_load(bendIndices.size() * sizeof(GLuint), bendIndices.data());
+  render->springEBO.allocate_load(springIndices.size() * sizeof(GLuint), springIndices.data());
 }
 void Cloth::computeSpringForce() {
   // TODO: Compute spring force and damper force for each spring.
@@ -160,63 +288,171 @@ void Cloth::computeSpringForce() {
   //          a.normalized() will create a new vector.
   //   3. Use a.dot(b) to get dot product of a and b.
 
-  for (const auto& spring : _springs) {
-    const auto& start=_particles.position(spring.startParticleIndex());
-    const auto& end = _particles.position(spring.endParticleIndex());
-    auto& vec = end - start;
-    float m_start = _particles.inverseMass(spring.startParticleIndex());
-    float m_end = _particles.inverseMass(spring.endParticleIndex());
-    if (vec.norm() > spring.length()) {
-      Eigen::Vector4f F = (vec.norm() - spring.length()) * springCoef * vec.normalized();
-      _particles.acceleration(spring.startParticleIndex()) += F * m_start;
-      _particles.acceleration(spring.endParticleIndex()) -= F * m_end;
-    } else if (vec.norm() < spring.length()) {
-      Eigen::Vector4f F = (spring.length() - vec.norm()) * springCoef * vec.normalized();
-      _particles.acceleration(spring.startParticleIndex()) -= F * m_start;
-      _particles.acceleration(spring.endParticleIndex()) += F * m_end;
-    }
-    
-    Eigen::Vector4f v1 = _particles.velocity(spring.startParticleIndex()),
-                    v2 = _particles.velocity(spring.endParticleIndex());
-    float delta_v = ( v2 - v1 ).dot(vec.normalized());
-    if (delta_v > 0) {
-      Eigen::Vector4f f = damperCoef * delta_v * vec.normalized();
-      _particles.acceleration(spring.startParticleIndex()) += f * m_start;
-      _particles.acceleration(spring.endParticleIndex()) -= f * m_end;
-    } else if (delta_v < 0) {
-      Eigen::Vector4f f = damperCoef * delta_v * vec.normalized();
-      _particles.acceleration(spring.startParticleIndex()) += f * m_start;
-      _particles.acceleration(spring.endParticleIndex()) -= f * m_end;
+  // Springs in the same batch never share a particle, so the threads can scatter without locks.
+  ThreadPool& pool = ThreadPool::getPool();
+  for (size_t batch = 0; batch + 1 < _springBatchOffsets.size(); ++batch) {
+    int offset = _springBatchOffsets[batch];
+    pool.parallelFor(_springBatchOffsets[batch + 1] - offset,
+                     [this, offset](int begin, int end) { computeSpringForce(offset + begin, offset + end); });
+  }
+}
+
+void Cloth::colorSprings() {
+  // Greedy edge coloring, each spring takes the lowest color unused by both of its particles.
+  // A particle has at most 12 springs, so no more than 23 colors are needed.
+  std::vector<std::uint32_t> usedColors(_particles.getCapacity(), 0);
+  std::vector<int> springColors(_springs.size());
+  int colorCount = 0;
+  for (size_t i = 0; i < _springs.size(); ++i) {
+    std::uint32_t& startColors = usedColors[_springs[i].startParticleIndex()];
+    std::uint32_t& endColors = usedColors[_springs[i].endParticleIndex()];
+    int color = 0;
+    while ((startColors | endColors) & (1u << color)) ++color;
+    startColors |= 1u << color;
+    endColors |= 1u << color;
+    springColors[i] = color;
+    colorCount = std::max(colorCount, color + 1);
+  }
+
+  std::vector<Spring> sortedSprings;
+  sortedSprings.reserve(_springs.size());
+  _springBatchOffsets.assign(1, 0);
+  for (int color = 0; color < colorCount; ++color) {
+    for (size_t i = 0; i < _springs.size(); ++i) {
+      if (springColors[i] == color) sortedSprings.push_back(_springs[i]);
     }
-    // Write code here!
+    _springBatchOffsets.push_back(static_cast<int>(sortedSprings.size()));
+  }
+  _springs = std::move(sortedSprings);
+}
+
+void Cloth::computeSpringForce(int begin, int end) {
+  // The spring and damper force share the same direction, so both fold into one scale of (end - start):
+  //   F = (springCoef * stiffness * (|d| - restLength) + damperCoef * dot(dv, d) / |d|) * d / |d|
+  // The force is computed in three passes, only the middle one does math and it runs over packed arrays.
+  const auto& startIndex = _springArrays.startIndex();
+  const auto& endIndex = _springArrays.endIndex();
+  int count = end - begin;
+  // 1. Gather the relative position and velocity of each spring.
+  for (int i = begin; i < end; ++i) {
+    Eigen::Vector4f d = _particles.position(endIndex[i]) - _particles.position(startIndex[i]);
+    StateVector dv = _particles.velocity(endIndex[i]) - _particles.velocity(startIndex[i]);
+    _springDx[i] = d[0];
+    _springDy[i] = d[1];
+    _springDz[i] = d[2];
+    _springDvx[i] = dv[0];
+    _springDvy[i] = dv[1];
+    _springDvz[i] = dv[2];
+  }
+  // 2. Length and direction are computed once per spring, vectorized across springs.
+  auto dx = _springDx.segment(begin, count);
+  auto dy = _springDy.segment(begin, count);
+  auto dz = _springDz.segment(begin, count);
+  auto dvx = _springDvx.segment(begin, count);
+  auto dvy = _springDvy.segment(begin, count);
+  auto dvz = _springDvz.segment(begin, count);
+  auto length = _springLength.segment(begin, count);
+  auto inverseLength = _springInverseLength.segment(begin, count);
+  length = (dx.square() + dy.square() + dz.square()).sqrt();
+  inverseLength = (length > 0.0f).select(length.inverse(), 0.0f);
+  _springForceScale.segment(begin, count) =
+      (springCoef * _springArrays.stiffness().segment(begin, count) *
+           (length - _springArrays.restLength().segment(begin, count)) +
+       damperCoef * (dvx * dx + dvy * dy + dvz * dz) * inverseLength) *
+      inverseLength;
+  // 3. Scatter the force to both ends.
+  for (int i = begin; i < end; ++i) {
+    StateVector force =
+        _springForceScale[i] * Eigen::Vector4f(_springDx[i], _springDy[i], _springDz[i], 0.0f).head<stateRows>();
+    _particles.acceleration(startIndex[i]) += force * _particles.inverseMass(startIndex[i]);
+    _particles.acceleration(endIndex[i]) -= force * _particles.inverseMass(endIndex[i]);
   }
+}
 
+void Cloth::computeStabilityBounds() {
+  // Row sums of the spring matrix (per unit springCoef) bound its largest eigenvalue, scaled by the particle's mass.
+  Eigen::ArrayXf stiffnessSum = Eigen::ArrayXf::Zero(_particles.getCapacity());
+  for (int i = 0; i < _springArrays.size(); ++i) {
+    stiffnessSum[_springArrays.startIndex()[i]] += _springArrays.stiffness()[i];
+    stiffnessSum[_springArrays.endIndex()[i]] += _springArrays.stiffness()[i];
+  }
+  _maxStiffnessPerMass = (2.0f * stiffnessSum * _particles.inverseMass()).maxCoeff();
+  _minRestLength = _springArrays.size() > 0 ? _springArrays.restLength().minCoeff() : 0.0f;
 }
 
 void Cloth::collide(Shape* shape) { shape->collide(this); }
 void Cloth::collide(Spheres* sphere) { sphere->collide(this); }
 
-void Cloth::computeNormal() {
-  static Eigen::Matrix<float, 4, particlesPerEdge * particlesPerEdge> normals;
-  normals.setZero();
-  for (int i = 0; i < particlesPerEdge - 1; ++i) {
-    int offset = i * (particlesPerEdge);
-    for (int j = 0; j < particlesPerEdge - 1; ++j) {
-      Eigen::Vector4f v1 = _particles.position(offset + j) - _particles.position(offset + j + particlesPerEdge);
-      Eigen::Vector4f v2 = _particles.position(offset + j + 1) - _particles.position(offset + j + particlesPerEdge);
-      Eigen::Vector4f n1 = v2.cross3(v1);
-      normals.col(offset + j) += n1;
-      normals.col(offset + j + 1) += n1;
-      normals.col(offset + j + particlesPerEdge) += n1;
-
-      Eigen::Vector4f v3 =
-          _particles.position(offset + j + particlesPerEdge + 1) - _particles.position(offset + j + particlesPerEdge);
-      Eigen::Vector4f n2 = v3.cross3(v2);
-      normals.col(offset + j + 1) += n2;
-      normals.col(offset + j + particlesPerEdge) += n2;
-      normals.col(offset + j + particlesPerEdge + 1) += n2;
+void Cloth::computeNormal(bool isForced) {
+  if (isForced) isNormalOutdated = true;
+  if (!isNormalOutdated && ++normalFrameCount < normalUpdateInterval) return;
+  normalFrameCount = 0;
+  int rowBegin = 0, rowEnd = _height;
+  if (!isNormalOutdated && normalUpdateThreshold > 0.0f && findMovedRows()) {
+    // Only the rows around the moved ones change.
+    auto first = std::find(_rowsToUpdate.begin(), _rowsToUpdate.end(), 1);
+    if (first == _rowsToUpdate.end()) return;
+    rowBegin = static_cast<int>(first - _rowsToUpdate.begin());
+    rowEnd = static_cast<int>(_rowsToUpdate.rend() - std::find(_rowsToUpdate.rbegin(), _rowsToUpdate.rend(), 1));
+  } else {
+    std::fill(_rowsToUpdate.begin(), _rowsToUpdate.end(), 1);
+    if (normalUpdateThreshold > 0.0f) _normalReference = _particles.position();
+  }
+  isNormalOutdated = false;
+
+  auto gather = [this](int begin, int end) {
+    // Skip the unchanged rows, but keep runs of changed rows to one call.
+    for (int y = begin; y < end;) {
+      if (!_rowsToUpdate[y]) {
+        ++y;
+        continue;
+      }
+      int runEnd = y;
+      while (runEnd < end && _rowsToUpdate[runEnd]) ++runEnd;
+      // Fixed widths let the compiler fold the row stride into the addressing.
+      switch (_width) {
+        case 25: gatherNormals<25>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+        case 32: gatherNormals<32>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+        case 50: gatherNormals<50>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+        case 64: gatherNormals<64>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+        case 100: gatherNormals<100>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+        case 128: gatherNormals<128>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+        case 200: gatherNormals<200>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+        case 256: gatherNormals<256>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+        case 512: gatherNormals<512>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+        default: gatherNormals<0>(_particles.position(), _normals, _width, _height, y, runEnd); break;
+      }
+      y = runEnd;
+    }
+  };
+  // About 4096 vertices per task.
+  ThreadPool::getPool().parallelFor(_height, gather, std::max(1, 4096 / _width));
+  if (render) {
+    GLintptr offset = 4 * rowBegin * _width * sizeof(float);
+    GLsizeiptr size = 4 * (rowEnd - rowBegin) * _width * sizeof(float);
+    render->normalBuffer.load(offset, size, _normals.col(rowBegin * _width).data());
+  }
+}
+
+bool Cloth::findMovedRows() {
+  if (_normalReference.cols() != _particles.getCapacity()) return false;
+  const float squaredThreshold = normalUpdateThreshold * normalUpdateThreshold;
+  // A row moved if any of its particles is further than the threshold from where the normals were computed.
+  std::fill(_rowsMoved.begin(), _rowsMoved.end(), 0);
+  Eigen::Ref<Eigen::Matrix4Xf> position = _particles.position();
+  auto check = [this, &position, squaredThreshold](int begin, int end) {
+    for (int y = begin; y < end; ++y) {
+      auto current = position.middleCols(y * _width, _width);
+      auto reference = _normalReference.middleCols(y * _width, _width);
+      if ((current - reference).colwise().squaredNorm().maxCoeff() <= squaredThreshold) continue;
+      _rowsMoved[y] = 1;
+      reference = current;
     }
+  };
+  ThreadPool::getPool().parallelFor(_height, check, std::max(1, 4096 / _width));
+  // The normals of a row depend on the rows above and below.
+  for (int y = 0; y < _height; ++y) {
+    _rowsToUpdate[y] = _rowsMoved[y] || (y > 0 && _rowsMoved[y - 1]) || (y + 1 < _height && _rowsMoved[y + 1]);
   }
-  normals.colwise().normalize();
-  normalBuffer.load(0, particlesPerEdge * particlesPerEdge * sizeof(float) * 4, normals.data());
+  return true;
 }
@@ -0,0 +1,322 @@
+#include "clothcompute.h"
+
+#include <algorithm>
+
+#include "configs.h"
+#include "profiler.h"
+
+namespace {
+constexpr int workGroupSize = 64;
+// The sphere impulses are summed with integer atomics in units of 2^-20, exact and in any order.
+constexpr float feedbackScale = 1048576.0f;
+// Storage binding points shared by the programs.
+enum Binding : GLuint {
+  POSITION,
+  VELOCITY,
+  ACCELERATION,
+  INVERSE_MASS,
+  SPRING_INDEX,
+  SPRING_PARAMETER,
+  SPHERE,
+  NORMAL,
+  SPHERE_FEEDBACK
+};
+
+constexpr const char* storageDeclarations = R"(
+#version 430
+layout(local_size_x = 64) in;
+layout(std430, binding = 0) buffer Position { vec4 position[]; };
+layout(std430, binding = 1) buffer Velocity { vec4 velocity[]; };
+layout(std430, binding = 2) buffer Acceleration { vec4 acceleration[]; };
+layout(std430, binding = 3) readonly buffer InverseMass { float inverseMass[]; };
+layout(std430, binding = 4) readonly buffer SpringIndex { ivec2 springIndex[]; };
+layout(std430, binding = 5) readonly buffer SpringParameter { vec2 springParameter[]; };
+layout(std430, binding = 6) readonly buffer Sphere { vec4 sphere[]; };
+layout(std430, binding = 7) writeonly buffer Normal { vec4 normal[]; };
+layout(std430, binding = 8) buffer SphereFeedback { int sphereFeedback[]; };
+)";
+
+// One invocation per spring of a batch, springs in a batch share no particle so the scatter has no race.
+constexpr const char* springSource = R"(
+uniform int springOffset;
+uniform int springCount;
+uniform float springCoef;
+uniform float damperCoef;
+
+void main() {
+  int i = int(gl_GlobalInvocationID.x);
+  if (i >= springCount) return;
+  i += springOffset;
+  ivec2 ends = springIndex[i];
+  vec3 d = position[ends.y].xyz - position[ends.x].xyz;
+  vec3 dv = velocity[ends.y].xyz - velocity[ends.x].xyz;
+  float len = length(d);
+  float inverseLength = len > 0.0 ? 1.0 / len : 0.0;
+  vec2 parameter = springParameter[i];  // rest length, stiffness
+  float stretch = springCoef * parameter.y * (len - parameter.x);
+  float scale = (stretch + damperCoef * dot(dv, d) * inverseLength) * inverseLength;
+  vec3 force = scale * d;
+  acceleration[ends.x].xyz += force * inverseMass[ends.x];
+  acceleration[ends.y].xyz -= force * inverseMass[ends.y];
+}
+)";
+
+// Sphere contacts, then gravity, damping and the explicit Euler update. Clears the acceleration for the next step.
+// A contact is the one of Spheres::collide(Cloth*): momentum exchange along the normal, friction and the push out.
+// The sphere's share goes to sphereFeedback as velocity, position and rotation changes.
+constexpr const char* integrateSource = R"(
+uniform int particleCount;
+uniform int sphereCount;
+uniform int sphereOffset;
+uniform float deltaTime;
+uniform float viscousCoef;
+uniform float frictionCoef;
+uniform float feedbackScale;
+
+vec3 safeNormalize(vec3 x) { return dot(x, x) > 0.0 ? normalize(x) : x; }
+
+// Slots of 4 ints, like the vec4 of the CPU side.
+void addFeedback(int slot, vec3 value) {
+  ivec3 fixedValue = ivec3(round(value * feedbackScale));
+  atomicAdd(sphereFeedback[4 * slot], fixedValue.x);
+  atomicAdd(sphereFeedback[4 * slot + 1], fixedValue.y);
+  atomicAdd(sphereFeedback[4 * slot + 2], fixedValue.z);
+}
+
+void main() {
+  int i = int(gl_GlobalInvocationID.x);
+  if (i >= particleCount) return;
+  float invm = inverseMass[i];
+  vec4 p = position[i];
+  vec4 v = velocity[i];
+  if (invm > 0.0) {
+    for (int j = 0; j < sphereCount; ++j) {
+      // (center, radius), (velocity, mass), (rotation, inverse mass) of the sphere at this step.
+      vec4 center = sphere[sphereOffset + 3 * j];
+      vec4 sphereVelocity = sphere[sphereOffset + 3 * j + 1];
+      vec4 sphereRotation = sphere[sphereOffset + 3 * j + 2];
+      vec3 offset = p.xyz - center.xyz;
+      float distance = length(offset);
+      if (distance > center.w || distance == 0.0) continue;
+      vec3 n = offset / distance;
+      float m1 = sphereVelocity.w, m2 = 1.0 / invm;
+      vec3 v1 = dot(n, sphereVelocity.xyz) * n;
+      vec3 v2 = dot(n, v.xyz) * n;
+      vec3 after = (m1 * v1 + m2 * v2) / (m1 + m2);
+      vec3 sphereDelta = after - v1;
+      v.xyz += after - v2;
+
+      float normalForce = length(sphereDelta) / deltaTime * m1;
+      vec3 direction1 = safeNormalize(sphereVelocity.xyz + sphereDelta - v1);
+      vec3 direction2 = safeNormalize(v.xyz - v2);
+      vec3 moveFriction = (direction2 - direction1) * normalForce * frictionCoef;
+      sphereDelta += deltaTime * moveFriction * sphereRotation.w;
+      v.xyz -= deltaTime * moveFriction * invm;
+
+      vec3 rotateDirection = safeNormalize(cross(sphereRotation.xyz, n));
+      sphereDelta += deltaTime * rotateDirection * sphereRotation.w;
+      v.xyz += deltaTime * rotateDirection * normalForce * frictionCoef * invm;
+      float inertia = 0.4 * m1 * center.w * center.w;
+      vec3 spin = inertia > 0.0 ? cross(n, moveFriction + rotateDirection) / inertia * deltaTime : vec3(0.0);
+
+      vec3 correction = 0.15 * (center.w - distance) * n;
+      p.xyz += correction;
+      addFeedback(3 * j, sphereDelta);
+      addFeedback(3 * j + 1, -correction);
+      addFeedback(3 * j + 2, spin);
+    }
+  }
+  vec4 gravity = invm > 0.0 ? vec4(0.0, -9.8, 0.0, 0.0) : vec4(0.0);
+  vec4 a = gravity - viscousCoef * invm * v + acceleration[i];
+  position[i] = p + deltaTime * v;
+  velocity[i] = v + deltaTime * a;
+  acceleration[i] = vec4(0.0);
+}
+)";
+
+// Gather the face normals around each vertex, same triangles as Cloth::computeNormal.
+constexpr const char* normalSource = R"(
+uniform int width;
+uniform int height;
+
+vec3 vertex(int x, int y) { return position[y * width + x].xyz; }
+
+void main() {
+  int id = int(gl_GlobalInvocationID.x);
+  if (id >= width * height) return;
+  int x = id % width, y = id / width;
+  vec3 n = vec3(0.0);
+  for (int qy = max(y - 1, 0); qy <= min(y, height - 2); ++qy) {
+    for (int qx = max(x - 1, 0); qx <= min(x, width - 2); ++qx) {
+      vec3 v1 = vertex(qx, qy) - vertex(qx, qy + 1);
+      vec3 v2 = vertex(qx + 1, qy) - vertex(qx, qy + 1);
+      vec3 v3 = vertex(qx + 1, qy + 1) - vertex(qx, qy + 1);
+      // The upper-left triangle misses the lower-right corner and the other one misses the upper-left corner.
+      if (qx + 1 != x || qy + 1 != y) n += cross(v2, v1);
+      if (qx != x || qy != y) n += cross(v3, v2);
+    }
+  }
+  normal[id] = vec4(length(n) > 0.0 ? normalize(n) : n, 0.0);
+}
+)";
+
+void buildProgram(ShaderProgram& program, const char* source) {
+  ComputeShader shader;
+  shader.fromString(std::string(storageDeclarations) + source);
+  program.attach(&shader);
+  program.link();
+  program.detach(&shader);
+}
+
+GLuint groupCount(int count) { return static_cast<GLuint>((count + workGroupSize - 1) / workGroupSize); }
+}  // namespace
+
+ClothCompute::ClothCompute() noexcept {
+  buildProgram(springProgram, springSource);
+  buildProgram(integrateProgram, integrateSource);
+  buildProgram(normalProgram, normalSource);
+}
+
+void ClothCompute::upload(Cloth& cloth_) {
+  cloth = &cloth_;
+  Particles& particles = cloth->particles();
+  int particleCount = particles.getCapacity();
+  // The compute passes keep working in the region written here until download().
+  cloth->setPositionOnGPU(false);
+  cloth->streamPosition();
+  // The shaders use vec4 velocities, the particles may keep only xyz.
+  Eigen::Matrix4Xf velocity = Eigen::Matrix4Xf::Zero(4, particleCount);
+  velocity.topRows<stateRows>() = particles.velocity();
+  velocityBuffer.allocate_load(4 * particleCount * sizeof(GLfloat), velocity.data(), GL_DYNAMIC_COPY);
+  // Forces are accumulated from zero in every step.
+  std::vector<GLfloat> zeros(4 * particleCount, 0.0f);
+  accelerationBuffer.allocate_load(zeros.size() * sizeof(GLfloat), zeros.data(), GL_DYNAMIC_COPY);
+  inverseMassBuffer.allocate_load(particleCount * sizeof(GLfloat), particles.inverseMass().data());
+
+  const SpringArrays& springs = cloth->springArrays();
+  std::vector<GLint> indices;
+  std::vector<GLfloat> parameters;
+  indices.reserve(2 * springs.size());
+  parameters.reserve(2 * springs.size());
+  for (int i = 0; i < springs.size(); ++i) {
+    indices.insert(indices.end(), {springs.startIndex()[i], springs.endIndex()[i]});
+    parameters.insert(parameters.end(), {springs.restLength()[i], springs.stiffness()[i]});
+  }
+  springIndexBuffer.allocate_load(indices.size() * sizeof(GLint), indices.data());
+  springParameterBuffer.allocate_load(parameters.size() * sizeof(GLfloat), parameters.data());
+  springBatchOffsets = cloth->springBatchOffsets();
+  cloth->setPositionOnGPU(true);
+}
+
+void ClothCompute::download() {
+  if (!cloth) return;
+  Particles& particles = cloth->particles();
+  int particleCount = particles.getCapacity();
+  glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+  cloth->positionBuffer()->bind();
+  glGetBufferSubData(GL_ARRAY_BUFFER, cloth->positionBuffer()->regionOffset(), 4 * particleCount * sizeof(GLfloat),
+                     particles.position().data());
+  velocityBuffer.bind();
+  Eigen::Matrix4Xf velocity(4, particleCount);
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, 4 * particleCount * sizeof(GLfloat), velocity.data());
+  particles.velocity() = velocity.topRows<stateRows>();
+  // The GPU leaves the accumulated forces cleared.
+  particles.acceleration().setZero();
+  cloth->setPositionOnGPU(false);
+  cloth = nullptr;
+}
+
+void ClothCompute::bindStorage() const {
+  cloth->positionBuffer()->bindStorageRegion(POSITION);
+  velocityBuffer.bindStorage(VELOCITY);
+  accelerationBuffer.bindStorage(ACCELERATION);
+  inverseMassBuffer.bindStorage(INVERSE_MASS);
+  springIndexBuffer.bindStorage(SPRING_INDEX);
+  springParameterBuffer.bindStorage(SPRING_PARAMETER);
+  sphereBuffer.bindStorage(SPHERE);
+  cloth->normalBuffer()->bindStorage(NORMAL);
+  sphereFeedbackBuffer.bindStorage(SPHERE_FEEDBACK);
+}
+
+void ClothCompute::simulate(Simulation& simulation, Spheres& spheres, int stepCount) {
+  if (!cloth) return;
+  // Step the spheres first, keeping where each cloth step sees them.
+  Particles& sphereParticles = spheres.particles();
+  int sphereCount = spheres.count();
+  sphereData.resize(3 * std::max(sphereCount * stepCount, 1), Eigen::Vector4f::Zero());
+  for (int i = 0; i < stepCount; ++i) {
+    for (int j = 0; j < sphereCount; ++j) {
+      Eigen::Vector4f* state = &sphereData[3 * (i * sphereCount + j)];
+      state[0] = sphereParticles.position(j);
+      state[0][3] = spheres.radius(j);
+      state[1].head<stateRows>() = sphereParticles.velocity(j);
+      state[1][3] = sphereParticles.mass(j);
+      state[2].head<stateRows>() = sphereParticles.rotation(j);
+      state[2][3] = sphereParticles.inverseMass(j);
+    }
+    simulation.simulateSpheres(1);
+  }
+  GLsizeiptr sphereSize = static_cast<GLsizeiptr>(sphereData.size() * sizeof(Eigen::Vector4f));
+  if (sphereBuffer.size() < sphereSize)
+    sphereBuffer.allocate_load(sphereSize, sphereData.data(), GL_STREAM_DRAW);
+  else
+    sphereBuffer.load(0, sphereSize, sphereData.data());
+  sphereFeedback.assign(3 * std::max(sphereCount, 1), Eigen::Vector4i::Zero());
+  GLsizeiptr feedbackSize = static_cast<GLsizeiptr>(sphereFeedback.size() * sizeof(Eigen::Vector4i));
+  if (sphereFeedbackBuffer.size() != feedbackSize)
+    sphereFeedbackBuffer.allocate_load(feedbackSize, sphereFeedback.data(), GL_DYNAMIC_READ);
+  else
+    sphereFeedbackBuffer.load(0, feedbackSize, sphereFeedback.data());
+  bindStorage();
+
+  int particleCount = cloth->particles().getCapacity();
+  {
+    // The sphere steps above are CPU stages of their own.
+    ScopedGPUTimer timer(Profiler::GPU_SIMULATION);
+    springProgram.use();
+    springProgram.setUniform("springCoef", springCoef);
+    springProgram.setUniform("damperCoef", damperCoef);
+    integrateProgram.use();
+    integrateProgram.setUniform("particleCount", particleCount);
+    integrateProgram.setUniform("sphereCount", sphereCount);
+    integrateProgram.setUniform("deltaTime", deltaTime);
+    integrateProgram.setUniform("viscousCoef", viscousCoef);
+    integrateProgram.setUniform("frictionCoef", frictionCoef);
+    integrateProgram.setUniform("feedbackScale", feedbackScale);
+    for (int i = 0; i < stepCount; ++i) {
+      springProgram.use();
+      for (size_t batch = 0; batch + 1 < springBatchOffsets.size(); ++batch) {
+        int springCount = springBatchOffsets[batch + 1] - springBatchOffsets[batch];
+        springProgram.setUniform("springOffset", springBatchOffsets[batch]);
+        springProgram.setUniform("springCount", springCount);
+        glDispatchCompute(groupCount(springCount), 1, 1);
+        glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+      }
+      integrateProgram.use();
+      integrateProgram.setUniform("sphereOffset", 3 * i * sphereCount);
+      glDispatchCompute(groupCount(particleCount), 1, 1);
+      glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT);
+    }
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_BUFFER_UPDATE_BARRIER_BIT);
+  }
+  // The cloth pushes back once per frame, this read waits for the steps above.
+  sphereFeedbackBuffer.bind();
+  glGetBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, feedbackSize, sphereFeedback.data());
+  for (int j = 0; j < sphereCount; ++j) {
+    const Eigen::Vector4i* feedback = &sphereFeedback[3 * j];
+    sphereParticles.velocity(j) += feedback[0].head<stateRows>().cast<float>() / feedbackScale;
+    sphereParticles.statePosition(j) += feedback[1].head<stateRows>().cast<float>() / feedbackScale;
+    sphereParticles.rotation(j) += feedback[2].head<stateRows>().cast<float>() / feedbackScale;
+  }
+}
+
+void ClothCompute::computeNormal() {
+  if (!cloth) return;
+  cloth->positionBuffer()->bindStorageRegion(POSITION);
+  cloth->normalBuffer()->bindStorage(NORMAL);
+  normalProgram.use();
+  normalProgram.setUniform("width", cloth->width());
+  normalProgram.setUniform("height", cloth->height());
+  glDispatchCompute(groupCount(cloth->width() * cloth->height()), 1, 1);
+  glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+}
@@ -1,4 +1,7 @@
 #include "configs.h"
+#include <algorithm>
+#include <thread>
+
 float mouseMoveSpeed = 0.001f;
 float keyboardMoveSpeed = 0.1f;
 
@@ -8,6 +11,21 @@ int speedMultiplier = 1;
 
 float deltaTime = 1e-4f;
 int simulationPerFrame = static_cast<int>(baseSpeed / deltaTime);
+int frameAllocationCount = 0;
+bool isAdaptiveTimeStep = false;
+float adaptiveSafetyFactor = 1.6f;
+int maxAdaptiveStepCount = 4096;
+int adaptiveStepCount = 0;
+int simulationThreadCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+
+int normalUpdateInterval = 1;
+float normalUpdateThreshold = 0.0f;
+
+float backwardEulerTolerance = 1e-4f;
+int backwardEulerMaxIterations = 100;
+int backwardEulerIterationCount = 0;
+
+int xpbdIterationCount = 4;
 
 float springCoef = 25000.0f;
 float damperCoef = 750.0f;
@@ -25,5 +43,19 @@ bool isDrawingBendSprings = false;
 bool isDrawingCloth = false;
 bool isPaused = true;
 bool isStateSwitched = false;
+int historyFrameCount = 0;
+int historySeekAge = 0;
+bool isHistorySeeked = false;
+bool isSphereBroadPhaseEnabled = true;
+bool isExplicitEulerFused = false;
+bool isHeadless = false;
+bool isProfilerEnabled = false;
+bool isGPUSimulationEnabled = false;
+bool isComputeShaderSupported = false;
+bool isBufferStorageSupported = false;
 
 int currentIntegrator = 0;
+
+int clothParticlesWidth = defaultParticlesPerEdge;
+int clothParticlesHeight = defaultParticlesPerEdge;
+bool isClothResolutionChanged = false;
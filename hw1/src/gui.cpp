@@ -1,7 +1,11 @@
 #include "gui.h"
+#include <algorithm>
+#include <cfloat>
 #include <cmath>
 
 #include "configs.h"
+#include "profiler.h"
+#include "threadpool.h"
 
 namespace {
 void renderColorPanel() {
@@ -46,6 +50,51 @@ void renderDrawingTypes() {
   ImGui::Checkbox("Surface", &isDrawingCloth);
 }
 
+void renderProfilerPanel() {
+  static const char* dumpStatus = "";
+  ImGui::SetNextWindowSize(ImVec2(420.0f, 420.0f), ImGuiCond_Once);
+  ImGui::SetNextWindowPos(ImVec2(520.0f, 50.0f), ImGuiCond_Once);
+  ImGui::SetNextWindowBgAlpha(0.6f);
+  if (ImGui::Begin("Profiler", &isProfilerEnabled)) {
+    Profiler& profiler = Profiler::getProfiler();
+    if (ImGui::Button("Dump CSV")) {
+      dumpStatus = profiler.dumpCSV("hw1_profile.csv") ? "Saved to hw1_profile.csv" : "Cannot write hw1_profile.csv";
+    }
+    ImGui::SameLine();
+    if (ImGui::Button("Clear")) profiler.clear();
+    ImGui::SameLine();
+    ImGui::Text("%s", dumpStatus);
+    if (ImGui::BeginTable("Stages", 4, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+      ImGui::TableSetupColumn("Stage (ms)");
+      ImGui::TableSetupColumn("Last");
+      ImGui::TableSetupColumn("Average");
+      ImGui::TableSetupColumn("Max");
+      ImGui::TableHeadersRow();
+      for (int i = 0; i < Profiler::STAGE_COUNT; ++i) {
+        auto stage = static_cast<Profiler::Stage>(i);
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("%s%s", Profiler::getStageName(stage), Profiler::isGPUStage(stage) ? " (GPU)" : "");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", profiler.latest(stage));
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", profiler.average(stage));
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", profiler.max(stage));
+      }
+      ImGui::EndTable();
+    }
+    for (int i = 0; i < Profiler::STAGE_COUNT; ++i) {
+      auto stage = static_cast<Profiler::Stage>(i);
+      // Only plot the stages that ran recently.
+      if (profiler.max(stage) <= 0.0f) continue;
+      ImGui::PlotLines(Profiler::getStageName(stage), profiler.history(stage), Profiler::historyLength,
+                       profiler.historyOffset(), nullptr, 0.0f, FLT_MAX, ImVec2(0.0f, 40.0f));
+    }
+  }
+  ImGui::End();
+}
+
 void renderMainPanel() {
   ImGui::SetNextWindowSize(ImVec2(450.0f, 350.0f), ImGuiCond_Once);
   ImGui::SetNextWindowCollapsed(0, ImGuiCond_Once);
@@ -63,6 +112,10 @@ void renderMainPanel() {
       simulationPerFrame = speedMultiplier * static_cast<int>(baseSpeed / deltaTime);
       simulationPerFrame = std::max(1, simulationPerFrame);
     }
+    if (ImGui::InputInt("simulationThreads", &simulationThreadCount)) {
+      simulationThreadCount = std::max(1, simulationThreadCount);
+      ThreadPool::getPool().setThreadCount(simulationThreadCount);
+    }
     if (ImGui::InputFloat("springCoef", &springCoef, 1e2f, 1e3f, "%.0f")) {
       springCoef = std::max(0.0f, springCoef);
     }
@@ -79,13 +132,60 @@ void renderMainPanel() {
     ImGui::RadioButton("Midpoint Euler", &currentIntegrator, 2);
     ImGui::SameLine();
     ImGui::RadioButton("Runge Kutta Fourth", &currentIntegrator, 3);
+    ImGui::RadioButton("Backward Euler", &currentIntegrator, 4);
+    if (currentIntegrator == 4) {
+      ImGui::SameLine();
+      ImGui::Text("CG iterations: %d", backwardEulerIterationCount);
+    }
+    ImGui::RadioButton("XPBD", &currentIntegrator, 5);
+    if (currentIntegrator == 5 && ImGui::InputInt("xpbdIterationCount", &xpbdIterationCount)) {
+      xpbdIterationCount = std::max(1, xpbdIterationCount);
+    }
+    ImGui::Checkbox("Fused explicit Euler", &isExplicitEulerFused);
+    if (isComputeShaderSupported) {
+      ImGui::SameLine();
+      ImGui::Checkbox("GPU simulation", &isGPUSimulationEnabled);
+    }
+    ImGui::Checkbox("Adaptive time step", &isAdaptiveTimeStep);
+    if (isAdaptiveTimeStep) {
+      if (ImGui::InputFloat("adaptiveSafetyFactor", &adaptiveSafetyFactor, 0.1f, 0.5f, "%.2f")) {
+        adaptiveSafetyFactor = std::max(0.01f, adaptiveSafetyFactor);
+      }
+      ImGui::Text("Steps per frame: %d (fixed: %d)", adaptiveStepCount, simulationPerFrame);
+    }
 
+    ImGui::Text("%s", "------------------------ Cloth -------------------------");
+    if (ImGui::InputInt("clothWidth", &clothParticlesWidth)) {
+      clothParticlesWidth = std::clamp(clothParticlesWidth, 2, maxParticlesPerEdge);
+    }
+    if (ImGui::InputInt("clothHeight", &clothParticlesHeight)) {
+      clothParticlesHeight = std::clamp(clothParticlesHeight, 2, maxParticlesPerEdge);
+    }
+    isClothResolutionChanged = ImGui::Button("Rebuild cloth");
     ImGui::Text("%s", "-------------------- Drawing Config --------------------");
     renderColorPanel();
     renderDrawingTypes();
+    if (ImGui::InputInt("normalUpdateInterval", &normalUpdateInterval)) {
+      normalUpdateInterval = std::max(1, normalUpdateInterval);
+    }
+    if (ImGui::InputFloat("normalUpdateThreshold", &normalUpdateThreshold, 1e-4f, 1e-3f, "%.4f")) {
+      normalUpdateThreshold = std::max(0.0f, normalUpdateThreshold);
+    }
     ImGui::Text("%s", "-------------------- Miscellaneous ---------------------");
+    ImGui::Checkbox("Sphere broad phase", &isSphereBroadPhaseEnabled);
+    ImGui::SameLine();
+    ImGui::Checkbox("Profiler", &isProfilerEnabled);
     if ((isStateSwitched = ImGui::Button(isPaused ? "Start" : "Stop"))) isPaused = !isPaused;
+    if (isPaused && historyFrameCount > 0) {
+      // Continue from the rewound frame instead of the initial state.
+      ImGui::SameLine();
+      if (ImGui::Button("Resume")) isPaused = false;
+      isHistorySeeked = ImGui::SliderInt("Rewind frames", &historySeekAge, 0, historyFrameCount - 1);
+    }
     ImGui::Text("Current framerate: %.0f", ImGui::GetIO().Framerate);
+#ifdef HW1_COUNT_ALLOCATIONS
+    ImGui::Text("Allocations per frame: %d", frameAllocationCount);
+#endif
   }
   ImGui::End();
 }
@@ -113,6 +213,7 @@ void GUI::render() {
   ImGui_ImplGlfw_NewFrame();
   ImGui::NewFrame();
   renderMainPanel();
+  if (isProfilerEnabled) renderProfilerPanel();
   ImGui::Render();
   ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
 }
@@ -1,5 +1,7 @@
 #include <algorithm>
 #include <cassert>
+#include <cstdlib>
+#include <cstring>
 #include <functional>
 #include <iostream>
 #include <memory>
@@ -16,6 +18,11 @@
 int alignSize = 256;
 bool isWindowSizeChanged = true;
 bool mouseBinded = false;
+// Record or replay the inputs of every frame, see recording.h
+const char* recordPath = nullptr;
+const char* replayPath = nullptr;
+const char* tracePath = nullptr;
+int keyframeInterval = 0;
 
 int uboAlign(int i) { return ((i + 1 * (alignSize - 1)) / alignSize) * alignSize; }
 
@@ -45,7 +52,35 @@ void framebufferSizeCallback(GLFWwindow*, int width, int height) {
   isWindowSizeChanged = true;
 }
 
-int main() {
+void parseArguments(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--cloth") == 0 && i + 1 < argc) {
+      // --cloth N or --cloth WxH
+      char* end = nullptr;
+      clothParticlesWidth = static_cast<int>(std::strtol(argv[++i], &end, 10));
+      clothParticlesHeight = (*end == 'x') ? static_cast<int>(std::strtol(end + 1, nullptr, 10)) : clothParticlesWidth;
+      clothParticlesWidth = std::clamp(clothParticlesWidth, 2, maxParticlesPerEdge);
+      clothParticlesHeight = std::clamp(clothParticlesHeight, 2, maxParticlesPerEdge);
+    } else if (std::strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+      recordPath = argv[++i];
+    } else if (std::strcmp(argv[i], "--keyframes") == 0 && i + 1 < argc) {
+      // Frames between two particle keyframes of the recording
+      keyframeInterval = std::max(0, std::atoi(argv[++i]));
+    } else if (std::strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+      replayPath = argv[++i];
+    } else if (std::strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+      // Frame times of the replay as CSV
+      tracePath = argv[++i];
+    } else {
+      std::cerr << "Usage: " << argv[0] << " [--cloth N | --cloth WxH] [--record FILE [--keyframes N]]"
+                << " [--replay FILE [--trace CSV]]" << std::endl;
+      exit(EXIT_FAILURE);
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  parseArguments(argc, argv);
   // Initialize OpenGL context.
   OpenGLContext& context = OpenGLContext::getContext();
   GLFWwindow* window = context.createWindow("HW1", 1280, 720, GLFW_OPENGL_CORE_PROFILE);
@@ -70,6 +105,7 @@ int main() {
   speedMultiplier = (240 / context.getRefreshRate());
   simulationPerFrame *= speedMultiplier;
   GUI gui(window, context.getOpenGLVersion());
+  isBufferStorageSupported = context.isBufferStorageSupported();
   // Initialize shaders
   ShaderProgram sphereRenderer, particleRenderer;
   {
@@ -100,7 +136,7 @@ int main() {
     particleRenderer.uniformBlockBinding("camera", 1);
   }
   // Create softbody
-  Cloth cloth;
+  Cloth cloth(clothParticlesWidth, clothParticlesHeight);
   cloth.computeNormal();
   UniformBuffer meshUBO;
   int meshOffset = uboAlign(32 * sizeof(GLfloat));
@@ -122,31 +158,44 @@ int main() {
   cameraUBO.load(0, 16 * sizeof(GLfloat), camera.viewProjectionMatrix().data());
   cameraUBO.load(16 * sizeof(GLfloat), 4 * sizeof(GLfloat), camera.position().data());
   cameraUBO.bindUniformBlockIndex(1, 0, uboAlign(20 * sizeof(GLfloat)));
-  // Do one step simulation, used in some implicit methods
-  std::function<void(void)> simulateOneStep = [&]() {
-    cloth.computeExternalForce();
-    spheres.computeExternalForce();
-    cloth.computeSpringForce();
-    spheres.collide(&cloth);
-    spheres.collide();
-  };
-
-  ExplicitEuler explicitEuler;
-  ImplicitEuler implicitEuler;
-  MidpointEuler midpointEuler;
-  RungeKuttaFourth rk4;
-  Integrator* integrator = &explicitEuler;
-
-  std::vector<Particles*> particles{&cloth.particles(), &spheres.particles()};
+  Simulation simulation(cloth, spheres);
+  // Cloth on compute shaders (explicit Euler only), falls back to the CPU on OpenGL 4.1 / macOS.
+  std::unique_ptr<ClothCompute> clothCompute;
+  isComputeShaderSupported = context.isComputeShaderSupported();
+  if (isComputeShaderSupported) clothCompute = std::make_unique<ClothCompute>();
   // Backup initial state
-  Particles initialCloth = cloth.particles();
-  Particles initialSpheres = spheres.particles();
+  ParticleState initialCloth, initialSpheres;
+  cloth.particles().save(initialCloth);
+  spheres.particles().save(initialSpheres);
+  StateHistory history({&cloth.particles(), &spheres.particles()}, historyMaxFrameCount, historyMemoryBudget);
+  Recorder recorder({&cloth.particles(), &spheres.particles()});
+  Replayer replayer({&cloth.particles(), &spheres.particles()});
+  if (recordPath && !recorder.open(recordPath, keyframeInterval)) {
+    std::cerr << "Cannot write " << recordPath << std::endl;
+    exit(EXIT_FAILURE);
+  }
+  if (replayPath) {
+    if (!replayer.open(replayPath)) {
+      std::cerr << "Cannot read the recording " << replayPath << std::endl;
+      exit(EXIT_FAILURE);
+    }
+    // Run as fast as the frames go, the frame times are what a replay measures.
+    glfwSwapInterval(0);
+  }
 
   while (!glfwWindowShouldClose(window)) {
     // Polling events.
     glfwPollEvents();
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-    bool cameraChanged = mouseBinded ? camera.move(window) : false;
+    bool cameraChanged = false;
+    if (replayer.isOpen()) {
+      // The recorded camera and configs replace the live ones until the recording ends.
+      if (!replayer.beginFrame(camera)) break;
+      cameraChanged = replayer.isCameraMoved();
+    } else if (mouseBinded) {
+      cameraChanged = camera.move(window);
+    }
+    recorder.beginFrame(camera);
     if (isWindowSizeChanged) {
       isWindowSizeChanged = false;
       camera.updateProjection();
@@ -156,55 +205,105 @@ int main() {
       cameraUBO.load(0, 16 * sizeof(GLfloat), camera.viewProjectionMatrix().data());
       cameraUBO.load(16 * sizeof(GLfloat), 4 * sizeof(GLfloat), camera.position().data());
     }
-    // Check which integrator is selected in GUI.
-    switch (currentIntegrator) {
-      case 0: integrator = &explicitEuler; break;
-      case 1: integrator = &implicitEuler; break;
-      case 2: integrator = &midpointEuler; break;
-      case 3: integrator = &rk4; break;
-      default: break;
+    // Move the cloth state when the GPU simulation is switched.
+    bool isOnGPU = isGPUSimulationEnabled && currentIntegrator == 0;
+    if (clothCompute && clothCompute->isResident() != isOnGPU) {
+      if (isOnGPU)
+        clothCompute->upload(cloth);
+      else
+        clothCompute->download();
+    }
+    if (isClothResolutionChanged) {
+      // Restart the scene with the new cloth
+      cloth.resize(clothParticlesWidth, clothParticlesHeight);
+      cloth.computeNormal(true);
+      cloth.particles().save(initialCloth);
+      spheres.particles().restore(initialSpheres);
+      history.clear();
+      if (isOnGPU) clothCompute->upload(cloth);
     }
 
     if (!isPaused) {
       // Stop -> Start: Restore initial state
       if (isStateSwitched) {
-        cloth.particles() = initialCloth;
-        spheres.particles() = initialSpheres;
+        cloth.particles().restore(initialCloth);
+        spheres.particles().restore(initialSpheres);
+        history.clear();
+        if (isOnGPU) clothCompute->upload(cloth);
       }
-      // Simulate one step and then integrate it.
-      for (int i = 0; i < simulationPerFrame; i++) {
-        simulateOneStep();
-        integrator->integrate(particles, simulateOneStep);
+      // Simulate one step and then integrate it, with the integrator selected in GUI.
+      AllocationScope allocations;
+      if (isOnGPU) {
+        // Timed inside, around the dispatches only, GPU timers cannot be nested.
+        clothCompute->simulate(simulation, spheres, simulationPerFrame);
+      } else if (isAdaptiveTimeStep) {
+        // Same simulated time per frame as the fixed steps, in fewer or more steps as the state allows.
+        adaptiveStepCount = simulation.simulateAdaptive(currentIntegrator, simulationPerFrame * deltaTime);
+      } else {
+        simulation.simulate(currentIntegrator, simulationPerFrame);
       }
+      // The cloth on GPU is only downloaded when switching back, so its frames are not recorded.
+      if (isOnGPU)
+        history.clear();
+      else
+        history.push();
+      frameAllocationCount = static_cast<int>(allocations.count());
+      backwardEulerIterationCount = simulation.backwardEulerIterationCount();
     }
+    if (isPaused && isHistorySeeked && history.seek(historySeekAge) && isOnGPU) clothCompute->upload(cloth);
+    historyFrameCount = history.size();
+    historySeekAge = history.position();
+    if (!recorder.endFrame(isOnGPU)) std::cerr << "Cannot write " << recordPath << ", recording stopped" << std::endl;
+    if (replayer.isOpen()) replayer.endFrame(isOnGPU);
 
-    particleRenderer.use();
-    if (isClothColorChange) particleRenderer.setUniform("color", clothColor);
-    meshUBO.bindUniformBlockIndex(0, 0, meshOffset);
-    if (isDrawingParticles) cloth.draw(Cloth::DrawType::PARTICLE);
-    if (isDrawingStructuralSprings) cloth.draw(Cloth::DrawType::STRUCTURAL);
-    if (isDrawingShearSprings) cloth.draw(Cloth::DrawType::SHEAR);
-    if (isDrawingBendSprings) cloth.draw(Cloth::DrawType::BEND);
-    if (isDrawingCloth) {
-      glDisable(GL_CULL_FACE);
-      // This is very slow because it is done in CPU. Since GL4.1 doesn't support compute shader.
+    // Normals before the draws, so the cloth draws are timed as one stage.
+    if (isDrawingCloth && isOnGPU) {
+      ScopedGPUTimer timer(Profiler::GPU_NORMAL);
+      clothCompute->computeNormal();
+    } else if (isDrawingCloth) {
+      // This is very slow when done in CPU, which is the only choice on GL4.1 since it doesn't support compute shader.
+      ScopedTimer timer(Profiler::NORMAL);
       cloth.computeNormal();
-      particleRenderer.setUniform("isSurface", 1);
-      cloth.draw(Cloth::DrawType::FULL);
-      glEnable(GL_CULL_FACE);
-    } else {
-      particleRenderer.setUniform("isSurface", 0);
     }
-    sphereRenderer.use();
-    if (isSphereColorChange) sphereRenderer.setUniform("color", sphereColor);
-    meshUBO.bindUniformBlockIndex(0, meshOffset, meshOffset);
-    spheres.draw();
+    {
+      ScopedGPUTimer timer(Profiler::CLOTH_DRAW);
+      // One upload per frame, shared by all the draw types below.
+      cloth.streamPosition();
+      particleRenderer.use();
+      if (isClothColorChange) particleRenderer.setUniform("color", clothColor);
+      meshUBO.bindUniformBlockIndex(0, 0, meshOffset);
+      if (isDrawingParticles) cloth.draw(Cloth::DrawType::PARTICLE);
+      cloth.drawSprings(isDrawingStructuralSprings, isDrawingShearSprings, isDrawingBendSprings);
+      if (isDrawingCloth) {
+        glDisable(GL_CULL_FACE);
+        particleRenderer.setUniform("isSurface", 1);
+        cloth.draw(Cloth::DrawType::FULL);
+        glEnable(GL_CULL_FACE);
+      } else {
+        particleRenderer.setUniform("isSurface", 0);
+      }
+    }
+    {
+      ScopedGPUTimer timer(Profiler::SPHERE_DRAW);
+      sphereRenderer.use();
+      if (isSphereColorChange) sphereRenderer.setUniform("color", sphereColor);
+      meshUBO.bindUniformBlockIndex(0, meshOffset, meshOffset);
+      spheres.draw();
+    }
 
     gui.render();
 #ifdef __APPLE__
     glFlush();
 #endif
     glfwSwapBuffers(window);
+    Profiler::getProfiler().endFrame();
+  }
+  if (replayer.isOpen()) {
+    std::cerr << "Replayed " << replayer.frameCount() << " frames"
+              << (replayer.hasError() ? " of a broken recording" : "") << ", " << replayer.averageFrameTime()
+              << " ms per frame. " << replayer.divergedKeyframeCount() << " of " << replayer.keyframeCount()
+              << " keyframes diverged, by at most " << replayer.maxDivergence() << std::endl;
+    if (tracePath && !replayer.writeTrace(tracePath)) std::cerr << "Cannot write " << tracePath << std::endl;
   }
   glfwDestroyWindow(window);
   return 0;
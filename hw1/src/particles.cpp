@@ -1,7 +1,10 @@
 #include "particles.h"
 
+#include <algorithm>
+
 Particles::Particles(int size, float mass_) noexcept :
-    _position(4, size), _velocity(4, size), _acceleration(4, size), _mass(size, mass_) {
+    _position(4, size), _velocity(stateRows, size), _acceleration(stateRows, size), _mass(size, mass_),
+    _inverseMass(Eigen::ArrayXf::Constant(size, computeInverseMass(mass_))), _rotation(stateRows, size) {
   _position.setZero();
   _velocity.setZero();
   _acceleration.setZero();
@@ -15,10 +18,37 @@ void Particles::setZero() {
   _rotation.setZero();
 }
 
+void Particles::save(ParticleState& state) const {
+  // Eigen only reallocates on assignment when the sizes differ.
+  state.position = _position;
+  state.velocity = _velocity;
+  state.acceleration = _acceleration;
+  state.rotation = _rotation;
+}
+
+void Particles::restore(const ParticleState& state) {
+  _position = state.position;
+  _velocity = state.velocity;
+  _acceleration = state.acceleration;
+  _rotation = state.rotation;
+}
+
 void Particles::resize(int newSize) {
   _position.conservativeResize(Eigen::NoChange, newSize);
   _velocity.conservativeResize(Eigen::NoChange, newSize);
   _acceleration.conservativeResize(Eigen::NoChange, newSize);
+  // Only the spheres rotate and nothing else sets it, new particles start still.
+  Eigen::Index oldRotationSize = _rotation.cols();
   _rotation.conservativeResize(Eigen::NoChange, newSize);
+  if (newSize > oldRotationSize) _rotation.rightCols(newSize - oldRotationSize).setZero();
   _mass.resize(newSize, 0.0f);
+  // New particles have m == 0
+  Eigen::Index oldSize = _inverseMass.size();
+  _inverseMass.conservativeResize(newSize);
+  if (newSize > oldSize) _inverseMass.tail(newSize - oldSize).setZero();
+}
+
+void Particles::setMass(float mass_) {
+  std::fill(_mass.begin(), _mass.end(), mass_);
+  _inverseMass.setConstant(computeInverseMass(mass_));
 }
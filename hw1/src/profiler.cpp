@@ -0,0 +1,141 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "configs.h"
+
+namespace {
+constexpr const char* stageNames[Profiler::STAGE_COUNT] = {
+    "External force", "Spring force", "Sphere-cloth collision", "Sphere collision", "Integrator",  "Normal",
+    "GPU simulation", "GPU normal",   "Cloth draw",             "Sphere draw",      "Frame",
+};
+}  // namespace
+
+Profiler& Profiler::getProfiler() {
+  static Profiler profiler;
+  return profiler;
+}
+
+Profiler::~Profiler() {
+  if (isQueryCreated) glDeleteQueries(STAGE_COUNT * queryLatency, &queries[0][0]);
+}
+
+const char* Profiler::getStageName(Stage stage) { return stageNames[stage]; }
+
+void Profiler::endFrame() {
+  auto now = std::chrono::steady_clock::now();
+  if (!isProfilerEnabled) {
+    lastFrame = {};
+    return;
+  }
+  collectQueries();
+  // The first frame after enabling has no start.
+  if (lastFrame != std::chrono::steady_clock::time_point{})
+    current[FRAME] = std::chrono::duration_cast<std::chrono::nanoseconds>(now - lastFrame).count();
+  lastFrame = now;
+  for (int i = 0; i < STAGE_COUNT; ++i) _history[i][nextFrame] = static_cast<float>(current[i] * 1e-6);
+  current.fill(0);
+  nextFrame = (nextFrame + 1) % historyLength;
+  _frameCount = std::min(_frameCount + 1, historyLength);
+}
+
+void Profiler::clear() {
+  for (auto& stage : _history) stage.fill(0.0f);
+  current.fill(0);
+  nextFrame = 0;
+  _frameCount = 0;
+}
+
+float Profiler::latest(Stage stage) const {
+  return _frameCount == 0 ? 0.0f : _history[stage][(nextFrame + historyLength - 1) % historyLength];
+}
+
+float Profiler::average(Stage stage) const {
+  if (_frameCount == 0) return 0.0f;
+  float sum = 0.0f;
+  // Frames not recorded yet are zero.
+  for (float time : _history[stage]) sum += time;
+  return sum / _frameCount;
+}
+
+float Profiler::max(Stage stage) const { return *std::max_element(_history[stage].begin(), _history[stage].end()); }
+
+bool Profiler::dumpCSV(const char* path) const {
+  FILE* file = std::fopen(path, "w");
+  if (!file) return false;
+  std::fprintf(file, "frame");
+  for (int i = 0; i < STAGE_COUNT; ++i) std::fprintf(file, ",%s", stageNames[i]);
+  std::fprintf(file, "\n");
+  int first = (nextFrame + historyLength - _frameCount) % historyLength;
+  for (int frame = 0; frame < _frameCount; ++frame) {
+    std::fprintf(file, "%d", frame);
+    for (int i = 0; i < STAGE_COUNT; ++i) std::fprintf(file, ",%.4f", _history[i][(first + frame) % historyLength]);
+    std::fprintf(file, "\n");
+  }
+  return std::fclose(file) == 0;
+}
+
+bool Profiler::beginQuery(Stage stage) {
+  if (!isQueryCreated) {
+    glGenQueries(STAGE_COUNT * queryLatency, &queries[0][0]);
+    isQueryCreated = true;
+  }
+  if (isQueryRunning) return false;
+  int& slot = nextQuery[stage];
+  // Still running after queryLatency frames, skip this measurement rather than stall.
+  if (isQueryPending[stage][slot]) return false;
+  glBeginQuery(GL_TIME_ELAPSED, queries[stage][slot]);
+  isQueryRunning = true;
+  isQueryPending[stage][slot] = true;
+  slot = (slot + 1) % queryLatency;
+  return true;
+}
+
+void Profiler::endQuery() {
+  glEndQuery(GL_TIME_ELAPSED);
+  isQueryRunning = false;
+}
+
+void Profiler::collectQueries() {
+  if (!isQueryCreated) return;
+  for (int stage = GPU_SIMULATION; stage < FRAME; ++stage) {
+    for (int slot = 0; slot < queryLatency; ++slot) {
+      if (!isQueryPending[stage][slot]) continue;
+      GLint isAvailable = GL_FALSE;
+      glGetQueryObjectiv(queries[stage][slot], GL_QUERY_RESULT_AVAILABLE, &isAvailable);
+      if (!isAvailable) continue;
+      // GPU times are a few frames late, they are added to the frame where the result arrives.
+      GLuint64 nanoseconds = 0;
+      glGetQueryObjectui64v(queries[stage][slot], GL_QUERY_RESULT, &nanoseconds);
+      current[stage] += static_cast<std::int64_t>(nanoseconds);
+      isQueryPending[stage][slot] = false;
+    }
+  }
+}
+
+ScopedTimer::ScopedTimer(Profiler::Stage stage_) noexcept : stage(stage_), isActive(isProfilerEnabled) {
+  if (!isActive) return;
+  Profiler& profiler = Profiler::getProfiler();
+  parent = profiler.activeTimer;
+  profiler.activeTimer = this;
+  start = std::chrono::steady_clock::now();
+}
+
+ScopedTimer::~ScopedTimer() {
+  if (!isActive) return;
+  std::int64_t elapsed =
+      std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  Profiler& profiler = Profiler::getProfiler();
+  profiler.current[stage] += elapsed - childNanoseconds;
+  if (parent) parent->childNanoseconds += elapsed;
+  profiler.activeTimer = parent;
+}
+
+ScopedGPUTimer::ScopedGPUTimer(Profiler::Stage stage) noexcept : isActive(isProfilerEnabled && !isHeadless) {
+  if (isActive) isActive = Profiler::getProfiler().beginQuery(stage);
+}
+
+ScopedGPUTimer::~ScopedGPUTimer() {
+  if (isActive) Profiler::getProfiler().endQuery();
+}
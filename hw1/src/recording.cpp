@@ -0,0 +1,363 @@
+#include "recording.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <iterator>
+#include <limits>
+#include <utility>
+
+#include "configs.h"
+#include "threadpool.h"
+
+namespace {
+constexpr char recordingMagic[4] = {'H', 'W', '1', 'R'};
+constexpr std::uint32_t recordingVersion = 1;
+constexpr std::size_t headerSize = 16;
+// Bits of the byte starting a frame record.
+constexpr unsigned char cameraFlag = 1;
+constexpr unsigned char keyframeFlag = 2;
+// Position then rotation x, y, z, w.
+constexpr int cameraFloatCount = 8;
+// Position and velocity xyz of a particle, the same with and without HW1_COMPACT_PARTICLES.
+constexpr int wordsPerParticle = 6;
+
+struct ConfigField {
+  void* value;
+  std::size_t size;
+};
+
+// The configs the GUI changes, the id of a field is its index. New fields go at the end, so older recordings still
+// replay, with the live value for the fields they do not have.
+const ConfigField configFields[] = {
+    {&deltaTime, sizeof(deltaTime)},
+    {&simulationPerFrame, sizeof(simulationPerFrame)},
+    {&simulationThreadCount, sizeof(simulationThreadCount)},
+    {&isAdaptiveTimeStep, sizeof(isAdaptiveTimeStep)},
+    {&adaptiveSafetyFactor, sizeof(adaptiveSafetyFactor)},
+    {&maxAdaptiveStepCount, sizeof(maxAdaptiveStepCount)},
+    {&normalUpdateInterval, sizeof(normalUpdateInterval)},
+    {&normalUpdateThreshold, sizeof(normalUpdateThreshold)},
+    {&backwardEulerTolerance, sizeof(backwardEulerTolerance)},
+    {&backwardEulerMaxIterations, sizeof(backwardEulerMaxIterations)},
+    {&xpbdIterationCount, sizeof(xpbdIterationCount)},
+    {&springCoef, sizeof(springCoef)},
+    {&damperCoef, sizeof(damperCoef)},
+    {&viscousCoef, sizeof(viscousCoef)},
+    {&frictionCoef, sizeof(frictionCoef)},
+    {&sphereColor, sizeof(sphereColor)},
+    {&clothColor, sizeof(clothColor)},
+    {&isSphereColorChange, sizeof(isSphereColorChange)},
+    {&isClothColorChange, sizeof(isClothColorChange)},
+    {&isDrawingParticles, sizeof(isDrawingParticles)},
+    {&isDrawingStructuralSprings, sizeof(isDrawingStructuralSprings)},
+    {&isDrawingShearSprings, sizeof(isDrawingShearSprings)},
+    {&isDrawingBendSprings, sizeof(isDrawingBendSprings)},
+    {&isDrawingCloth, sizeof(isDrawingCloth)},
+    {&isPaused, sizeof(isPaused)},
+    {&isStateSwitched, sizeof(isStateSwitched)},
+    {&historySeekAge, sizeof(historySeekAge)},
+    {&isHistorySeeked, sizeof(isHistorySeeked)},
+    {&isSphereBroadPhaseEnabled, sizeof(isSphereBroadPhaseEnabled)},
+    {&isExplicitEulerFused, sizeof(isExplicitEulerFused)},
+    {&isGPUSimulationEnabled, sizeof(isGPUSimulationEnabled)},
+    {&currentIntegrator, sizeof(currentIntegrator)},
+    {&clothParticlesWidth, sizeof(clothParticlesWidth)},
+    {&clothParticlesHeight, sizeof(clothParticlesHeight)},
+    {&isClothResolutionChanged, sizeof(isClothResolutionChanged)},
+};
+constexpr int configFieldCount = static_cast<int>(std::size(configFields));
+
+// Where each field is in a buffer of all config values, the last entry is the buffer size.
+const std::vector<std::size_t>& configOffsets() {
+  static const std::vector<std::size_t> offsets = [] {
+    std::vector<std::size_t> result(configFieldCount + 1, 0);
+    for (int id = 0; id < configFieldCount; ++id) result[id + 1] = result[id] + configFields[id].size;
+    return result;
+  }();
+  return offsets;
+}
+
+void append(std::vector<unsigned char>& output, const void* value, std::size_t size) {
+  const auto* bytes = static_cast<const unsigned char*>(value);
+  output.insert(output.end(), bytes, bytes + size);
+}
+
+void gatherWords(const Particles& particles, std::vector<std::uint32_t>& words) {
+  const int count = particles.getCapacity();
+  const float* position = particles.getPositionData();
+  const float* velocity = particles.getVelocityData();
+  words.resize(static_cast<std::size_t>(count) * wordsPerParticle);
+  for (int i = 0; i < count; ++i) {
+    std::memcpy(&words[i * wordsPerParticle], position + 4 * i, 3 * sizeof(float));
+    std::memcpy(&words[i * wordsPerParticle + 3], velocity + stateRows * i, 3 * sizeof(float));
+  }
+}
+
+// Bytes up to the highest non-zero one.
+int significantBytes(std::uint32_t word) {
+  int count = 0;
+  while (count < 4 && (word >> (8 * count)) != 0) ++count;
+  return count;
+}
+
+// Per pair of words a byte with the significant byte counts of their XOR with the reference, then those bytes.
+void encodeDelta(const std::vector<std::uint32_t>& words, std::vector<std::uint32_t>& reference,
+                 std::vector<unsigned char>& output) {
+  if (reference.size() != words.size()) reference.assign(words.size(), 0);
+  for (std::size_t w = 0; w < words.size(); w += 2) {
+    std::uint32_t delta[2] = {words[w] ^ reference[w], w + 1 < words.size() ? words[w + 1] ^ reference[w + 1] : 0};
+    int counts[2] = {significantBytes(delta[0]), significantBytes(delta[1])};
+    output.push_back(static_cast<unsigned char>(counts[0] | (counts[1] << 4)));
+    for (int k = 0; k < 2; ++k) {
+      for (int b = 0; b < counts[k]; ++b) output.push_back(static_cast<unsigned char>(delta[k] >> (8 * b)));
+    }
+  }
+  reference = words;
+}
+
+// The reverse of encodeDelta, reference becomes the keyframe.
+bool decodeDelta(const unsigned char* input, std::size_t size, std::vector<std::uint32_t>& reference) {
+  std::size_t position = 0;
+  for (std::size_t w = 0; w < reference.size(); w += 2) {
+    if (position >= size) return false;
+    int counts[2] = {input[position] & 15, input[position] >> 4};
+    ++position;
+    for (int k = 0; k < 2; ++k) {
+      if (counts[k] > 4 || (k == 1 && w + 1 >= reference.size() && counts[k] != 0)) return false;
+      if (position + counts[k] > size) return false;
+      std::uint32_t delta = 0;
+      for (int b = 0; b < counts[k]; ++b) delta |= static_cast<std::uint32_t>(input[position++]) << (8 * b);
+      if (counts[k] > 0) reference[w + k] ^= delta;
+    }
+  }
+  return position == size;
+}
+}  // namespace
+
+Recorder::Recorder(std::vector<Particles*> particles_) : particles(std::move(particles_)) {}
+
+bool Recorder::open(const char* path, int keyframeInterval_) {
+  close();
+  file = std::fopen(path, "wb");
+  if (!file) return false;
+  unsigned char header[headerSize] = {};
+  const std::uint32_t fieldCount = configFieldCount;
+  std::memcpy(header, recordingMagic, sizeof(recordingMagic));
+  std::memcpy(header + 4, &recordingVersion, sizeof(recordingVersion));
+  std::memcpy(header + 8, &fieldCount, sizeof(fieldCount));
+  if (std::fwrite(header, 1, headerSize, file) != headerSize) {
+    close();
+    return false;
+  }
+  keyframeInterval = std::max(0, keyframeInterval_);
+  frameIndex = 0;
+  lastConfigs.clear();
+  lastCamera.clear();
+  references.assign(particles.size(), {});
+  return true;
+}
+
+void Recorder::close() {
+  if (file) std::fclose(file);
+  file = nullptr;
+}
+
+void Recorder::beginFrame(Camera& camera) {
+  if (!file) return;
+  record.clear();
+  record.push_back(0);
+  float pose[cameraFloatCount];
+  std::memcpy(pose, camera.position().data(), 4 * sizeof(float));
+  std::memcpy(pose + 4, camera.rotation().coeffs().data(), 4 * sizeof(float));
+  if (lastCamera.empty() || std::memcmp(lastCamera.data(), pose, sizeof(pose)) != 0) {
+    record[0] |= cameraFlag;
+    append(record, pose, sizeof(pose));
+    lastCamera.assign(pose, pose + cameraFloatCount);
+  }
+
+  const std::vector<std::size_t>& offsets = configOffsets();
+  const bool isFirstFrame = lastConfigs.empty();
+  if (isFirstFrame) lastConfigs.resize(offsets.back());
+  const std::size_t countPosition = record.size();
+  record.push_back(0);
+  for (int id = 0; id < configFieldCount; ++id) {
+    const ConfigField& field = configFields[id];
+    unsigned char* last = lastConfigs.data() + offsets[id];
+    if (!isFirstFrame && std::memcmp(last, field.value, field.size) == 0) continue;
+    record.push_back(static_cast<unsigned char>(id));
+    append(record, field.value, field.size);
+    std::memcpy(last, field.value, field.size);
+    ++record[countPosition];
+  }
+}
+
+bool Recorder::endFrame(bool isOnGPU) {
+  if (!file) return true;
+  if (keyframeInterval > 0 && frameIndex % keyframeInterval == 0 && !isOnGPU) {
+    record[0] |= keyframeFlag;
+    const std::uint32_t setCount = static_cast<std::uint32_t>(particles.size());
+    append(record, &setCount, sizeof(setCount));
+    for (std::size_t k = 0; k < particles.size(); ++k) {
+      gatherWords(*particles[k], words);
+      const std::uint32_t particleCount = static_cast<std::uint32_t>(particles[k]->getCapacity());
+      append(record, &particleCount, sizeof(particleCount));
+      const std::size_t sizePosition = record.size();
+      record.resize(sizePosition + sizeof(std::uint32_t));
+      encodeDelta(words, references[k], record);
+      const auto payloadSize = static_cast<std::uint32_t>(record.size() - sizePosition - sizeof(std::uint32_t));
+      std::memcpy(record.data() + sizePosition, &payloadSize, sizeof(payloadSize));
+    }
+  }
+  ++frameIndex;
+  if (std::fwrite(record.data(), 1, record.size(), file) != record.size()) {
+    close();
+    return false;
+  }
+  return true;
+}
+
+Replayer::Replayer(std::vector<Particles*> particles_) : particles(std::move(particles_)) {}
+
+bool Replayer::open(const char* path) {
+  data.clear();
+  std::FILE* file = std::fopen(path, "rb");
+  if (!file) return false;
+  std::fseek(file, 0, SEEK_END);
+  long size = std::ftell(file);
+  std::fseek(file, 0, SEEK_SET);
+  if (size >= static_cast<long>(headerSize)) {
+    data.resize(static_cast<std::size_t>(size));
+    if (std::fread(data.data(), 1, data.size(), file) != data.size()) data.clear();
+  }
+  std::fclose(file);
+
+  std::uint32_t version = 0, recordedFieldCount = 0;
+  if (data.empty() || std::memcmp(data.data(), recordingMagic, sizeof(recordingMagic)) != 0) {
+    data.clear();
+    return false;
+  }
+  std::memcpy(&version, data.data() + 4, sizeof(version));
+  std::memcpy(&recordedFieldCount, data.data() + 8, sizeof(recordedFieldCount));
+  if (version != recordingVersion || recordedFieldCount > static_cast<std::uint32_t>(configFieldCount)) {
+    data.clear();
+    return false;
+  }
+  fieldCount = static_cast<int>(recordedFieldCount);
+  cursor = headerSize;
+  isFirstFrame = true;
+  isBroken = false;
+  hasKeyframe = false;
+  // Fields the recording does not have keep their live value.
+  const std::vector<std::size_t>& offsets = configOffsets();
+  configs.resize(offsets.back());
+  for (int id = 0; id < configFieldCount; ++id)
+    std::memcpy(configs.data() + offsets[id], configFields[id].value, configFields[id].size);
+  references.assign(particles.size(), {});
+  comparedKeyframes = divergedKeyframes = 0;
+  _maxDivergence = 0.0f;
+  frameTimes.clear();
+  return true;
+}
+
+bool Replayer::read(void* value, std::size_t size) {
+  if (data.size() - cursor < size) return false;
+  std::memcpy(value, data.data() + cursor, size);
+  cursor += size;
+  return true;
+}
+
+bool Replayer::beginFrame(Camera& camera) {
+  auto now = std::chrono::steady_clock::now();
+  if (!isFirstFrame) frameTimes.push_back(std::chrono::duration<float, std::milli>(now - lastFrame).count());
+  lastFrame = now;
+  if (isBroken || cursor == data.size()) return false;
+  auto stop = [this] {
+    isBroken = true;
+    return false;
+  };
+
+  unsigned char flags = 0;
+  if (!read(&flags, 1)) return stop();
+  cameraMoved = (flags & cameraFlag) != 0;
+  if (cameraMoved) {
+    float pose[cameraFloatCount];
+    if (!read(pose, sizeof(pose))) return stop();
+    camera.setPose(Eigen::Map<const Eigen::Vector4f>(pose), Eigen::Quaternionf(pose[7], pose[4], pose[5], pose[6]));
+  }
+  const std::vector<std::size_t>& offsets = configOffsets();
+  unsigned char changedCount = 0;
+  if (!read(&changedCount, 1)) return stop();
+  for (int i = 0; i < changedCount; ++i) {
+    unsigned char id = 0;
+    if (!read(&id, 1) || id >= fieldCount) return stop();
+    if (!read(configs.data() + offsets[id], configFields[id].size)) return stop();
+  }
+  const int threadCount = simulationThreadCount;
+  const int clothWidth = clothParticlesWidth, clothHeight = clothParticlesHeight;
+  for (int id = 0; id < configFieldCount; ++id)
+    std::memcpy(configFields[id].value, configs.data() + offsets[id], configFields[id].size);
+  if (simulationThreadCount != threadCount) ThreadPool::getPool().setThreadCount(simulationThreadCount);
+  // The cloth was built from the command line, the recording may start with another size.
+  if (isFirstFrame && (clothParticlesWidth != clothWidth || clothParticlesHeight != clothHeight))
+    isClothResolutionChanged = true;
+  // Recorded on a machine with compute shaders.
+  if (!isComputeShaderSupported) isGPUSimulationEnabled = false;
+
+  hasKeyframe = (flags & keyframeFlag) != 0;
+  if (hasKeyframe) {
+    std::uint32_t setCount = 0;
+    if (!read(&setCount, sizeof(setCount)) || setCount != particles.size()) return stop();
+    for (auto& reference : references) {
+      std::uint32_t particleCount = 0, payloadSize = 0;
+      if (!read(&particleCount, sizeof(particleCount)) || !read(&payloadSize, sizeof(payloadSize))) return stop();
+      if (data.size() - cursor < payloadSize) return stop();
+      std::size_t wordCount = static_cast<std::size_t>(particleCount) * wordsPerParticle;
+      if (reference.size() != wordCount) reference.assign(wordCount, 0);
+      if (!decodeDelta(data.data() + cursor, payloadSize, reference)) return stop();
+      cursor += payloadSize;
+    }
+  }
+  isFirstFrame = false;
+  return true;
+}
+
+void Replayer::endFrame(bool isOnGPU) {
+  if (!hasKeyframe || isOnGPU) return;
+  bool isDiverged = false;
+  for (std::size_t k = 0; k < particles.size(); ++k) {
+    gatherWords(*particles[k], words);
+    if (words.size() != references[k].size()) {
+      isDiverged = true;
+      _maxDivergence = std::numeric_limits<float>::infinity();
+      continue;
+    }
+    for (std::size_t w = 0; w < words.size(); ++w) {
+      if (words[w] == references[k][w]) continue;
+      float live, recorded;
+      std::memcpy(&live, &words[w], sizeof(float));
+      std::memcpy(&recorded, &references[k][w], sizeof(float));
+      isDiverged = true;
+      _maxDivergence = std::max(_maxDivergence, std::abs(live - recorded));
+    }
+  }
+  ++comparedKeyframes;
+  if (isDiverged) ++divergedKeyframes;
+}
+
+double Replayer::averageFrameTime() const {
+  if (frameTimes.empty()) return 0.0;
+  double total = 0.0;
+  for (float time : frameTimes) total += time;
+  return total / frameTimes.size();
+}
+
+bool Replayer::writeTrace(const char* path) const {
+  FILE* file = std::fopen(path, "w");
+  if (!file) return false;
+  std::fprintf(file, "frame,milliseconds\n");
+  for (std::size_t frame = 0; frame < frameTimes.size(); ++frame)
+    std::fprintf(file, "%zu,%.4f\n", frame, frameTimes[frame]);
+  return std::fclose(file) == 0;
+}
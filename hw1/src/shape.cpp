@@ -3,6 +3,7 @@
 #include <Eigen/Dense>
 #include "configs.h"
 #include "integrator.h"
+#include "threadpool.h"
 
 using Eigen::Matrix4f;
 
@@ -15,12 +16,28 @@ void Shape::setModelMatrix(const Eigen::Ref<const Eigen::Matrix4f>& _modelMatrix
 }
 
 void Shape::computeExternalForce() {
-  for (size_t i = 0; i < _particles.mass().size(); ++i) {
-    if (_particles.mass(i) == 0.0f) {
-      _particles.acceleration(i).setZero();
-    } else {
-      _particles.acceleration(i) = Eigen::Vector4f(0, -9.8f, 0, 0);
-      _particles.acceleration(i) -= _particles.velocity(i) * viscousCoef * _particles.inverseMass(i);
+  // Pinned particles have zero inverse mass, so they get neither gravity nor damping.
+  auto inverseMass = _particles.inverseMass().transpose();
+  _particles.acceleration().array() = (_particles.velocity().array() * -viscousCoef).rowwise() * inverseMass;
+  _particles.acceleration().row(1).array() -= 9.8f * (inverseMass > 0.0f).cast<float>();
+}
+
+void Shape::integrateExplicitFused() {
+  auto position = _particles.position();
+  auto velocity = _particles.velocity();
+  auto acceleration = _particles.acceleration();
+  const float* mass = _particles.getMassData();
+  const Eigen::ArrayXf& inverseMass = _particles.inverseMass();
+  auto kernel = [&](int begin, int end) {
+    const StateVector gravity = Eigen::Vector4f(0, -9.8f, 0, 0).head<stateRows>();
+    for (int i = begin; i < end; ++i) {
+      // Pinned particles have zero inverse mass, which also cancels gravity.
+      StateVector totalAcceleration =
+          inverseMass[i] * (mass[i] * gravity - viscousCoef * velocity.col(i)) + acceleration.col(i);
+      position.col(i).head<stateRows>() += deltaTime * velocity.col(i);
+      velocity.col(i) += deltaTime * totalAcceleration;
+      acceleration.col(i).setZero();
     }
-  }
+  };
+  ThreadPool::getPool().parallelFor(_particles.getCapacity(), kernel, 1024);
 }
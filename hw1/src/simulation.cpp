@@ -0,0 +1,136 @@
+#include "simulation.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "configs.h"
+#include "profiler.h"
+
+Simulation::Simulation(Cloth& cloth_, Spheres& spheres_) :
+    cloth(cloth_), spheres(spheres_), particles{&cloth_.particles(), &spheres_.particles()},
+    sphereParticles{&spheres_.particles()}, backwardEuler(cloth_), xpbd(cloth_, spheres_) {}
+
+void Simulation::simulateOneStep() {
+  {
+    ScopedTimer timer(Profiler::EXTERNAL_FORCE);
+    cloth.computeExternalForce();
+    spheres.computeExternalForce();
+  }
+  {
+    ScopedTimer timer(Profiler::SPRING_FORCE);
+    cloth.computeSpringForce();
+  }
+  {
+    ScopedTimer timer(Profiler::SPHERE_CLOTH_COLLISION);
+    spheres.collide(&cloth);
+  }
+  ScopedTimer timer(Profiler::SPHERE_COLLISION);
+  spheres.collide();
+}
+
+void Simulation::simulate(int integrator, int stepCount) {
+  // The integrator is chosen once, so its stages are compiled together with simulateOneStep.
+  switch (integrator) {
+    case 0: isExplicitEulerFused ? simulateFused(stepCount) : simulate(explicitEuler, stepCount); break;
+    case 1: simulate(implicitEuler, stepCount); break;
+    case 2: simulate(midpointEuler, stepCount); break;
+    case 3: simulate(rk4, stepCount); break;
+    case 4: simulate(backwardEuler, stepCount); break;
+    case 5: xpbd.simulate(stepCount); break;
+    default: break;
+  }
+  wasExplicitEulerFused = integrator == 0 && isExplicitEulerFused;
+}
+
+int Simulation::simulateAdaptive(int integrator, float frameTime) {
+  float stepTime = estimateStableTimeStep(integrator);
+  float stepCount = std::ceil(frameTime / stepTime);
+  int count = std::clamp(std::isfinite(stepCount) ? static_cast<int>(stepCount) : 1, 1, maxAdaptiveStepCount);
+  float nominalTime = deltaTime;
+  deltaTime = frameTime / count;
+  simulate(integrator, count);
+  deltaTime = nominalTime;
+  return count;
+}
+
+float Simulation::estimateStableTimeStep(int integrator) const {
+  float stepTime = std::numeric_limits<float>::infinity();
+  // Backward Euler and XPBD solve the springs implicitly, only the integrators below are limited by their stiffness.
+  if (integrator < 4) stepTime = estimateExplicitTimeStep();
+  // Moving a fraction of the shortest spring per step keeps the collisions from tunnelling.
+  float maxSpeed = std::sqrt(cloth.particles().velocity().colwise().squaredNorm().maxCoeff());
+  if (maxSpeed > 0.0f) stepTime = std::min(stepTime, 0.25f * cloth.minRestLength() / maxSpeed);
+  return stepTime;
+}
+
+float Simulation::estimateExplicitTimeStep() const {
+  // The damper acts along the same springs, so the stiffest mode has eigenvalues of s^2 + gamma s + kappa = 0.
+  float kappa = springCoef * cloth.maxStiffnessPerMass();
+  float gamma = damperCoef * cloth.maxStiffnessPerMass() + viscousCoef * cloth.particles().inverseMass().maxCoeff();
+  float stepTime = std::numeric_limits<float>::infinity();
+  if (gamma * gamma >= 4.0f * kappa) {
+    // Overdamped, both eigenvalues are real and the fast one decides.
+    float fastRate = 0.5f * gamma + std::sqrt(0.25f * gamma * gamma - kappa);
+    if (fastRate > 0.0f) stepTime = 2.0f / fastRate;
+  } else {
+    // Underdamped, |1 + s dt| < 1 for s = -gamma / 2 +- i sqrt(kappa - gamma^2 / 4).
+    stepTime = gamma / kappa;
+  }
+  // The explicit, implicit, midpoint and RK4 integrators only evaluate forces at explicit predictions and blow up
+  // at about the same step size, which is where explicit Euler does.
+  return stepTime * adaptiveSafetyFactor;
+}
+
+void Simulation::simulateSpheres(int stepCount) {
+  auto step = [this]() {
+    {
+      ScopedTimer timer(Profiler::EXTERNAL_FORCE);
+      spheres.computeExternalForce();
+    }
+    ScopedTimer timer(Profiler::SPHERE_COLLISION);
+    spheres.collide();
+  };
+  for (int i = 0; i < stepCount; i++) {
+    step();
+    ScopedTimer timer(Profiler::INTEGRATOR);
+    explicitEuler.step(sphereParticles, step);
+  }
+}
+
+template <class IntegratorType>
+void Simulation::simulate(const IntegratorType& integrator, int stepCount) {
+  auto step = [this]() { simulateOneStep(); };
+  for (int i = 0; i < stepCount; i++) {
+    simulateOneStep();
+    // Steps taken inside the integrator count for their own stages.
+    ScopedTimer timer(Profiler::INTEGRATOR);
+    integrator.step(particles, step);
+  }
+}
+
+void Simulation::simulateFused(int stepCount) {
+  // The fused sweep leaves accelerations cleared, clear them once when coming from another path.
+  if (!wasExplicitEulerFused) {
+    cloth.particles().acceleration().setZero();
+    spheres.particles().acceleration().setZero();
+  }
+  for (int i = 0; i < stepCount; i++) {
+    {
+      ScopedTimer timer(Profiler::SPRING_FORCE);
+      cloth.computeSpringForce();
+    }
+    {
+      ScopedTimer timer(Profiler::SPHERE_CLOTH_COLLISION);
+      spheres.collide(&cloth);
+    }
+    {
+      ScopedTimer timer(Profiler::SPHERE_COLLISION);
+      spheres.collide();
+    }
+    // External forces are part of the fused sweep.
+    ScopedTimer timer(Profiler::INTEGRATOR);
+    cloth.integrateExplicitFused();
+    spheres.integrateExplicitFused();
+  }
+}
@@ -0,0 +1,48 @@
+#include "spatialhash.h"
+
+#include <algorithm>
+
+void SpatialHash::update(const Eigen::Ref<const Eigen::Matrix4Xf>& points, float cellSize_) {
+  int pointCount = static_cast<int>(points.cols());
+  std::uint32_t newTableSize = 1;
+  while (newTableSize < 2u * static_cast<std::uint32_t>(pointCount)) newTableSize <<= 1;
+  bool isRebuildNeeded = cellSize != cellSize_ || tableSize != newTableSize ||
+                         static_cast<int>(sortedPoints.size()) != pointCount;
+  cellSize = cellSize_;
+  // Without a positive size, e.g. spheres of radius 0, every point goes to cell 0.
+  inverseCellSize = cellSize_ > 0.0f ? 1.0f / cellSize_ : 0.0f;
+  tableSize = newTableSize;
+  pointBuckets.resize(pointCount, tableSize);
+
+  for (int i = 0; i < pointCount; ++i) {
+    std::uint32_t b = bucket(cell(points(0, i)), cell(points(1, i)), cell(points(2, i)));
+    isRebuildNeeded |= (b != pointBuckets[i]);
+    pointBuckets[i] = b;
+  }
+  if (!isRebuildNeeded) return;
+  // Counting sort the points by bucket.
+  bucketStart.assign(tableSize + 1, 0);
+  for (int i = 0; i < pointCount; ++i) ++bucketStart[pointBuckets[i] + 1];
+  for (std::uint32_t b = 0; b < tableSize; ++b) bucketStart[b + 1] += bucketStart[b];
+  sortedPoints.resize(pointCount);
+  for (int i = pointCount - 1; i >= 0; --i) sortedPoints[--bucketStart[pointBuckets[i] + 1]] = i;
+  // The loop above leaves bucketStart[b + 1] at the start of bucket b, shift it back.
+  std::rotate(bucketStart.begin(), bucketStart.begin() + 1, bucketStart.end());
+  bucketStart[tableSize] = pointCount;
+}
+
+void SpatialHash::query(const Eigen::Ref<const Eigen::Vector4f>& lower, const Eigen::Ref<const Eigen::Vector4f>& upper,
+                        std::vector<int>& candidates) const {
+  if (tableSize == 0) return;
+  int minX = cell(lower[0]), minY = cell(lower[1]), minZ = cell(lower[2]);
+  int maxX = cell(upper[0]), maxY = cell(upper[1]), maxZ = cell(upper[2]);
+  for (int x = minX; x <= maxX; ++x) {
+    for (int y = minY; y <= maxY; ++y) {
+      for (int z = minZ; z <= maxZ; ++z) {
+        std::uint32_t b = bucket(x, y, z);
+        candidates.insert(candidates.end(), sortedPoints.begin() + bucketStart[b],
+                          sortedPoints.begin() + bucketStart[b + 1]);
+      }
+    }
+  }
+}
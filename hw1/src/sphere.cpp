@@ -1,5 +1,7 @@
 #include "sphere.h"
 
+#include <algorithm>
+
 #include <Eigen/Dense>
 
 #include "cloth.h"
@@ -57,47 +59,61 @@ void Spheres::addSphere(const Eigen::Ref<const Eigen::Vector4f>& position, float
   if (sphereCount == _particles.getCapacity()) {
     _particles.resize(sphereCount * 2);
     _radius.resize(sphereCount * 2);
-    offsets.allocate(8 * sphereCount * sizeof(float));
-    sizes.allocate(2 * sphereCount * sizeof(float));
+    if (render) {
+      render->offsets.allocateRegions(8 * sphereCount * sizeof(float));
+      render->sizes.allocate(2 * sphereCount * sizeof(float));
+    }
   }
   _radius[sphereCount] = size;
   _particles.position(sphereCount) = position;
   _particles.velocity(sphereCount).setZero();
   _particles.acceleration(sphereCount).setZero();
-  _particles.mass(sphereCount) = sphereDensity * size * size * size;
+  _particles.setMass(sphereCount, sphereDensity * size * size * size);
 
-  sizes.load(0, _radius.size() * sizeof(float), _radius.data());
+  if (render) render->sizes.load(0, _radius.size() * sizeof(float), _radius.data());
   ++sphereCount;
 }
 
-Spheres::Spheres() : Shape(1, 1), sphereCount(0), _radius(1, 0.0f) {
-  offsets.allocate(4 * sizeof(float));
-  sizes.allocate(sizeof(float));
+void Spheres::clear() {
+  _particles.setZero();
+  _particles.setMass(0.0f);
+  std::fill(_radius.begin(), _radius.end(), 0.0f);
+  sphereCount = 0;
+}
+
+Spheres::Spheres() :
+    Shape(1, 1),
+    sphereCount(0),
+    _radius(1, 0.0f),
+    render(isHeadless ? nullptr : std::make_unique<RenderResources>()) {
+  if (!render) return;
+  render->offsets.allocateRegions(4 * sizeof(float));
+  render->sizes.allocate(sizeof(float));
 
   std::vector<GLfloat> vertices;
   std::vector<GLuint> indices;
   generateVertices(vertices, indices);
 
-  vbo.allocate_load(vertices.size() * sizeof(GLfloat), vertices.data());
-  ebo.allocate_load(indices.size() * sizeof(GLuint), indices.data());
+  render->vbo.allocate_load(vertices.size() * sizeof(GLfloat), vertices.data());
+  render->ebo.allocate_load(indices.size() * sizeof(GLuint), indices.data());
 
-  vao.bind();
-  vbo.bind();
-  ebo.bind();
+  render->vao.bind();
+  render->vbo.bind();
+  render->ebo.bind();
 
-  vao.enable(0);
-  vao.setAttributePointer(0, 3, 6, 0);
+  render->vao.enable(0);
+  render->vao.setAttributePointer(0, 3, 6, 0);
   glVertexAttribDivisor(0, 0);
-  vao.enable(1);
-  vao.setAttributePointer(1, 3, 6, 3);
+  render->vao.enable(1);
+  render->vao.setAttributePointer(1, 3, 6, 3);
   glVertexAttribDivisor(1, 0);
-  offsets.bind();
-  vao.enable(2);
-  vao.setAttributePointer(2, 3, 4, 0);
+  render->offsets.bind();
+  render->vao.enable(2);
+  render->vao.setAttributePointer(2, 3, 4, 0);
   glVertexAttribDivisor(2, 1);
-  sizes.bind();
-  vao.enable(3);
-  vao.setAttributePointer(3, 1, 1, 0);
+  render->sizes.bind();
+  render->vao.enable(3);
+  render->vao.setAttributePointer(3, 1, 1, 0);
   glVertexAttribDivisor(3, 1);
 
   glBindVertexArray(0);
@@ -106,9 +122,13 @@ Spheres::Spheres() : Shape(1, 1), sphereCount(0), _radius(1, 0.0f) {
 }
 
 void Spheres::draw() const {
-  vao.bind();
-  offsets.load(0, 4 * sphereCount * sizeof(GLfloat), _particles.getPositionData());
-  GLsizei indexCount = static_cast<GLsizei>(ebo.size() / sizeof(GLuint));
+  if (!render) return;
+  render->vao.bind();
+  // The region moves every frame, so does the attribute pointer.
+  GLintptr offset = render->offsets.write(_particles.getPositionData(), 4 * sphereCount * sizeof(GLfloat));
+  render->offsets.bind();
+  render->vao.setAttributePointer(2, 3, 4, static_cast<int>(offset / sizeof(GLfloat)));
+  GLsizei indexCount = static_cast<GLsizei>(render->ebo.size() / sizeof(GLuint));
   glDrawElementsInstanced(GL_TRIANGLES, indexCount, GL_UNSIGNED_INT, nullptr, sphereCount);
   glBindVertexArray(0);
 }
@@ -122,7 +142,7 @@ void Spheres::collide(Cloth* cloth) {
   //   3. (Bonus) You can add friction, which updates particles' acceleration a = F / m
   // Note:
   //   1. There are `sphereCount` spheres.
-  //   2. There are `particlesPerEdge * particlesPerEdge` particles.
+  //   2. There are `cloth->width() * cloth->height()` particles.
   //   3. See TODOs in Cloth::computeSpringForce if you don't know how to access data.
   // Hint:
   //   1. You can simply push particles back to prevent penetration.
@@ -132,46 +152,76 @@ void Spheres::collide(Cloth* cloth) {
   //       _particles.position(j) -= correction;
 
   // Write code here!
+  if (sphereCount == 0) return;
+  // Broad phase: a sphere only tests the particles binned in cells overlapped by its bounding box.
+  Particles& clothParticles = cloth->particles();
+  clothGrid.update(clothParticles.position(), *std::max_element(_radius.begin(), _radius.begin() + sphereCount));
+  // How far the corrections moved each particle from where the grid binned it, and the most any particle moved.
+  clothDrift.assign(clothParticles.getCapacity(), 0.0f);
+  float maxClothDrift = 0.0f;
   for (int j = 0; j < sphereCount; j++) {
-    for (int i = 0; i < particlesPerEdge * particlesPerEdge; i++) {
-      if ((cloth->particles().position(i) - _particles.position(j)).norm() <= _radius[j]) {
-        Eigen::Vector4f vec = cloth->particles().position(i) - _particles.position(j);
-        Eigen::Vector4f v1 = vec.normalized().dot(_particles.velocity(j)) * vec.normalized();
-        Eigen::Vector4f v2 = vec.normalized().dot(cloth->particles().velocity(i)) * vec.normalized();
-        float m1 = _particles.mass(j), m2 = cloth->particles().mass(i);
-        Eigen::Vector4f v1_after = (m1 * v1 + m2 * v2) / (m1 + m2);
-        Eigen::Vector4f v2_after = (m1 * v1 + m2 * v2) / (m1 + m2);
-        _particles.velocity(j) += -v1 + v1_after;
-        cloth->particles().velocity(i) += -v2 + v2_after;
-
-        float normal_force_value = ((v1_after - v1) / deltaTime * _particles.mass(j)).norm();  //ʩҳyO
-        v1 = (_particles.velocity(j) - v1).normalized();
-        v2 = (cloth->particles().velocity(i) - v2).normalized();
-        Eigen::Vector4f move_friction_1 = (v2 - v1) * normal_force_value * frictionCoef;
-        Eigen::Vector4f move_friction_2 = (v1 - v2) * normal_force_value * frictionCoef;
-        _particles.velocity(j) += deltaTime * move_friction_1 * _particles.inverseMass(j);
-        cloth->particles().velocity(i) += deltaTime * move_friction_2 * cloth->particles().inverseMass(i);
-        
-        Eigen::Vector4f rotate_direction_1 = _particles.rotation(j).cross3(vec.normalized()).normalized();  //yO
-        Eigen::Vector4f rotate_friction_1 =
-            (- rotate_direction_1) * normal_force_value * frictionCoef;
-        Eigen::Vector4f rotate_friction_2 = rotate_direction_1 * normal_force_value * frictionCoef;
-         _particles.velocity(j) += deltaTime * rotate_direction_1 * _particles.inverseMass(j);
-        cloth->particles().velocity(i) += deltaTime * rotate_friction_2 * cloth->particles().inverseMass(i);
-
-        float I1 = (float)2 / 5 * _particles.mass(j) * _radius[j] * _radius[j];
-        _particles.rotation(j) += (vec.normalized().cross3(move_friction_1 + rotate_direction_1) / I1) * deltaTime;
-
-        float penetration = _radius[j] - abs((cloth->particles().position(i) - _particles.position(j)).norm());
-        auto correction = penetration * vec.normalized() * 0.15;
-        cloth->particles().position(i) += correction;
-        _particles.position(j) -= correction;
+    // Padded, since the contacts resolved below move the sphere. Once it moved past the padding, the particles after
+    // the current one are queried again around it, so every pair the brute force loop resolves is still found.
+    const float padding = 0.25f * _radius[j];
+    Eigen::Vector4f queryCenter = _particles.position(j);
+    auto queryAfter = [&](int last) {
+      Eigen::Vector4f extent = Eigen::Vector4f::Constant(_radius[j] + padding + maxClothDrift);
+      contactCandidates.clear();
+      clothGrid.query(queryCenter - extent, queryCenter + extent, contactCandidates);
+      // Same visiting order as testing every particle, and buckets may be listed twice.
+      std::sort(contactCandidates.begin(), contactCandidates.end());
+      contactCandidates.erase(std::unique(contactCandidates.begin(), contactCandidates.end()), contactCandidates.end());
+      contactCandidates.erase(contactCandidates.begin(),
+                              std::upper_bound(contactCandidates.begin(), contactCandidates.end(), last));
+    };
+    queryAfter(-1);
+    for (std::size_t c = 0; c < contactCandidates.size(); ++c) {
+      int i = contactCandidates[c];
+      Eigen::Vector4f vec = clothParticles.position(i) - _particles.position(j);
+      float distance = vec.norm();
+      if (distance > _radius[j]) continue;
+      StateVector normal = vec.normalized().head<stateRows>();
+      StateVector v1 = normal.dot(_particles.velocity(j)) * normal;
+      StateVector v2 = normal.dot(clothParticles.velocity(i)) * normal;
+      float m1 = _particles.mass(j), m2 = clothParticles.mass(i);
+      StateVector v1_after = (m1 * v1 + m2 * v2) / (m1 + m2);
+      StateVector v2_after = (m1 * v1 + m2 * v2) / (m1 + m2);
+      _particles.velocity(j) += -v1 + v1_after;
+      clothParticles.velocity(i) += -v2 + v2_after;
+
+      float normal_force_value = ((v1_after - v1) / deltaTime * _particles.mass(j)).norm();  //ʩҳyO
+      v1 = (_particles.velocity(j) - v1).normalized();
+      v2 = (clothParticles.velocity(i) - v2).normalized();
+      StateVector move_friction_1 = (v2 - v1) * normal_force_value * frictionCoef;
+      StateVector move_friction_2 = (v1 - v2) * normal_force_value * frictionCoef;
+      _particles.velocity(j) += deltaTime * move_friction_1 * _particles.inverseMass(j);
+      clothParticles.velocity(i) += deltaTime * move_friction_2 * clothParticles.inverseMass(i);
+
+      StateVector rotate_direction_1 = stateCross(_particles.rotation(j), normal).normalized();  //yO
+      StateVector rotate_friction_1 =
+          (- rotate_direction_1) * normal_force_value * frictionCoef;
+      StateVector rotate_friction_2 = rotate_direction_1 * normal_force_value * frictionCoef;
+      _particles.velocity(j) += deltaTime * rotate_direction_1 * _particles.inverseMass(j);
+      clothParticles.velocity(i) += deltaTime * rotate_friction_2 * clothParticles.inverseMass(i);
+
+      float I1 = (float)2 / 5 * _particles.mass(j) * _radius[j] * _radius[j];
+      _particles.rotation(j) += (stateCross(normal, move_friction_1 + rotate_direction_1) / I1) * deltaTime;
+
+      float penetration = _radius[j] - distance;
+      auto correction = penetration * normal * 0.15;
+      clothParticles.statePosition(i) += correction;
+      _particles.statePosition(j) -= correction;
+      clothDrift[i] += 0.15f * penetration;
+      maxClothDrift = std::max(maxClothDrift, clothDrift[i]);
+      if ((_particles.position(j) - queryCenter).head<3>().norm() > padding) {
+        queryCenter = _particles.position(j);
+        queryAfter(i);
+        c = static_cast<std::size_t>(-1);
       }
     }
   }
 }
 void Spheres::collide() {
-  constexpr float coefRestitution = 0.8f;
   // TODO: Collide with another sphere (Rigidbody collision)
   //   1. Detect collision.
   //   2. If collided, update impulse directly to particles' velocity
@@ -184,45 +234,54 @@ void Spheres::collide() {
   //   1. You can simply push particles back to prevent penetration.
 
   // Write code here!
-  for (int j = 0; j < sphereCount; j++) {
-    for (int i = j+1; i < sphereCount; i++) {
-      if ((_particles.position(i) - _particles.position(j)).norm() <= _radius[j]+_radius[i]) {
-        Eigen::Vector4f vec = _particles.position(i) - _particles.position(j);
-        Eigen::Vector4f v1 = vec.normalized().dot(_particles.velocity(j)) * vec.normalized();
-        Eigen::Vector4f v2 = vec.normalized().dot(_particles.velocity(i)) * vec.normalized();
-        float m1 = _particles.mass(j), m2 = _particles.mass(i);
-        Eigen::Vector4f v1_after = (m1 * v1 + m2 * v2 + m2 * coefRestitution * (v2 - v1)) / (m1 + m2);
-        Eigen::Vector4f v2_after = (m1 * v1 + m2 * v2 + m1 * coefRestitution * (v1 - v2)) / (m1 + m2);
-        _particles.velocity(j) += -v1 + v1_after;
-        _particles.velocity(i) += -v2 + v2_after;
-
-        float normal_force_value = ((v1_after - v1) / deltaTime * _particles.mass(j)).norm();  //ʩҳyO
-        v1 = (_particles.velocity(j) - v1).normalized();
-        v2 = (_particles.velocity(i) - v2).normalized();
-        Eigen::Vector4f move_friction_1 = (v2 - v1) * normal_force_value * frictionCoef;
-        Eigen::Vector4f move_friction_2 = (v1 - v2) * normal_force_value * frictionCoef;
-        _particles.velocity(j) += deltaTime * move_friction_1 * _particles.inverseMass(j);
-        _particles.velocity(i) += deltaTime * move_friction_2 * _particles.inverseMass(i);
-
-        Eigen::Vector4f rotate_direction_1 = _particles.rotation(j).cross3(vec.normalized()).normalized();  //yO
-        Eigen::Vector4f rotate_direction_2 = _particles.rotation(i).cross3(vec.normalized()).normalized();
-        Eigen::Vector4f rotate_friction_1 =
-            (rotate_direction_2 - rotate_direction_1) * normal_force_value * frictionCoef;
-        Eigen::Vector4f rotate_friction_2 =
-            (rotate_direction_1 - rotate_direction_1) * normal_force_value * frictionCoef;
-        _particles.velocity(j) += deltaTime * rotate_direction_1 * _particles.inverseMass(j);
-        _particles.velocity(i) += deltaTime * rotate_direction_2 * _particles.inverseMass(i);
-
-        float I1 = (float)2 / 5 * _particles.mass(j) * _radius[j] * _radius[j];
-        float I2 = (float)2 / 5 * _particles.mass(i) * _radius[i] * _radius[i];
-        _particles.rotation(j) += (vec.normalized().cross3(move_friction_1 + rotate_direction_1) / I1) * deltaTime;
-        _particles.rotation(i) += (vec.normalized().cross3(move_friction_2 + rotate_direction_2) / I2) * deltaTime;
-
-        float penetration = _radius[j] + _radius[i] - abs((_particles.position(i) - _particles.position(j)).norm());
-        auto correction = penetration * vec.normalized() * 0.15;
-        _particles.position(i) += correction;
-        _particles.position(j) -= correction;
-      }
+  if (isSphereBroadPhaseEnabled) {
+    broadPhase.update(_particles.position(), _radius, sphereCount);
+    for (const auto& [j, i] : broadPhase.pairs()) resolveCollision(j, i);
+  } else {
+    for (int j = 0; j < sphereCount; j++) {
+      for (int i = j + 1; i < sphereCount; i++) resolveCollision(j, i);
     }
   }
 }
+
+void Spheres::resolveCollision(int j, int i) {
+  constexpr float coefRestitution = 0.8f;
+  Eigen::Vector4f vec = _particles.position(i) - _particles.position(j);
+  float distance = vec.norm();
+  if (distance > _radius[j] + _radius[i]) return;
+  StateVector normal = vec.normalized().head<stateRows>();
+  StateVector v1 = normal.dot(_particles.velocity(j)) * normal;
+  StateVector v2 = normal.dot(_particles.velocity(i)) * normal;
+  float m1 = _particles.mass(j), m2 = _particles.mass(i);
+  StateVector v1_after = (m1 * v1 + m2 * v2 + m2 * coefRestitution * (v2 - v1)) / (m1 + m2);
+  StateVector v2_after = (m1 * v1 + m2 * v2 + m1 * coefRestitution * (v1 - v2)) / (m1 + m2);
+  _particles.velocity(j) += -v1 + v1_after;
+  _particles.velocity(i) += -v2 + v2_after;
+
+  float normal_force_value = ((v1_after - v1) / deltaTime * _particles.mass(j)).norm();  //ʩҳyO
+  v1 = (_particles.velocity(j) - v1).normalized();
+  v2 = (_particles.velocity(i) - v2).normalized();
+  StateVector move_friction_1 = (v2 - v1) * normal_force_value * frictionCoef;
+  StateVector move_friction_2 = (v1 - v2) * normal_force_value * frictionCoef;
+  _particles.velocity(j) += deltaTime * move_friction_1 * _particles.inverseMass(j);
+  _particles.velocity(i) += deltaTime * move_friction_2 * _particles.inverseMass(i);
+
+  StateVector rotate_direction_1 = stateCross(_particles.rotation(j), normal).normalized();  //yO
+  StateVector rotate_direction_2 = stateCross(_particles.rotation(i), normal).normalized();
+  StateVector rotate_friction_1 =
+      (rotate_direction_2 - rotate_direction_1) * normal_force_value * frictionCoef;
+  StateVector rotate_friction_2 =
+      (rotate_direction_1 - rotate_direction_1) * normal_force_value * frictionCoef;
+  _particles.velocity(j) += deltaTime * rotate_direction_1 * _particles.inverseMass(j);
+  _particles.velocity(i) += deltaTime * rotate_direction_2 * _particles.inverseMass(i);
+
+  float I1 = (float)2 / 5 * _particles.mass(j) * _radius[j] * _radius[j];
+  float I2 = (float)2 / 5 * _particles.mass(i) * _radius[i] * _radius[i];
+  _particles.rotation(j) += (stateCross(normal, move_friction_1 + rotate_direction_1) / I1) * deltaTime;
+  _particles.rotation(i) += (stateCross(normal, move_friction_2 + rotate_direction_2) / I2) * deltaTime;
+
+  float penetration = _radius[j] + _radius[i] - distance;
+  auto correction = penetration * normal * 0.15;
+  _particles.statePosition(i) += correction;
+  _particles.statePosition(j) -= correction;
+}
@@ -0,0 +1,15 @@
+#include "spring.h"
+
+void SpringArrays::assign(const std::vector<Spring>& springs, const float (&typeStiffness)[3]) {
+  int springCount = static_cast<int>(springs.size());
+  _startIndex.resize(springCount);
+  _endIndex.resize(springCount);
+  _restLength.resize(springCount);
+  _stiffness.resize(springCount);
+  for (int i = 0; i < springCount; ++i) {
+    _startIndex[i] = static_cast<int>(springs[i].startParticleIndex());
+    _endIndex[i] = static_cast<int>(springs[i].endParticleIndex());
+    _restLength[i] = springs[i].length();
+    _stiffness[i] = typeStiffness[static_cast<int>(springs[i].type())];
+  }
+}
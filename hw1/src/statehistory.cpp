@@ -0,0 +1,51 @@
+#include "statehistory.h"
+
+#include <algorithm>
+#include <utility>
+
+StateHistory::StateHistory(std::vector<Particles*> particles_, int maxFrameCount_, std::size_t memoryBudget_) :
+    particles(std::move(particles_)), maxFrameCount(std::max(1, maxFrameCount_)), memoryBudget(memoryBudget_) {}
+
+int StateHistory::capacity() const {
+  // Position, velocity, acceleration and rotation of every particle.
+  std::size_t frameSize = 0;
+  for (const Particles* p : particles)
+    frameSize += (sizeof(Eigen::Vector4f) + 3 * sizeof(StateVector)) * p->getCapacity();
+  if (frameSize == 0) return maxFrameCount;
+  return static_cast<int>(std::clamp<std::size_t>(memoryBudget / frameSize, 1, maxFrameCount));
+}
+
+void StateHistory::push() {
+  int slotCount = capacity();
+  if (static_cast<int>(frames.size()) != slotCount) {
+    // The budget changed with the particle count, the old frames cannot be restored anyway.
+    frames.resize(slotCount);
+    clear();
+  }
+  // Continue from the frame seeked to.
+  newestSlot = (newestSlot - seekAge + slotCount) % slotCount;
+  frameCount -= seekAge;
+  seekAge = 0;
+
+  newestSlot = (newestSlot + 1) % slotCount;
+  frameCount = std::min(frameCount + 1, slotCount);
+  std::vector<ParticleState>& frame = frames[newestSlot];
+  frame.resize(particles.size());
+  for (size_t k = 0; k < particles.size(); ++k) particles[k]->save(frame[k]);
+}
+
+bool StateHistory::seek(int age) {
+  if (age < 0 || age >= frameCount) return false;
+  int slotCount = static_cast<int>(frames.size());
+  const std::vector<ParticleState>& frame = frames[(newestSlot - age + slotCount) % slotCount];
+  for (size_t k = 0; k < particles.size(); ++k) particles[k]->restore(frame[k]);
+  seekAge = age;
+  return true;
+}
+
+void StateHistory::clear() {
+  // The slots keep their storage.
+  newestSlot = -1;
+  frameCount = 0;
+  seekAge = 0;
+}
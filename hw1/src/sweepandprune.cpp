@@ -0,0 +1,35 @@
+#include "sweepandprune.h"
+
+#include <algorithm>
+#include <cmath>
+
+void SweepAndPrune::update(const Eigen::Ref<const Eigen::Matrix4Xf>& position, const std::vector<float>& radius,
+                           int count) {
+  // New spheres are appended, the order of existing ones is kept.
+  if (static_cast<int>(order.size()) > count) order.clear();
+  for (int i = static_cast<int>(order.size()); i < count; ++i) order.push_back(i);
+  lowerX.resize(count);
+  for (int i = 0; i < count; ++i) lowerX[i] = position(0, i) - radius[i];
+  // Insertion sort, spheres barely move between two steps.
+  for (int k = 1; k < count; ++k) {
+    int current = order[k];
+    int l = k - 1;
+    for (; l >= 0 && lowerX[order[l]] > lowerX[current]; --l) order[l + 1] = order[l];
+    order[l + 1] = current;
+  }
+
+  _pairs.clear();
+  for (int k = 0; k < count; ++k) {
+    int a = order[k];
+    float upperX = position(0, a) + radius[a];
+    for (int l = k + 1; l < count && lowerX[order[l]] <= upperX; ++l) {
+      int b = order[l];
+      float extent = radius[a] + radius[b];
+      if (std::abs(position(1, a) - position(1, b)) > extent || std::abs(position(2, a) - position(2, b)) > extent)
+        continue;
+      _pairs.emplace_back(std::min(a, b), std::max(a, b));
+    }
+  }
+  // Resolve in the same order as testing every pair.
+  std::sort(_pairs.begin(), _pairs.end());
+}
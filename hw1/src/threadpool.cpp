@@ -0,0 +1,81 @@
+#include "threadpool.h"
+
+#include <algorithm>
+
+#include "configs.h"
+
+ThreadPool::ThreadPool(int count) { setThreadCount(count); }
+
+ThreadPool::~ThreadPool() { stopWorkers(); }
+
+ThreadPool& ThreadPool::getPool() {
+  static ThreadPool pool(simulationThreadCount);
+  return pool;
+}
+
+void ThreadPool::setThreadCount(int count) {
+  count = std::max(1, count);
+  if (count == getThreadCount()) return;
+  stopWorkers();
+  isStopping = false;
+  generation = 0;
+  workers.reserve(count - 1);
+  for (int i = 0; i < count - 1; ++i) workers.emplace_back(&ThreadPool::workerLoop, this);
+}
+
+void ThreadPool::stopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    isStopping = true;
+  }
+  wakeCondition.notify_all();
+  for (auto& worker : workers) worker.join();
+  workers.clear();
+}
+
+void ThreadPool::run(int count, int grainSize, Task task_, void* context_) {
+  if (count <= 0) return;
+  int maxChunks = std::max(1, count / std::max(1, grainSize));
+  if (workers.empty() || maxChunks == 1) {
+    task_(context_, 0, count);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(mutex);
+    task = task_;
+    context = context_;
+    itemCount = count;
+    // A few chunks per thread to balance uneven chunks.
+    chunkCount = std::min(maxChunks, 4 * getThreadCount());
+    chunkSize = (count + chunkCount - 1) / chunkCount;
+    chunkCount = (count + chunkSize - 1) / chunkSize;
+    nextChunk.store(0, std::memory_order_relaxed);
+    activeWorkers = static_cast<int>(workers.size());
+    ++generation;
+  }
+  wakeCondition.notify_all();
+  work();
+  std::unique_lock<std::mutex> lock(mutex);
+  doneCondition.wait(lock, [this] { return activeWorkers == 0; });
+}
+
+void ThreadPool::work() {
+  for (int chunk = nextChunk.fetch_add(1); chunk < chunkCount; chunk = nextChunk.fetch_add(1)) {
+    int begin = chunk * chunkSize;
+    task(context, begin, std::min(begin + chunkSize, itemCount));
+  }
+}
+
+void ThreadPool::workerLoop() {
+  unsigned int seenGeneration = 0;
+  std::unique_lock<std::mutex> lock(mutex);
+  while (true) {
+    wakeCondition.wait(lock, [&] { return isStopping || generation != seenGeneration; });
+    if (isStopping) return;
+    seenGeneration = generation;
+    lock.unlock();
+    work();
+    lock.lock();
+    if (--activeWorkers == 0) doneCondition.notify_one();
+  }
+}
@@ -0,0 +1,138 @@
+#include "xpbd.h"
+
+#include <algorithm>
+
+#include "configs.h"
+#include "profiler.h"
+#include "threadpool.h"
+
+void XPBD::simulate(int stepCount) {
+  const std::vector<int>& batchOffsets = cloth.springBatchOffsets();
+  for (int i = 0; i < stepCount; i++) {
+    predict();
+    {
+      ScopedTimer timer(Profiler::SPHERE_CLOTH_COLLISION);
+      findContacts();
+    }
+    lambda.setZero(cloth.springArrays().size());
+    for (int iteration = 0; iteration < xpbdIterationCount; ++iteration) {
+      {
+        ScopedTimer timer(Profiler::SPRING_FORCE);
+        // Springs of a batch share no particle, so a batch is projected in parallel.
+        for (size_t batch = 0; batch + 1 < batchOffsets.size(); ++batch) {
+          int offset = batchOffsets[batch];
+          ThreadPool::getPool().parallelFor(
+              batchOffsets[batch + 1] - offset,
+              [this, offset](int begin, int end) { solveDistanceConstraints(begin + offset, end + offset); }, 512);
+        }
+      }
+      ScopedTimer timer(Profiler::SPHERE_CLOTH_COLLISION);
+      solveContacts();
+    }
+    ScopedTimer timer(Profiler::INTEGRATOR);
+    const float inverseTime = 1.0f / deltaTime;
+    cloth.particles().velocity() =
+        (cloth.particles().statePosition() - previousCloth.topRows<stateRows>()) * inverseTime;
+    spheres.particles().velocity() =
+        (spheres.particles().statePosition() - previousSpheres.topRows<stateRows>()) * inverseTime;
+  }
+}
+
+void XPBD::predict() {
+  Particles& clothParticles = cloth.particles();
+  Particles& sphereParticles = spheres.particles();
+  {
+    ScopedTimer timer(Profiler::EXTERNAL_FORCE);
+    cloth.computeExternalForce();
+    spheres.computeExternalForce();
+  }
+  {
+    ScopedTimer timer(Profiler::SPHERE_COLLISION);
+    spheres.collide();
+  }
+  ScopedTimer timer(Profiler::INTEGRATOR);
+  previousCloth = clothParticles.position();
+  previousSpheres = sphereParticles.position();
+  for (Particles* particles : {&clothParticles, &sphereParticles}) {
+    particles->velocity() += deltaTime * particles->acceleration();
+    particles->statePosition() += deltaTime * particles->velocity();
+  }
+}
+
+void XPBD::solveDistanceConstraints(int begin, int end) {
+  const SpringArrays& springs = cloth.springArrays();
+  Particles& particles = cloth.particles();
+  const float inverseTimeSquared = 1.0f / (deltaTime * deltaTime);
+  for (int s = begin; s < end; ++s) {
+    int i = springs.startIndex()[s], j = springs.endIndex()[s];
+    float wi = particles.inverseMass(i), wj = particles.inverseMass(j);
+    if (wi + wj == 0.0f) continue;
+    // Infinitely compliant without stiffness, like a spring of no force.
+    float stiffness = springCoef * springs.stiffness()[s];
+    if (stiffness <= 0.0f) continue;
+    Eigen::Vector4f d = particles.position(j) - particles.position(i);
+    float length = d.norm();
+    if (length == 0.0f) continue;
+    Eigen::Vector4f n = d / length;
+    float constraint = length - springs.restLength()[s];
+    // alpha~ = alpha / h^2 and gamma = alpha~ beta~ / h with compliance alpha = 1 / k and damping beta = damperCoef.
+    float compliance = inverseTimeSquared / stiffness;
+    float gamma = compliance * damperCoef * deltaTime;
+    // Rate of the constraint from the motion during this step, damped like the spring's damper.
+    float rate = n.dot((particles.position(j) - previousCloth.col(j)) - (particles.position(i) - previousCloth.col(i)));
+    float deltaLambda =
+        (-constraint - compliance * lambda[s] - gamma * rate) / ((1.0f + gamma) * (wi + wj) + compliance);
+    lambda[s] += deltaLambda;
+    particles.position(i) -= wi * deltaLambda * n;
+    particles.position(j) += wj * deltaLambda * n;
+  }
+}
+
+void XPBD::findContacts() {
+  int sphereCount = spheres.count();
+  contactCandidates.clear();
+  contactOffsets.assign(1, 0);
+  if (sphereCount == 0) return;
+  Particles& sphereParticles = spheres.particles();
+  float maxRadius = 0.0f;
+  for (int j = 0; j < sphereCount; ++j) maxRadius = std::max(maxRadius, spheres.radius(j));
+  clothGrid.update(cloth.particles().position(), maxRadius);
+  for (int j = 0; j < sphereCount; ++j) {
+    // Padded, the constraints move the particles and the sphere during the step.
+    Eigen::Vector4f extent = Eigen::Vector4f::Constant(1.25f * spheres.radius(j));
+    auto first = static_cast<std::ptrdiff_t>(contactCandidates.size());
+    clothGrid.query(sphereParticles.position(j) - extent, sphereParticles.position(j) + extent, contactCandidates);
+    std::sort(contactCandidates.begin() + first, contactCandidates.end());
+    contactCandidates.erase(std::unique(contactCandidates.begin() + first, contactCandidates.end()),
+                            contactCandidates.end());
+    contactOffsets.push_back(static_cast<int>(contactCandidates.size()));
+  }
+}
+
+void XPBD::solveContacts() {
+  Particles& clothParticles = cloth.particles();
+  Particles& sphereParticles = spheres.particles();
+  for (int j = 0; j + 1 < static_cast<int>(contactOffsets.size()); ++j) {
+    float ws = sphereParticles.inverseMass(j);
+    for (int k = contactOffsets[j]; k < contactOffsets[j + 1]; ++k) {
+      int i = contactCandidates[k];
+      float wp = clothParticles.inverseMass(i);
+      Eigen::Vector4f offset = clothParticles.position(i) - sphereParticles.position(j);
+      float distance = offset.norm();
+      float penetration = spheres.radius(j) - distance;
+      if (penetration <= 0.0f || distance == 0.0f || wp + ws == 0.0f) continue;
+      // Hard constraint |p - c| >= r, split by inverse mass.
+      Eigen::Vector4f normal = offset / distance;
+      Eigen::Vector4f correction = penetration * normal;
+      // Coulomb friction on the relative motion of the step, static when it is within frictionCoef * penetration.
+      Eigen::Vector4f slip = (clothParticles.position(i) - previousCloth.col(i)) -
+                             (sphereParticles.position(j) - previousSpheres.col(j));
+      slip -= slip.dot(normal) * normal;
+      float slipLength = slip.norm();
+      if (slipLength > 0.0f) correction -= std::min(1.0f, frictionCoef * penetration / slipLength) * slip;
+      correction /= wp + ws;
+      clothParticles.position(i) += wp * correction;
+      sphereParticles.position(j) -= ws * correction;
+    }
+  }
+}
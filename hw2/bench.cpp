@@ -0,0 +1,388 @@
+// Latency of the HW2 kinematics on synthetic skeletons and clips. Build it like the assignment, with bench.cpp in
+// place of the framework's main, e.g. g++ -O2 -std=c++17 -I<framework include> bench.cpp kinematics.cpp -lpthread
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "flatskeleton.h"
+#include "kinematics.h"
+#include "timewarp.h"
+#include "transition.h"
+
+namespace {
+std::atomic<std::size_t> allocationCount = 0;
+}  // namespace
+
+#ifdef __GLIBC__
+// Eigen allocates dense storage with malloc directly, and operator new calls malloc too, so count malloc itself.
+// The blocks come from glibc's own allocator, its free releases them.
+#define ALLOCATION_COLUMN "allocations_per_call"
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* pointer, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+
+void* malloc(std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+void* calloc(std::size_t count, std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+void* realloc(void* pointer, std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(pointer, size);
+}
+void* aligned_alloc(std::size_t alignment, std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+int posix_memalign(void** pointer, std::size_t alignment, std::size_t size) noexcept {
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  *pointer = __libc_memalign(alignment, size);
+  return *pointer || size == 0 ? 0 : ENOMEM;
+}
+}
+#else
+// Without glibc's malloc to wrap only operator new is counted, Eigen's dense storage is not.
+#define ALLOCATION_COLUMN "std_allocations_per_call"
+void* operator new(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void* pointer = std::malloc(size == 0 ? 1 : size)) return pointer;
+  throw std::bad_alloc();
+}
+// Inlined into the std allocators, GCC takes the free of memory from operator new for a mismatch.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+namespace {
+enum BenchmarkCase { fk, fkFlat, fkMotion, warp, warpTable, blend, benchmarkCaseCount };
+constexpr const char* caseNames[] = {"fk", "fk_flat", "fk_motion", "warp", "warp_table", "blend"};
+
+struct BenchmarkOptions {
+  std::vector<int> boneCounts{31, 62, 124};
+  std::vector<int> frameCounts{120, 480, 1920};
+  std::vector<int> cases{fk, fkFlat, fkMotion, warp, warpTable, blend};
+  int sampleCount = 1000;
+  int warmupCount = 50;
+  bool isJson = false;
+};
+
+struct BenchmarkResult {
+  int benchmarkCase;
+  int boneCount;
+  // 0 for the cases that take one posture.
+  int frameCount;
+  int sampleCount;
+  double mean, p50, p90, p99, max;
+  double allocationsPerCall;
+};
+
+// One bone of the body, a CMU ASF skeleton with its 31 bones.
+struct BodyBone {
+  int parent;
+  Eigen::Vector3f direction;
+  float length;
+  // Euler angles of the ASF axis, in radians.
+  Eigen::Vector3f axis;
+};
+
+// Indexed like the ASF skeleton of the CMU motion capture database.
+const BodyBone bodyBones[] = {
+    {-1, {0, 1, 0}, 0.0f, {0, 0, 0}},  // root
+    {0, {0.7f, -0.66f, 0.27f}, 2.4f, {0, 0, 0}},  // lhipjoint
+    {1, {0.34f, -0.94f, 0}, 7.2f, {0, 0, 0.35f}},  // lfemur
+    {2, {0.34f, -0.94f, 0}, 7.4f, {0, 0, 0.35f}},  // ltibia
+    {3, {0.1f, -0.2f, 0.97f}, 2.3f, {-1.57f, 0, 0.35f}},  // lfoot
+    {4, {0, 0, 1}, 1.2f, {-1.57f, 0, 0.35f}},  // ltoes
+    {0, {-0.7f, -0.66f, 0.27f}, 2.4f, {0, 0, 0}},  // rhipjoint
+    {6, {-0.34f, -0.94f, 0}, 7.2f, {0, 0, -0.35f}},  // rfemur
+    {7, {-0.34f, -0.94f, 0}, 7.4f, {0, 0, -0.35f}},  // rtibia
+    {8, {-0.1f, -0.2f, 0.97f}, 2.3f, {-1.57f, 0, -0.35f}},  // rfoot
+    {9, {0, 0, 1}, 1.2f, {-1.57f, 0, -0.35f}},  // rtoes
+    {0, {0, 1, -0.05f}, 2.0f, {0, 0, 0}},  // lowerback
+    {11, {0, 1, 0.05f}, 2.0f, {0, 0, 0}},  // upperback
+    {12, {0, 1, 0}, 2.0f, {0, 0, 0}},  // thorax
+    {13, {0, 1, 0.1f}, 1.6f, {0, 0, 0}},  // lowerneck
+    {14, {0, 1, -0.1f}, 1.6f, {0, 0, 0}},  // upperneck
+    {15, {0, 1, 0}, 1.6f, {0, 0, 0}},  // head
+    {13, {1, 0.2f, 0}, 3.5f, {0, 0, -0.5f}},  // lclavicle
+    {17, {1, 0, 0}, 5.0f, {0, 0, 1.57f}},  // lhumerus
+    {18, {1, 0, 0}, 3.4f, {0, 0, 1.57f}},  // lradius
+    {19, {1, 0, 0}, 1.7f, {0, 0, 1.57f}},  // lwrist
+    {20, {1, 0, 0}, 0.7f, {0, 0, 1.57f}},  // lhand
+    {21, {1, 0, 0}, 0.6f, {0, 0, 1.57f}},  // lfingers
+    {20, {0.7f, 0, 0.7f}, 0.8f, {-0.78f, 0, 1.57f}},  // lthumb
+    {13, {-1, 0.2f, 0}, 3.5f, {0, 0, 0.5f}},  // rclavicle
+    {24, {-1, 0, 0}, 5.0f, {0, 0, -1.57f}},  // rhumerus
+    {25, {-1, 0, 0}, 3.4f, {0, 0, -1.57f}},  // rradius
+    {26, {-1, 0, 0}, 1.7f, {0, 0, -1.57f}},  // rwrist
+    {27, {-1, 0, 0}, 0.7f, {0, 0, -1.57f}},  // rhand
+    {28, {-1, 0, 0}, 0.6f, {0, 0, -1.57f}},  // rfingers
+    {27, {-0.7f, 0, 0.7f}, 0.8f, {-0.78f, 0, -1.57f}},  // rthumb
+};
+constexpr int bodyBoneCount = static_cast<int>(std::size(bodyBones));
+// Bones past the body are more left arms on the thorax, the arm is bodyBones[17, 24).
+constexpr int thorax = 13;
+constexpr int firstArmBone = 17;
+constexpr int armBoneCount = 7;
+
+void printUsage(const char* program) {
+  std::cerr << "Usage: " << program << " [--bones N,...] [--frames N,...] [--case NAME,...|all] [--samples N]"
+            << " [--warmup N] [--format csv|json]\n"
+            << "  cases: fk, fk_flat, fk_motion, warp, warp_table, blend" << std::endl;
+  exit(EXIT_FAILURE);
+}
+
+std::vector<std::string> split(const char* list) {
+  std::vector<std::string> items;
+  std::string current;
+  for (const char* c = list; *c != '\0'; ++c) {
+    if (*c == ',') {
+      items.push_back(current);
+      current.clear();
+    } else {
+      current.push_back(*c);
+    }
+  }
+  items.push_back(current);
+  return items;
+}
+
+std::vector<int> parseCounts(const char* value, int minimum) {
+  std::vector<int> counts;
+  for (const auto& item : split(value)) counts.push_back(std::max(minimum, std::atoi(item.c_str())));
+  return counts;
+}
+
+BenchmarkOptions parseArguments(int argc, char** argv) {
+  BenchmarkOptions options;
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 >= argc) printUsage(argv[0]);
+    const char* value = argv[++i];
+    if (std::strcmp(argv[i - 1], "--bones") == 0) {
+      options.boneCounts = parseCounts(value, 1);
+    } else if (std::strcmp(argv[i - 1], "--frames") == 0) {
+      // motionBlend matches the last 30 frames of a clip
+      options.frameCounts = parseCounts(value, 32);
+    } else if (std::strcmp(argv[i - 1], "--case") == 0) {
+      options.cases.clear();
+      for (const auto& item : split(value)) {
+        if (item == "all") {
+          for (int type = 0; type < benchmarkCaseCount; ++type) options.cases.push_back(type);
+          continue;
+        }
+        auto found = std::find_if(std::begin(caseNames), std::end(caseNames),
+                                  [&item](const char* name) { return item == name; });
+        if (found == std::end(caseNames)) printUsage(argv[0]);
+        options.cases.push_back(static_cast<int>(found - std::begin(caseNames)));
+      }
+    } else if (std::strcmp(argv[i - 1], "--samples") == 0) {
+      options.sampleCount = std::max(1, std::atoi(value));
+    } else if (std::strcmp(argv[i - 1], "--warmup") == 0) {
+      options.warmupCount = std::max(0, std::atoi(value));
+    } else if (std::strcmp(argv[i - 1], "--format") == 0) {
+      if (std::strcmp(value, "csv") != 0 && std::strcmp(value, "json") != 0) printUsage(argv[0]);
+      options.isJson = std::strcmp(value, "json") == 0;
+    } else {
+      printUsage(argv[0]);
+    }
+  }
+  return options;
+}
+
+// The body truncated or extended to boneCount bones, stored by Bone::idx with the tree links set.
+std::vector<Bone> makeSkeleton(int boneCount) {
+  std::vector<Bone> bones(boneCount);
+  for (int i = 0; i < boneCount; ++i) {
+    int armBone = (i - bodyBoneCount) % armBoneCount;
+    const BodyBone& source = i < bodyBoneCount ? bodyBones[i] : bodyBones[firstArmBone + armBone];
+    int parent = source.parent;
+    if (i >= bodyBoneCount) parent = armBone == 0 ? thorax : source.parent - firstArmBone + (i - armBone);
+    Bone& bone = bones[i];
+    bone.idx = i;
+    bone.direction = source.direction.normalized();
+    bone.length = source.length;
+    bone.axis = source.axis;
+    if (parent < 0) continue;
+    bone.parent = &bones[parent];
+    Bone** link = &bones[parent].child;
+    while (*link != nullptr) link = &(*link)->sibling;
+    *link = &bone;
+  }
+  return bones;
+}
+
+// A walk: every joint swings with its own phase, the root moves forward.
+Motion makeMotion(int boneCount, int frameCount, unsigned seed) {
+  std::mt19937 random(seed);
+  std::uniform_real_distribution<float> phase(0.0f, 6.28f);
+  std::vector<Eigen::Vector3f> phases(boneCount);
+  for (auto& p : phases) p = {phase(random), phase(random), phase(random)};
+  Motion motion;
+  std::vector<Posture>& postures = motion.posture();
+  postures.resize(frameCount);
+  for (int f = 0; f < frameCount; ++f) {
+    Posture& posture = postures[f];
+    posture.rotations.resize(boneCount);
+    posture.translations.assign(boneCount, Eigen::Vector3f::Zero());
+    posture.eulerAngle.resize(boneCount);
+    for (int i = 0; i < boneCount; ++i) {
+      Eigen::Vector3f angle = phases[i] + Eigen::Vector3f::Constant(0.1f * f);
+      Eigen::Vector3f euler(0.4f * std::sin(angle[0]), 0.2f * std::sin(angle[1]), 0.3f * std::sin(angle[2]));
+      posture.eulerAngle[i] = euler;
+      posture.rotations[i] = Eigen::AngleAxisf(euler[2], Eigen::Vector3f::UnitZ()) *
+                             Eigen::AngleAxisf(euler[1], Eigen::Vector3f::UnitY()) *
+                             Eigen::AngleAxisf(euler[0], Eigen::Vector3f::UnitX());
+    }
+    posture.translations[0] = {0.0f, 17.0f + 0.5f * std::sin(0.2f * f), 0.3f * f};
+  }
+  return motion;
+}
+
+// Time sampleCount calls of run after warmupCount untimed ones.
+template <class Func>
+BenchmarkResult measure(const BenchmarkOptions& options, int benchmarkCase, int boneCount, int frameCount, Func&& run) {
+  for (int i = 0; i < options.warmupCount; ++i) run();
+  std::vector<double> latencies(options.sampleCount);
+  std::size_t allocationStart = allocationCount.load(std::memory_order_relaxed);
+  for (double& latency : latencies) {
+    auto start = std::chrono::steady_clock::now();
+    run();
+    latency = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+  }
+  std::size_t allocations = allocationCount.load(std::memory_order_relaxed) - allocationStart;
+  double mean = 0.0;
+  for (double latency : latencies) mean += latency;
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) { return latencies[static_cast<int>(p * (latencies.size() - 1))]; };
+  return {benchmarkCase,
+          boneCount,
+          frameCount,
+          options.sampleCount,
+          mean / options.sampleCount,
+          percentile(0.5),
+          percentile(0.9),
+          percentile(0.99),
+          latencies.back(),
+          static_cast<double>(allocations) / options.sampleCount};
+}
+
+void printResults(const std::vector<BenchmarkResult>& results, bool isJson) {
+  if (!isJson) {
+    std::printf("case,bones,frames,samples,mean_us,p50_us,p90_us,p99_us,max_us," ALLOCATION_COLUMN "\n");
+  } else {
+    std::printf("[\n");
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& result = results[i];
+    const char* format =
+        isJson ? "  {\"case\": \"%s\", \"bones\": %d, \"frames\": %d, \"samples\": %d, \"mean_us\": %.3f, "
+                 "\"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, "
+                 "\"" ALLOCATION_COLUMN "\": %.2f}%s\n"
+               : "%s,%d,%d,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f%s\n";
+    const char* separator = !isJson ? "" : (i + 1 < results.size() ? "," : "");
+    std::printf(format, caseNames[result.benchmarkCase], result.boneCount, result.frameCount, result.sampleCount,
+                result.mean, result.p50, result.p90, result.p99, result.max, result.allocationsPerCall, separator);
+  }
+  if (isJson) std::printf("]\n");
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchmarkOptions options = parseArguments(argc, argv);
+  // Every skeleton stays loaded for the run, like the framework's, forwardKinematics(posture, root) caches a few.
+  std::vector<std::vector<Bone>> skeletons;
+  skeletons.reserve(options.boneCounts.size());
+  // Keeps the compiler from dropping the results.
+  volatile float sink = 0.0f;
+
+  std::vector<BenchmarkResult> results;
+  for (int boneCount : options.boneCounts) {
+    std::vector<Bone>& bones = skeletons.emplace_back(makeSkeleton(boneCount));
+    Bone* root = &bones[0];
+    FlatSkeleton skeleton = flattenSkeleton(root);
+    for (int benchmarkCase : options.cases) {
+      const bool isPerPosture = benchmarkCase == fk || benchmarkCase == fkFlat;
+      for (int frameCount : options.frameCounts) {
+        Motion motionA = makeMotion(boneCount, frameCount, 1);
+        Motion motionB = makeMotion(boneCount, frameCount, 2);
+        int frame = 0;
+        Motion output;
+        std::vector<Eigen::Quaternionf> rotations;
+        std::vector<Eigen::Vector3f> endPositions;
+        // Slowed down by half, the warped clip is 1.5 times longer.
+        const WarpTable table = makeWarpTable(frameCount, frameCount, frameCount * 3 / 2);
+        BenchmarkResult result;
+        switch (benchmarkCase) {
+          case fk:
+            result = measure(options, benchmarkCase, boneCount, 0, [&] {
+              forwardKinematics(motionA.posture(frame++ % frameCount), root);
+              sink = bones.back().endPosition[0];
+            });
+            break;
+          case fkFlat:
+            result = measure(options, benchmarkCase, boneCount, 0, [&] {
+              forwardKinematics(skeleton, motionA.posture(frame++ % frameCount), root);
+              sink = bones.back().endPosition[0];
+            });
+            break;
+          case fkMotion:
+            result = measure(options, benchmarkCase, boneCount, frameCount, [&] {
+              forwardKinematics(skeleton, motionA, rotations, endPositions);
+              sink = endPositions.back()[0];
+            });
+            break;
+          case warp:
+            result = measure(options, benchmarkCase, boneCount, frameCount, [&] {
+              output = motionWarp(motionA, frameCount, frameCount * 3 / 2);
+              sink = output.posture(0).rotations[0].w();
+            });
+            break;
+          case warpTable:
+            result = measure(options, benchmarkCase, boneCount, frameCount, [&] {
+              motionWarp(motionA, table, output);
+              sink = output.posture(0).rotations[0].w();
+            });
+            break;
+          case blend:
+            result = measure(options, benchmarkCase, boneCount, frameCount, [&] {
+              output = motionBlend(motionA, motionB);
+              sink = output.posture(0).rotations[0].w();
+            });
+            break;
+        }
+        results.push_back(result);
+        // One posture does not depend on the clip length.
+        if (isPerPosture) break;
+      }
+    }
+  }
+  printResults(results, options.isJson);
+  return 0;
+}
@@ -0,0 +1,158 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "kinematics.h"
+#include "timewarp.h"
+#include "transition.h"
+
+/**
+ * @brief One frame of a clip, the rotations and translations of all of its bones.
+ */
+struct FrameView {
+  const Eigen::Quaternionf* rotations = nullptr;
+  const Eigen::Vector3f* translations = nullptr;
+};
+
+/**
+ * @brief A non-owning view of frameCount x boneCount rotations and translations, each stored frame after frame.
+ * Copying a view copies two pointers, sub-clips are views into the same memory.
+ */
+class ClipView {
+ public:
+  ClipView() = default;
+  ClipView(int frameCount_, int boneCount_, const Eigen::Quaternionf* rotations_,
+           const Eigen::Vector3f* translations_) noexcept
+      : _frameCount(frameCount_), _boneCount(boneCount_), _rotations(rotations_), _translations(translations_) {}
+  int frameCount() const { return _frameCount; }
+  int boneCount() const { return _boneCount; }
+  FrameView frame(int i) const {
+    return {_rotations + static_cast<std::ptrdiff_t>(i) * _boneCount,
+            _translations + static_cast<std::ptrdiff_t>(i) * _boneCount};
+  }
+  /**
+   * @brief Frames [first, first + count) of this clip.
+   *
+   */
+  ClipView frames(int first, int count) const {
+    FrameView start = frame(first);
+    return {count, _boneCount, start.rotations, start.translations};
+  }
+  /**
+   * @brief Copy frame i into a posture, for code that still works on Motion.
+   *
+   */
+  void copyTo(int i, Posture& posture) const;
+
+ private:
+  int _frameCount = 0;
+  int _boneCount = 0;
+  const Eigen::Quaternionf* _rotations = nullptr;
+  const Eigen::Vector3f* _translations = nullptr;
+};
+
+/**
+ * @brief A clip in the contiguous layout of ClipView that owns its memory.
+ */
+class ClipBuffer {
+ public:
+  ClipBuffer() = default;
+  /**
+   * @brief Convert a motion, all postures must have the bone count of the first.
+   *
+   */
+  explicit ClipBuffer(const Motion& motion);
+  /**
+   * @brief Set the size, the memory is only reallocated when it grows.
+   *
+   */
+  void resize(int frameCount_, int boneCount_);
+  int frameCount() const { return _frameCount; }
+  int boneCount() const { return _boneCount; }
+  ClipView view() const { return {_frameCount, _boneCount, _rotations.data(), _translations.data()}; }
+  Eigen::Quaternionf* rotations(int frame) {
+    return _rotations.data() + static_cast<std::ptrdiff_t>(frame) * _boneCount;
+  }
+  Eigen::Vector3f* translations(int frame) {
+    return _translations.data() + static_cast<std::ptrdiff_t>(frame) * _boneCount;
+  }
+  /**
+   * @brief Convert back to a motion.
+   *
+   */
+  Motion toMotion() const;
+  /**
+   * @brief Write the clip in the format MappedClip reads.
+   *
+   * @return false if the file cannot be written.
+   */
+  bool save(const char* path) const;
+
+ private:
+  int _frameCount = 0;
+  int _boneCount = 0;
+  std::vector<Eigen::Quaternionf> _rotations;
+  std::vector<Eigen::Vector3f> _translations;
+};
+
+/**
+ * @brief A clip file mapped read-only into memory. Opening costs no reads, a frame is paged in on first access.
+ * The file is a 16 byte header (magic "CLIP", version, frame count, bone count), then the rotations as x y z w
+ * and the translations as x y z, frame after frame, as floats in native byte order.
+ */
+class MappedClip {
+ public:
+  MappedClip() = default;
+  MappedClip(const MappedClip&) = delete;
+  MappedClip& operator=(const MappedClip&) = delete;
+  MappedClip(MappedClip&& other) noexcept;
+  MappedClip& operator=(MappedClip&& other) noexcept;
+  ~MappedClip() { close(); }
+  /**
+   * @brief Map a file written by ClipBuffer::save, closing the current one.
+   *
+   * @return false if the file cannot be mapped or is not a clip, the object is then closed.
+   */
+  bool open(const char* path);
+  void close();
+  bool isOpen() const { return data != nullptr; }
+  /**
+   * @brief The mapped clip, valid until it is closed.
+   *
+   */
+  ClipView view() const { return clip; }
+
+ private:
+  const void* data = nullptr;
+  std::size_t dataSize = 0;
+#ifdef _WIN32
+  void* mapping = nullptr;
+#endif
+  ClipView clip;
+};
+
+/**
+ * @brief motionWarp on a clip view, see motionWarp(const Motion&, const WarpTable&, Motion&).
+ *
+ * @param output Resized to table.size() frames, must not share memory with clip.
+ */
+void motionWarp(const ClipView& clip, const WarpTable& table, ClipBuffer& output);
+
+/**
+ * @brief findTransition on clip views, see findTransition(const Motion&, int, int, const Motion&, int, int).
+ *
+ */
+Transition findTransition(const ClipView& clipA, int firstA, int countA, const ClipView& clipB, int firstB,
+                          int countB);
+
+/**
+ * @brief motionBlend on clip views, see motionBlend(const Motion&, const Motion&, const Transition&, int).
+ *
+ * @param output Resized to the blended length, must not share memory with the clips.
+ */
+void motionBlend(const ClipView& clipA, const ClipView& clipB, const Transition& transition, int blendFrameCount,
+                 ClipBuffer& output);
@@ -0,0 +1,84 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "clipbuffer.h"
+#include "flatskeleton.h"
+#include "kinematics.h"
+#include "timewarp.h"
+#include "transition.h"
+
+/**
+ * @brief A clip compressed for keeping large libraries in memory, decompressed a frame at a time.
+ * A bone whose rotation or translation is the same in every frame is stored once. Other rotations are quantized
+ * with smallest-three into 48 bits (error below 3e-5 per component). Other translations are quantized to 16 bits
+ * per component over the track's range in the clip. A clip of skeleton bones with fixed offsets is about 4 times
+ * smaller than Posture or ClipBuffer.
+ */
+class CompressedClip {
+ public:
+  CompressedClip() = default;
+  explicit CompressedClip(const ClipView& clip);
+  explicit CompressedClip(const Motion& motion) : CompressedClip(ClipBuffer(motion).view()) {}
+  int frameCount() const { return _frameCount; }
+  int boneCount() const { return _boneCount; }
+  /**
+   * @brief Decompress one frame.
+   *
+   * @param rotations boneCount() rotations.
+   * @param translations boneCount() translations.
+   */
+  void decompress(int frame, Eigen::Quaternionf* rotations, Eigen::Vector3f* translations) const;
+  /**
+   * @brief Decompress one frame into a posture, which only allocates when it has fewer bones.
+   *
+   */
+  void decompress(int frame, Posture& posture) const;
+  /**
+   * @brief Decompress the whole clip.
+   *
+   */
+  void decompress(ClipBuffer& output) const;
+  /**
+   * @brief Memory used by the compressed data.
+   *
+   */
+  std::size_t byteSize() const;
+
+ private:
+  int _frameCount = 0;
+  int _boneCount = 0;
+  // Bones stored once, with their value.
+  std::vector<int> constantRotationBones, constantTranslationBones;
+  std::vector<Eigen::Quaternionf> constantRotations;
+  std::vector<Eigen::Vector3f> constantTranslations;
+  // Bones stored every frame, the translations with their range: value = minimum + quantized * step.
+  std::vector<int> animatedRotationBones, animatedTranslationBones;
+  std::vector<Eigen::Vector3f> translationMinimums, translationSteps;
+  // Frame after frame, 3 values per animated bone.
+  std::vector<std::uint16_t> rotationData, translationData;
+};
+
+/**
+ * @brief motionWarp on a compressed clip, the source frames are decompressed as they are sampled.
+ *
+ */
+void motionWarp(const CompressedClip& clip, const WarpTable& table, ClipBuffer& output);
+
+/**
+ * @brief motionBlend on compressed clips, the frames are decompressed as they are blended.
+ *
+ */
+void motionBlend(const CompressedClip& clipA, const CompressedClip& clipB, const Transition& transition,
+                 int blendFrameCount, ClipBuffer& output);
+
+/**
+ * @brief Forward kinematics of every frame of a compressed clip, laid out like the Motion overload.
+ *
+ */
+void forwardKinematics(const FlatSkeleton& skeleton, const CompressedClip& clip,
+                       std::vector<Eigen::Quaternionf>& rotations, std::vector<Eigen::Vector3f>& endPositions);
@@ -0,0 +1,61 @@
+#pragma once
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "kinematics.h"
+
+/**
+ * @brief A skeleton flattened into arrays in parent-before-child order, so forward kinematics is one loop.
+ * Everything that does not depend on the posture is computed once by flattenSkeleton.
+ */
+struct FlatSkeleton {
+  // Bone::idx of each slot, slot 0 is the root.
+  std::vector<int> boneIndex;
+  // Slot of the parent, always before the slot itself. -1 for the root.
+  std::vector<int> parentSlot;
+  // Rotation from the parent's axis frame into this bone's, the axis itself for the root.
+  std::vector<Eigen::Quaternionf> localAxis;
+  // direction.normalized() * length, in the bone's frame.
+  std::vector<Eigen::Vector3f> offset;
+
+  int size() const { return static_cast<int>(boneIndex.size()); }
+};
+
+/**
+ * @brief Flatten the bones under root, call once after loading the skeleton.
+ * Also sets Bone::rotationParentCurrent the same as the recursive forward kinematics did.
+ *
+ * @param root The root bone, the bones must be stored in an array indexed by Bone::idx.
+ */
+FlatSkeleton flattenSkeleton(Bone* root);
+
+/**
+ * @brief Forward kinematics of one posture written into the bones.
+ *
+ * @param skeleton The skeleton of root, from flattenSkeleton.
+ */
+void forwardKinematics(const FlatSkeleton& skeleton, const Posture& posture, Bone* root);
+
+/**
+ * @brief Forward kinematics of many postures into caller-owned arrays, the bones are not touched.
+ * Posture p of slot k is written at p * skeleton.size() + k. A bone starts at the end of its parent, the root
+ * starts at the origin. The postures are split across a thread pool.
+ *
+ * @param skeleton The skeleton all postures belong to.
+ * @param postures postureCount postures.
+ * @param rotations Global rotation of each bone, postureCount * skeleton.size() of them.
+ * @param endPositions Global end position of each bone, postureCount * skeleton.size() of them.
+ */
+void forwardKinematics(const FlatSkeleton& skeleton, const Posture* postures, int postureCount,
+                       Eigen::Quaternionf* rotations, Eigen::Vector3f* endPositions);
+
+/**
+ * @brief Forward kinematics of every frame of a motion, e.g. to precompute the joint positions of a clip.
+ *
+ * @param rotations Resized to motion.size() * skeleton.size(), laid out as above.
+ * @param endPositions Resized to motion.size() * skeleton.size(), laid out as above.
+ */
+void forwardKinematics(const FlatSkeleton& skeleton, const Motion& motion, std::vector<Eigen::Quaternionf>& rotations,
+                       std::vector<Eigen::Vector3f>& endPositions);
@@ -1,8 +1,346 @@
 #include "kinematics.h"
 
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
 
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "clipbuffer.h"
+#include "compressedclip.h"
+#include "flatskeleton.h"
+#include "timewarp.h"
+#include "transition.h"
 #include "utils.h"
+
+namespace {
+// The ASF axis is applied as Z, then Y, then X.
+Eigen::Quaternionf axisRotation(const Bone& bone) {
+  return Eigen::AngleAxisf(bone.axis[2], Eigen::Vector3f::UnitZ()) *
+         Eigen::AngleAxisf(bone.axis[1], Eigen::Vector3f::UnitY()) *
+         Eigen::AngleAxisf(bone.axis[0], Eigen::Vector3f::UnitX());
+}
+
+// Persistent workers for the batched loops. parallelFor splits [0, count) into chunks of at least grainSize and
+// blocks until all of them are done, the calling thread works too. Loops must not nest.
+class WorkerPool {
+ public:
+  static WorkerPool& get() {
+    static WorkerPool pool;
+    return pool;
+  }
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      isStopping = true;
+    }
+    wakeCondition.notify_all();
+    for (auto& worker : workers) worker.join();
+  }
+  template <class Func>
+  void parallelFor(int count, int grainSize, Func&& func) {
+    using FuncType = std::remove_reference_t<Func>;
+    auto invoke = [](void* context, int begin, int end) { (*static_cast<FuncType*>(context))(begin, end); };
+    run(count, grainSize, invoke, const_cast<void*>(static_cast<const void*>(&func)));
+  }
+
+ private:
+  using Task = void (*)(void*, int, int);
+  WorkerPool() {
+    int count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int i = 0; i < count - 1; ++i) workers.emplace_back(&WorkerPool::workerLoop, this);
+  }
+  void run(int count, int grainSize, Task task_, void* context_) {
+    if (count <= 0) return;
+    int maxChunks = std::max(1, count / std::max(1, grainSize));
+    if (workers.empty() || maxChunks == 1) {
+      task_(context_, 0, count);
+      return;
+    }
+    // One loop at a time, a second caller waits for the first.
+    std::lock_guard<std::mutex> runLock(runMutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      task = task_;
+      context = context_;
+      itemCount = count;
+      chunkCount = std::min(maxChunks, 4 * static_cast<int>(workers.size() + 1));
+      chunkSize = (count + chunkCount - 1) / chunkCount;
+      chunkCount = (count + chunkSize - 1) / chunkSize;
+      nextChunk.store(0, std::memory_order_relaxed);
+      activeWorkers = static_cast<int>(workers.size());
+      ++generation;
+    }
+    wakeCondition.notify_all();
+    work();
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] { return activeWorkers == 0; });
+  }
+
+  void work() {
+    for (int chunk = nextChunk.fetch_add(1); chunk < chunkCount; chunk = nextChunk.fetch_add(1)) {
+      int begin = chunk * chunkSize;
+      task(context, begin, std::min(begin + chunkSize, itemCount));
+    }
+  }
+  void workerLoop() {
+    unsigned int seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wakeCondition.wait(lock, [&] { return isStopping || generation != seenGeneration; });
+      if (isStopping) return;
+      seenGeneration = generation;
+      lock.unlock();
+      work();
+      lock.lock();
+      if (--activeWorkers == 0) doneCondition.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex runMutex;
+  std::mutex mutex;
+  std::condition_variable wakeCondition;
+  std::condition_variable doneCondition;
+  bool isStopping = false;
+  unsigned int generation = 0;
+  int activeWorkers = 0;
+  // Current loop, written under the mutex before waking the workers.
+  Task task = nullptr;
+  void* context = nullptr;
+  int itemCount = 0;
+  int chunkSize = 0;
+  int chunkCount = 0;
+  std::atomic<int> nextChunk = 0;
+};
+
+// Forward kinematics of one posture into one row of the output arrays.
+void posePosture(const FlatSkeleton& skeleton, const Posture& posture, Eigen::Quaternionf* rotations,
+                 Eigen::Vector3f* endPositions) {
+  for (int slot = 0; slot < skeleton.size(); ++slot) {
+    int boneIndex = skeleton.boneIndex[slot];
+    int parentSlot = skeleton.parentSlot[slot];
+    Eigen::Quaternionf local = skeleton.localAxis[slot] * posture.rotations[boneIndex];
+    Eigen::Vector3f startPosition = Eigen::Vector3f::Zero();
+    if (parentSlot < 0) {
+      rotations[slot] = local;
+    } else {
+      rotations[slot] = rotations[parentSlot] * local;
+      startPosition = endPositions[parentSlot];
+    }
+    endPositions[slot] = startPosition + posture.translations[boneIndex] + rotations[slot] * skeleton.offset[slot];
+  }
+}
+
+// Enough work per chunk to hide the hand-off, a posture is about a hundred quaternion products.
+constexpr int postureGrainSize = 16;
+// Bones compared between two checks of the bound in postureDistance.
+constexpr int distanceBlockSize = 8;
+
+FrameView frameOf(const Posture& posture) { return {posture.rotations.data(), posture.translations.data()}; }
+
+// Lerp the translations and slerp the rotations from `from` (ratio 0) to `to` (ratio 1).
+void interpolateFrame(FrameView from, FrameView to, float ratio, int boneCount, Eigen::Quaternionf* rotations,
+                      Eigen::Vector3f* translations) {
+  for (int j = 0; j < boneCount; ++j) {
+    translations[j] = from.translations[j] * (1 - ratio) + to.translations[j] * ratio;
+    rotations[j] = from.rotations[j].slerp(ratio, to.rotations[j]);
+  }
+}
+
+// Frame of a blend from a to b, b moved by the translation offset between startA and startB.
+void blendFrame(FrameView startA, FrameView startB, FrameView a, FrameView b, float rate, int boneCount,
+                Eigen::Quaternionf* rotations, Eigen::Vector3f* translations) {
+  for (int j = 0; j < boneCount; ++j) {
+    translations[j] = startA.translations[j] + (a.translations[j] - startA.translations[j]) * (1 - rate) +
+                      (b.translations[j] - startB.translations[j]) * rate;
+    rotations[j] = a.rotations[j].slerp(rate, b.rotations[j]);
+  }
+}
+
+// Frame of b after the blend, moved like blendFrame does.
+void offsetFrame(FrameView startA, FrameView startB, FrameView b, int boneCount, Eigen::Quaternionf* rotations,
+                 Eigen::Vector3f* translations) {
+  for (int j = 0; j < boneCount; ++j) {
+    translations[j] = startA.translations[j] + (b.translations[j] - startB.translations[j]);
+    rotations[j] = b.rotations[j];
+  }
+}
+
+// postureDistance of two frames.
+float frameDistance(FrameView a, FrameView b, int totalBones, float bound, float rotationWeight) {
+  Eigen::Map<const Eigen::Matrix3Xf> translationsA(a.translations->data(), 3, totalBones);
+  Eigen::Map<const Eigen::Matrix3Xf> translationsB(b.translations->data(), 3, totalBones);
+  Eigen::Map<const Eigen::Matrix4Xf> rotationsA(a.rotations->coeffs().data(), 4, totalBones);
+  Eigen::Map<const Eigen::Matrix4Xf> rotationsB(b.rotations->coeffs().data(), 4, totalBones);
+  // Only the height of the root counts, blending removes its horizontal offset.
+  float rootHeight = a.translations->y() - b.translations->y();
+  float distance = rootHeight * rootHeight - (translationsA.col(0) - translationsB.col(0)).squaredNorm();
+  for (int first = 0; first < totalBones; first += distanceBlockSize) {
+    const int count = std::min(distanceBlockSize, totalBones - first);
+    // q and -q are the same rotation, 1 - dot^2 is zero for both.
+    auto dots = rotationsA.middleCols(first, count).cwiseProduct(rotationsB.middleCols(first, count)).colwise().sum();
+    distance += (translationsA.middleCols(first, count) - translationsB.middleCols(first, count)).squaredNorm() +
+                rotationWeight * (count - dots.squaredNorm());
+    if (distance > bound) break;
+  }
+  return distance;
+}
+
+// Layout of a clip file, see MappedClip.
+struct ClipFileHeader {
+  char magic[4];
+  std::uint32_t version;
+  std::int32_t frameCount;
+  std::int32_t boneCount;
+};
+constexpr char clipMagic[4] = {'C', 'L', 'I', 'P'};
+constexpr std::uint32_t clipVersion = 1;
+static_assert(sizeof(ClipFileHeader) == 16 && sizeof(Eigen::Quaternionf) == 16 && sizeof(Eigen::Vector3f) == 12,
+              "the clip file is the memory layout of the arrays");
+
+// What flattenSkeleton reads from a bone and writes into it, with the bones it links to.
+struct BoneRecord {
+  int index, child, sibling;
+  float axis[3];
+  float direction[3];
+  float length;
+  float rotationParentCurrent[4];
+
+  explicit BoneRecord(const Bone& bone) :
+      index(bone.idx), child(bone.child ? bone.child->idx : -1), sibling(bone.sibling ? bone.sibling->idx : -1) {
+    std::memcpy(axis, bone.axis.data(), sizeof(axis));
+    std::memcpy(direction, bone.direction.data(), sizeof(direction));
+    length = bone.length;
+    std::memcpy(rotationParentCurrent, bone.rotationParentCurrent.coeffs().data(), sizeof(rotationParentCurrent));
+  }
+  bool operator==(const BoneRecord& other) const { return std::memcmp(this, &other, sizeof(BoneRecord)) == 0; }
+};
+
+// The bones from bone on along its siblings, each followed by its children.
+template <class Visit>
+void visitBones(const Bone* bone, Visit& visit) {
+  for (; bone != nullptr; bone = bone->sibling) {
+    visit(*bone);
+    visitBones(bone->child, visit);
+  }
+}
+
+// The flattened skeletons forwardKinematics(posture, root) was last called with. An entry is only used while the
+// bones still match what it was flattened from, so another skeleton loaded into the same storage is flattened again.
+const FlatSkeleton& cachedFlatSkeleton(Bone* root) {
+  struct Entry {
+    const Bone* root = nullptr;
+    std::vector<BoneRecord> bones;
+    FlatSkeleton skeleton;
+  };
+  // A few of them, alternating between two skeletons does not flatten on every call.
+  thread_local std::array<Entry, 4> cache;
+  thread_local int nextEntry = 0;
+  for (const Entry& entry : cache) {
+    if (entry.root != root) continue;
+    size_t next = 0;
+    bool isSame = true;
+    auto compare = [&](const Bone& bone) {
+      isSame = isSame && next < entry.bones.size() && entry.bones[next] == BoneRecord(bone);
+      ++next;
+    };
+    visitBones(root, compare);
+    if (isSame && next == entry.bones.size()) return entry.skeleton;
+  }
+  Entry& entry = cache[nextEntry];
+  nextEntry = (nextEntry + 1) % static_cast<int>(cache.size());
+  entry.skeleton = flattenSkeleton(root);
+  entry.root = root;
+  // Recorded after flattenSkeleton has set rotationParentCurrent.
+  entry.bones.clear();
+  auto record = [&entry](const Bone& bone) { entry.bones.emplace_back(bone); };
+  visitBones(root, record);
+  return entry.skeleton;
+}
+}  // namespace
+
+FlatSkeleton flattenSkeleton(Bone* root) {
+  FlatSkeleton skeleton;
+  // Depth first with an explicit stack, a bone is pushed when its parent gets a slot.
+  std::vector<std::pair<Bone*, int>> stack;
+  for (Bone* bone = root; bone != nullptr; bone = bone->sibling) stack.emplace_back(bone, -1);
+  while (!stack.empty()) {
+    auto [bone, parentSlot] = stack.back();
+    stack.pop_back();
+    int slot = skeleton.size();
+    Eigen::Quaternionf axis = axisRotation(*bone);
+    skeleton.boneIndex.push_back(bone->idx);
+    skeleton.parentSlot.push_back(parentSlot);
+    skeleton.localAxis.push_back(parentSlot < 0 ? axis : bone->rotationParentCurrent * axis);
+    skeleton.offset.push_back(bone->direction.normalized() * bone->length);
+    for (Bone* child = bone->child; child != nullptr; child = child->sibling) {
+      // Children are in the parent's axis frame.
+      child->rotationParentCurrent = axis.inverse();
+      stack.emplace_back(child, slot);
+    }
+  }
+  return skeleton;
+}
+
+void forwardKinematics(const FlatSkeleton& skeleton, const Posture& posture, Bone* root) {
+  Bone* bones = root - root->idx;
+  for (int slot = 0; slot < skeleton.size(); ++slot) {
+    Bone& bone = bones[skeleton.boneIndex[slot]];
+    int parentSlot = skeleton.parentSlot[slot];
+    Eigen::Quaternionf local = skeleton.localAxis[slot] * posture.rotations[bone.idx];
+    if (parentSlot < 0) {
+      bone.startPosition = Eigen::Vector3f::Zero();
+      bone.rotation = local;
+    } else {
+      const Bone& parent = bones[skeleton.boneIndex[parentSlot]];
+      bone.startPosition = parent.endPosition;
+      bone.rotation = parent.rotation * local;
+    }
+    bone.endPosition = bone.startPosition + posture.translations[bone.idx] + bone.rotation * skeleton.offset[slot];
+  }
+}
+
+void forwardKinematics(const FlatSkeleton& skeleton, const Posture* postures, int postureCount,
+                       Eigen::Quaternionf* rotations, Eigen::Vector3f* endPositions) {
+  const int boneCount = skeleton.size();
+  WorkerPool::get().parallelFor(postureCount, postureGrainSize, [&](int begin, int end) {
+    for (int p = begin; p < end; ++p)
+      posePosture(skeleton, postures[p], rotations + p * boneCount, endPositions + p * boneCount);
+  });
+}
+
+void forwardKinematics(const FlatSkeleton& skeleton, const Motion& motion, std::vector<Eigen::Quaternionf>& rotations,
+                       std::vector<Eigen::Vector3f>& endPositions) {
+  const int frameCount = static_cast<int>(motion.size());
+  const int boneCount = skeleton.size();
+  rotations.resize(static_cast<size_t>(frameCount) * boneCount);
+  endPositions.resize(static_cast<size_t>(frameCount) * boneCount);
+  WorkerPool::get().parallelFor(frameCount, postureGrainSize, [&](int begin, int end) {
+    for (int frame = begin; frame < end; ++frame) {
+      posePosture(skeleton, motion.posture(frame), &rotations[frame * boneCount], &endPositions[frame * boneCount]);
+    }
+  });
+}
+
 void forwardKinematics(const Posture& posture, Bone* bone) {
   // TODO (FK)
   // You should set these variables:
@@ -16,45 +354,41 @@ void forwardKinematics(const Posture& posture, Bone* bone) {
   //   1. This function will be called with bone == root bone of the skeleton
 
   // Write your code here
-  Eigen::Quaternionf Rasf = Eigen::AngleAxisf(bone->axis[2], Eigen::Vector3f::UnitZ()) *
-                           Eigen::AngleAxisf(bone->axis[1], Eigen::Vector3f::UnitY()) *
-                           Eigen::AngleAxisf(bone->axis[0], Eigen::Vector3f::UnitX());
-  if (bone->parent != nullptr) {
-    bone->startPosition = bone->parent->endPosition;
-    bone->rotation = bone->parent->rotation * bone->rotationParentCurrent * Rasf * posture.rotations[bone->idx];
-  } else {
-    bone->startPosition = Eigen::Vector3f::Zero();
-    bone->rotation = Rasf * posture.rotations[bone->idx];
-  }
-  
-  bone->endPosition = bone->startPosition + posture.translations[bone->idx] +
-                      bone->rotation * (bone->direction).normalized() * bone->length;
-  
-  
-  if (bone->child != nullptr) {
-    bone->child->rotationParentCurrent = Rasf.inverse();
-    forwardKinematics(posture, bone->child);
-  }
-  
-  if (bone->sibling != nullptr) {
-    bone->sibling->rotationParentCurrent = bone->rotationParentCurrent;
-    forwardKinematics(posture, bone->sibling);
-  }
-  
+  // Callers that pose often keep the FlatSkeleton themselves, this looks it up by the bones.
+  forwardKinematics(cachedFlatSkeleton(bone), posture, bone);
 }
 
-Motion motionWarp(const Motion& motion, int oldKeyframe, int newKeyframe) {
-  Motion newMotion = motion;
-  int totalFrames = static_cast<int>(motion.size());
-  int totalBones = static_cast<int>(motion.posture(0).rotations.size());
-  std::vector<Posture> postures(newKeyframe * totalFrames / oldKeyframe);
-  for (int i = 0; i < newKeyframe * totalFrames / oldKeyframe; ++i) {
-    // Maybe set some per=Frame variables here
+WarpTable makeWarpTable(int frameCount, int oldKeyframe, int newKeyframe) {
+  WarpTable table;
+  if (frameCount <= 0) return table;
+  const int warpedCount = newKeyframe * frameCount / oldKeyframe;
+  table.frame.resize(warpedCount);
+  table.nextFrame.resize(warpedCount);
+  table.ratio.resize(warpedCount);
+  for (int i = 0; i < warpedCount; ++i) {
     float ori = (float)oldKeyframe / newKeyframe * i;
-    int frame = ori;
-    float ratio = ori - frame;
-    Posture p;
-    for (int j = 0; j < totalBones; ++j) {
+    // Stretched clips sample past the last frame at the end, hold it there.
+    int frame = std::min(static_cast<int>(ori), frameCount - 1);
+    table.frame[i] = frame;
+    table.nextFrame[i] = std::min(frame + 1, frameCount - 1);
+    table.ratio[i] = table.nextFrame[i] == frame ? 0.0f : ori - frame;
+  }
+  return table;
+}
+
+void motionWarp(const Motion& motion, const WarpTable& table, Motion& output) {
+  std::vector<Posture>& postures = output.posture();
+  postures.resize(table.size());
+  if (table.size() == 0) return;
+  const int totalBones = static_cast<int>(motion.posture(0).rotations.size());
+  WorkerPool::get().parallelFor(table.size(), postureGrainSize, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const Posture& from = motion.posture(table.frame[i]);
+      const Posture& to = motion.posture(table.nextFrame[i]);
+      const float ratio = table.ratio[i];
+      Posture& p = postures[i];
+      p.rotations.resize(totalBones);
+      p.translations.resize(totalBones);
       // TODO (Time warping)
       // original: |--------------|---------------|
       // new     : |------------------|-----------|
@@ -71,27 +405,137 @@ Motion motionWarp(const Motion& motion, int oldKeyframe, int newKeyframe) {
       //   3. You should use spherical linear interpolation for rotations.
 
       // Write your code here
-      Eigen::Quaternionf q;
-      Eigen::Vector3f v3f;
+      interpolateFrame(frameOf(from), frameOf(to), ratio, totalBones, p.rotations.data(), p.translations.data());
+    }
+  });
+}
+
+Motion motionWarp(const Motion& motion, int oldKeyframe, int newKeyframe) {
+  // Only the warped postures are kept, so the clip is not copied first.
+  Motion newMotion;
+  motionWarp(motion, makeWarpTable(static_cast<int>(motion.size()), oldKeyframe, newKeyframe), newMotion);
+  return newMotion;
+}
+
+float postureDistance(const Posture& a, const Posture& b, float bound, float rotationWeight) {
+  return frameDistance(frameOf(a), frameOf(b), static_cast<int>(a.rotations.size()), bound, rotationWeight);
+}
+
+Transition findTransition(const Motion& motionA, int firstA, int countA, const Motion& motionB, int firstB,
+                          int countB) {
+  Transition best;
+  for (int i = firstA; i < firstA + countA; ++i) {
+    for (int k = firstB; k < firstB + countB; ++k) {
+      float cost = postureDistance(motionA.posture(i), motionB.posture(k), best.cost);
+      if (cost < best.cost) best = {i, k, cost};
+    }
+  }
+  return best;
+}
 
-      v3f = motion.posture(frame).translations[j] * (1 - ratio) + motion.posture(frame + 1).translations[j] * ratio;
-      q = motion.posture(frame).rotations[j];
-      q = q.slerp(ratio, motion.posture(frame + 1).rotations[j]);
-      p.rotations.push_back(q);
-      p.translations.push_back(v3f);
+void transitionCosts(const Motion& motionA, int firstA, int countA, const Motion& motionB, int firstB, int countB,
+                     Eigen::MatrixXf& costs) {
+  costs.resize(countA, countB);
+  // Column major, so each task writes whole columns: one frame of B against a range of frames of A.
+  WorkerPool::get().parallelFor(countB, 1, [&](int begin, int end) {
+    for (int k = begin; k < end; ++k) {
+      for (int i = 0; i < countA; ++i)
+        costs(i, k) = postureDistance(motionA.posture(firstA + i), motionB.posture(firstB + k));
+    }
+  });
+}
+
+TransitionIndex::TransitionIndex(const std::vector<const Motion*>& clips_, int entryWindow_, int blendFrameCount_,
+                                 float maxCost_)
+    : clipCount(static_cast<int>(clips_.size())), table(clips_.size() * clips_.size()) {
+  Eigen::MatrixXf costs;
+  for (int from = 0; from < clipCount; ++from) {
+    for (int to = 0; to < clipCount; ++to) {
+      const Motion& motionA = *clips_[from];
+      const Motion& motionB = *clips_[to];
+      const int countA = static_cast<int>(motionA.size()) - blendFrameCount_ + 1;
+      const int countB = std::min(entryWindow_, static_cast<int>(motionB.size()) - blendFrameCount_ + 1);
+      if (countA <= 0 || countB <= 0) continue;
+      transitionCosts(motionA, 0, countA, motionB, 0, countB, costs);
+      if (&motionA == &motionB) {
+        // A frame costs nothing against itself, jumps within blendFrameCount frames of it would go nowhere.
+        const int band = std::max(1, blendFrameCount_);
+        for (int k = 0; k < countB; ++k) {
+          for (int i = std::max(0, k - band + 1); i < std::min(countA, k + band); ++i)
+            costs(i, k) = std::numeric_limits<float>::infinity();
+        }
+      }
+      std::vector<Transition>& transitions = table[from * clipCount + to];
+      // Every local minimum of its 3x3 neighbourhood, row by row so they come sorted by frameA.
+      for (int i = 0; i < countA; ++i) {
+        for (int k = 0; k < countB; ++k) {
+          float cost = costs(i, k);
+          if (cost > maxCost_ || std::isinf(cost)) continue;
+          bool isMinimum = true;
+          for (int di = std::max(0, i - 1); di <= std::min(countA - 1, i + 1) && isMinimum; ++di) {
+            for (int dk = std::max(0, k - 1); dk <= std::min(countB - 1, k + 1); ++dk) {
+              // Ties keep the earliest pair only.
+              if (costs(di, dk) < cost || (costs(di, dk) == cost && (di < i || (di == i && dk < k)))) {
+                isMinimum = false;
+                break;
+              }
+            }
+          }
+          if (isMinimum) transitions.push_back({i, k, cost});
+        }
+      }
     }
-    postures[i] = p;
   }
-  newMotion.posture() = postures;
+}
+
+const Transition* TransitionIndex::next(int from, int to, int frame) const {
+  const std::vector<Transition>& candidates = transitions(from, to);
+  auto it = std::lower_bound(candidates.begin(), candidates.end(), frame,
+                             [](const Transition& transition, int value) { return transition.frameA < value; });
+  return it == candidates.end() ? nullptr : &*it;
+}
+
+const Transition* TransitionIndex::best(int from, int to) const {
+  const std::vector<Transition>& candidates = transitions(from, to);
+  auto it = std::min_element(candidates.begin(), candidates.end(),
+                             [](const Transition& a, const Transition& b) { return a.cost < b.cost; });
+  return it == candidates.end() ? nullptr : &*it;
+}
+
+Motion motionBlend(const Motion& motionA, const Motion& motionB, const Transition& transition, int blendFrameCount) {
+  const int totalBones = static_cast<int>(motionA.posture(0).rotations.size());
+  const int totalFramesB = static_cast<int>(motionB.size());
+  const float blendFactor = 1.0f / blendFrameCount;
+  const Posture& startA = motionA.posture(transition.frameA);
+  const Posture& startB = motionB.posture(transition.frameB);
+  Motion newMotion;
+  std::vector<Posture>& postures = newMotion.posture();
+  postures.reserve(transition.frameA + totalFramesB - transition.frameB);
+  postures.insert(postures.end(), motionA.posture().begin(), motionA.posture().begin() + transition.frameA);
+  postures.resize(transition.frameA + totalFramesB - transition.frameB);
+
+  WorkerPool::get().parallelFor(totalFramesB - transition.frameB, postureGrainSize, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      const Posture& b = motionB.posture(transition.frameB + i);
+      Posture& p = postures[transition.frameA + i];
+      p.rotations.resize(totalBones);
+      p.translations.resize(totalBones);
+      if (i >= blendFrameCount) {
+        offsetFrame(frameOf(startA), frameOf(startB), frameOf(b), totalBones, p.rotations.data(),
+                    p.translations.data());
+        continue;
+      }
+      const Posture& a = motionA.posture(transition.frameA + i);
+      blendFrame(frameOf(startA), frameOf(startB), frameOf(a), frameOf(b), (i + 1) * blendFactor, totalBones,
+                 p.rotations.data(), p.translations.data());
+    }
+  });
   return newMotion;
 }
 
 Motion motionBlend(const Motion& motionA, const Motion& motionB) {
-  Motion newMotion;
   constexpr int blendFrameCount = 20;
-  constexpr float blendFactor = 1.0f / blendFrameCount;
   constexpr int matchRange = 10;
-  float difference[matchRange] = {};
   // TODO (Bonus)
   // motionA: |--------------|--matchRange--|--blendFrameCount--|
   // motionB:                               |--blendFrameCount--|--------------|
@@ -112,47 +556,403 @@ Motion motionBlend(const Motion& motionA, const Motion& motionB) {
 
   // Write your code here
   int totalFrames = static_cast<int>(motionA.size());
-  int totalBones = static_cast<int>(motionA.posture(0).rotations.size());
-  int totalFramesB = static_cast<int>(motionB.size());
-  std::vector<Posture> postures;
-
-  for (int i = 0; i < totalFrames - blendFrameCount; i++) {
-    postures.push_back(motionA.posture(i));
-  }
-
-  for (int i = 0; i < blendFrameCount; i++) {
-    float rate = i * blendFactor;
-    Posture p;
-    for (int j = 0; j < totalBones; j++) {
-      Eigen::Quaternionf q;
-      Eigen::Vector3f v3f;
-      v3f = motionA.posture(totalFrames - blendFrameCount).translations[j];
-      v3f += (motionA.posture(i + totalFrames - blendFrameCount).translations[j] -
-              motionA.posture(totalFrames - blendFrameCount).translations[j]) *
-                 (1 - rate) +
-             (motionB.posture(i).translations[j] - motionB.posture(0).translations[j]) * rate;
-      q = motionA.posture(i + totalFrames - blendFrameCount).rotations[j];
-      q = q.slerp(rate, motionB.posture(blendFrameCount).rotations[j]);
-      p.rotations.push_back(q);
-      p.translations.push_back(v3f);
-    }
-    postures.push_back(p);
-  }
-
-  for (int i = blendFrameCount; i < totalFramesB; i++) {
-    Posture p;
-    for (int j = 0; j < totalBones; j++) {
-      Eigen::Quaternionf q;
-      Eigen::Vector3f v3f;
-      v3f = motionA.posture(totalFrames - blendFrameCount).translations[j] +
-            (motionB.posture(i).translations[j] - motionB.posture(0).translations[j]);
-      q = motionB.posture(i).rotations[j];
-      p.translations.push_back(v3f);
-      p.rotations.push_back(q);
-    }
-    postures.push_back(p);
-  }
-  newMotion.posture() = postures;
-  
-  return newMotion;
+  int lastStart = totalFrames - blendFrameCount;
+  int firstStart = std::max(0, lastStart - matchRange);
+  Transition transition = findTransition(motionA, firstStart, lastStart - firstStart + 1, motionB, 0, 1);
+  return motionBlend(motionA, motionB, transition, blendFrameCount);
+}
+
+void ClipView::copyTo(int i, Posture& posture) const {
+  FrameView view = frame(i);
+  posture.rotations.assign(view.rotations, view.rotations + _boneCount);
+  posture.translations.assign(view.translations, view.translations + _boneCount);
+}
+
+ClipBuffer::ClipBuffer(const Motion& motion) {
+  int frameCount_ = static_cast<int>(motion.size());
+  resize(frameCount_, frameCount_ == 0 ? 0 : static_cast<int>(motion.posture(0).rotations.size()));
+  for (int i = 0; i < _frameCount; ++i) {
+    const Posture& posture = motion.posture(i);
+    std::copy(posture.rotations.begin(), posture.rotations.end(), rotations(i));
+    std::copy(posture.translations.begin(), posture.translations.end(), translations(i));
+  }
+}
+
+void ClipBuffer::resize(int frameCount_, int boneCount_) {
+  _frameCount = frameCount_;
+  _boneCount = boneCount_;
+  _rotations.resize(static_cast<size_t>(frameCount_) * boneCount_);
+  _translations.resize(static_cast<size_t>(frameCount_) * boneCount_);
+}
+
+Motion ClipBuffer::toMotion() const {
+  Motion motion;
+  motion.posture().resize(_frameCount);
+  ClipView clip = view();
+  for (int i = 0; i < _frameCount; ++i) clip.copyTo(i, motion.posture(i));
+  return motion;
+}
+
+bool ClipBuffer::save(const char* path) const {
+  FILE* file = std::fopen(path, "wb");
+  if (!file) return false;
+  ClipFileHeader header{};
+  std::memcpy(header.magic, clipMagic, sizeof(clipMagic));
+  header.version = clipVersion;
+  header.frameCount = _frameCount;
+  header.boneCount = _boneCount;
+  bool isWritten = std::fwrite(&header, sizeof(header), 1, file) == 1 &&
+                   std::fwrite(_rotations.data(), sizeof(Eigen::Quaternionf), _rotations.size(), file) ==
+                       _rotations.size() &&
+                   std::fwrite(_translations.data(), sizeof(Eigen::Vector3f), _translations.size(), file) ==
+                       _translations.size();
+  return std::fclose(file) == 0 && isWritten;
+}
+
+MappedClip::MappedClip(MappedClip&& other) noexcept { *this = std::move(other); }
+
+MappedClip& MappedClip::operator=(MappedClip&& other) noexcept {
+  if (this == &other) return *this;
+  close();
+  std::swap(data, other.data);
+  std::swap(dataSize, other.dataSize);
+#ifdef _WIN32
+  std::swap(mapping, other.mapping);
+#endif
+  std::swap(clip, other.clip);
+  return *this;
+}
+
+bool MappedClip::open(const char* path) {
+  close();
+#ifdef _WIN32
+  HANDLE file =
+      CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) return false;
+  LARGE_INTEGER size;
+  if (GetFileSizeEx(file, &size) && size.QuadPart > 0) {
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (mapping) {
+      data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+      dataSize = static_cast<std::size_t>(size.QuadPart);
+    }
+  }
+  // The mapping keeps the file open.
+  CloseHandle(file);
+#else
+  int file = ::open(path, O_RDONLY);
+  if (file < 0) return false;
+  struct stat status;
+  if (fstat(file, &status) == 0 && status.st_size > 0) {
+    void* mapped = mmap(nullptr, static_cast<std::size_t>(status.st_size), PROT_READ, MAP_PRIVATE, file, 0);
+    if (mapped != MAP_FAILED) {
+      data = mapped;
+      dataSize = static_cast<std::size_t>(status.st_size);
+    }
+  }
+  // The mapping keeps the file open.
+  ::close(file);
+#endif
+  if (!data || dataSize < sizeof(ClipFileHeader)) {
+    close();
+    return false;
+  }
+  ClipFileHeader header;
+  std::memcpy(&header, data, sizeof(header));
+  constexpr std::size_t elementSize = sizeof(Eigen::Quaternionf) + sizeof(Eigen::Vector3f);
+  const std::size_t arraySize = dataSize - sizeof(header);
+  const std::size_t elementCount = arraySize / elementSize;
+  // Checked by dividing, the counts of a crafted header multiplied out could wrap around and still match.
+  auto isCountMatching = [&] {
+    if (header.frameCount < 0 || header.boneCount < 0 || arraySize % elementSize != 0) return false;
+    if (header.boneCount == 0) return elementCount == 0;
+    const auto boneCount = static_cast<std::size_t>(header.boneCount);
+    return elementCount % boneCount == 0 && elementCount / boneCount == static_cast<std::size_t>(header.frameCount);
+  };
+  if (std::memcmp(header.magic, clipMagic, sizeof(clipMagic)) != 0 || header.version != clipVersion ||
+      !isCountMatching()) {
+    close();
+    return false;
+  }
+  // The mapping is page aligned, so the rotations after the 16 byte header are aligned like in a vector.
+  const char* bytes = static_cast<const char*>(data);
+  const auto* rotations = reinterpret_cast<const Eigen::Quaternionf*>(bytes + sizeof(header));
+  const auto* translations =
+      reinterpret_cast<const Eigen::Vector3f*>(bytes + sizeof(header) + elementCount * sizeof(Eigen::Quaternionf));
+  clip = ClipView(header.frameCount, header.boneCount, rotations, translations);
+  return true;
+}
+
+void MappedClip::close() {
+  if (data) {
+#ifdef _WIN32
+    UnmapViewOfFile(data);
+#else
+    munmap(const_cast<void*>(data), dataSize);
+#endif
+  }
+#ifdef _WIN32
+  if (mapping) CloseHandle(mapping);
+  mapping = nullptr;
+#endif
+  data = nullptr;
+  dataSize = 0;
+  clip = ClipView();
+}
+
+void motionWarp(const ClipView& clip, const WarpTable& table, ClipBuffer& output) {
+  output.resize(table.size(), clip.boneCount());
+  WorkerPool::get().parallelFor(table.size(), postureGrainSize, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      interpolateFrame(clip.frame(table.frame[i]), clip.frame(table.nextFrame[i]), table.ratio[i], clip.boneCount(),
+                       output.rotations(i), output.translations(i));
+    }
+  });
+}
+
+void motionBlend(const ClipView& clipA, const ClipView& clipB, const Transition& transition, int blendFrameCount,
+                 ClipBuffer& output) {
+  const int totalBones = clipA.boneCount();
+  const int tailCount = clipB.frameCount() - transition.frameB;
+  const float blendFactor = 1.0f / blendFrameCount;
+  const FrameView startA = clipA.frame(transition.frameA);
+  const FrameView startB = clipB.frame(transition.frameB);
+  output.resize(transition.frameA + tailCount, totalBones);
+  const FrameView first = clipA.frame(0);
+  std::copy(first.rotations, first.rotations + static_cast<std::ptrdiff_t>(transition.frameA) * totalBones,
+            output.rotations(0));
+  std::copy(first.translations, first.translations + static_cast<std::ptrdiff_t>(transition.frameA) * totalBones,
+            output.translations(0));
+  WorkerPool::get().parallelFor(tailCount, postureGrainSize, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      int frame = transition.frameA + i;
+      FrameView b = clipB.frame(transition.frameB + i);
+      if (i >= blendFrameCount) {
+        offsetFrame(startA, startB, b, totalBones, output.rotations(frame), output.translations(frame));
+      } else {
+        blendFrame(startA, startB, clipA.frame(frame), b, (i + 1) * blendFactor, totalBones, output.rotations(frame),
+                   output.translations(frame));
+      }
+    }
+  });
+}
+
+Transition findTransition(const ClipView& clipA, int firstA, int countA, const ClipView& clipB, int firstB,
+                          int countB) {
+  Transition best;
+  for (int i = firstA; i < firstA + countA; ++i) {
+    for (int k = firstB; k < firstB + countB; ++k) {
+      float cost = frameDistance(clipA.frame(i), clipB.frame(k), clipA.boneCount(), best.cost, 1.0f);
+      if (cost < best.cost) best = {i, k, cost};
+    }
+  }
+  return best;
+}
+
+namespace {
+// Each of the three smallest components of a unit quaternion is within +-1/sqrt(2).
+constexpr float smallestThreeRange = 0.70710678f;
+constexpr float smallestThreeScale = 32767.0f;
+
+// Smallest-three: the largest component is made positive and dropped, the other three get 15 bits each and its
+// index goes into the top bits of the first two.
+void packRotation(const Eigen::Quaternionf& rotation, std::uint16_t* packed) {
+  Eigen::Vector4f coeffs = rotation.normalized().coeffs();
+  int largest = 0;
+  coeffs.cwiseAbs().maxCoeff(&largest);
+  if (coeffs[largest] < 0.0f) coeffs = -coeffs;
+  for (int i = 0, k = 0; i < 4; ++i) {
+    if (i == largest) continue;
+    float unit = std::clamp((coeffs[i] / smallestThreeRange + 1.0f) * 0.5f, 0.0f, 1.0f);
+    packed[k++] = static_cast<std::uint16_t>(std::lround(unit * smallestThreeScale));
+  }
+  packed[0] = static_cast<std::uint16_t>(packed[0] | (largest & 1) << 15);
+  packed[1] = static_cast<std::uint16_t>(packed[1] | (largest >> 1) << 15);
+}
+
+Eigen::Quaternionf unpackRotation(const std::uint16_t* packed) {
+  int largest = (packed[0] >> 15) | (packed[1] >> 15) << 1;
+  Eigen::Quaternionf rotation;
+  float squaredSum = 0.0f;
+  for (int i = 0, k = 0; i < 4; ++i) {
+    if (i == largest) continue;
+    float value = ((packed[k++] & 0x7fff) / smallestThreeScale * 2.0f - 1.0f) * smallestThreeRange;
+    rotation.coeffs()[i] = value;
+    squaredSum += value * value;
+  }
+  rotation.coeffs()[largest] = std::sqrt(std::max(0.0f, 1.0f - squaredSum));
+  return rotation;
+}
+
+// Scratch frames of one chunk of work, sized once per chunk.
+struct FrameScratch {
+  explicit FrameScratch(int boneCount) : rotations(boneCount), translations(boneCount) {}
+  FrameView view() const { return {rotations.data(), translations.data()}; }
+  std::vector<Eigen::Quaternionf> rotations;
+  std::vector<Eigen::Vector3f> translations;
+  int frame = -1;
+};
+
+// Decompress a frame into scratch unless it already holds it.
+const FrameScratch& decompressInto(const CompressedClip& clip, int frame, FrameScratch& scratch) {
+  if (scratch.frame != frame) {
+    clip.decompress(frame, scratch.rotations.data(), scratch.translations.data());
+    scratch.frame = frame;
+  }
+  return scratch;
+}
+}  // namespace
+
+CompressedClip::CompressedClip(const ClipView& clip) : _frameCount(clip.frameCount()), _boneCount(clip.boneCount()) {
+  if (_frameCount == 0) return;
+  const FrameView first = clip.frame(0);
+  for (int j = 0; j < _boneCount; ++j) {
+    std::uint16_t firstPacked[3];
+    packRotation(first.rotations[j], firstPacked);
+    bool isConstantRotation = true;
+    bool isConstantTranslation = true;
+    Eigen::Vector3f minimum = first.translations[j];
+    Eigen::Vector3f maximum = first.translations[j];
+    for (int i = 1; i < _frameCount; ++i) {
+      const FrameView frame = clip.frame(i);
+      std::uint16_t packed[3];
+      packRotation(frame.rotations[j], packed);
+      isConstantRotation = isConstantRotation && std::equal(packed, packed + 3, firstPacked);
+      isConstantTranslation = isConstantTranslation && frame.translations[j] == first.translations[j];
+      minimum = minimum.cwiseMin(frame.translations[j]);
+      maximum = maximum.cwiseMax(frame.translations[j]);
+    }
+    if (isConstantRotation) {
+      constantRotationBones.push_back(j);
+      constantRotations.push_back(first.rotations[j]);
+    } else {
+      animatedRotationBones.push_back(j);
+    }
+    if (isConstantTranslation) {
+      constantTranslationBones.push_back(j);
+      constantTranslations.push_back(first.translations[j]);
+    } else {
+      animatedTranslationBones.push_back(j);
+      translationMinimums.push_back(minimum);
+      translationSteps.push_back((maximum - minimum) / 65535.0f);
+    }
+  }
+
+  const int rotationCount = static_cast<int>(animatedRotationBones.size());
+  const int translationCount = static_cast<int>(animatedTranslationBones.size());
+  rotationData.resize(static_cast<size_t>(_frameCount) * rotationCount * 3);
+  translationData.resize(static_cast<size_t>(_frameCount) * translationCount * 3);
+  for (int i = 0; i < _frameCount; ++i) {
+    const FrameView frame = clip.frame(i);
+    std::uint16_t* rotationFrame = &rotationData[static_cast<size_t>(i) * rotationCount * 3];
+    for (int k = 0; k < rotationCount; ++k)
+      packRotation(frame.rotations[animatedRotationBones[k]], rotationFrame + 3 * k);
+    std::uint16_t* translationFrame = &translationData[static_cast<size_t>(i) * translationCount * 3];
+    for (int k = 0; k < translationCount; ++k) {
+      const Eigen::Vector3f& translation = frame.translations[animatedTranslationBones[k]];
+      for (int c = 0; c < 3; ++c) {
+        float step = translationSteps[k][c];
+        float quantized = step > 0.0f ? (translation[c] - translationMinimums[k][c]) / step : 0.0f;
+        translationFrame[3 * k + c] = static_cast<std::uint16_t>(std::lround(std::clamp(quantized, 0.0f, 65535.0f)));
+      }
+    }
+  }
+}
+
+void CompressedClip::decompress(int frame, Eigen::Quaternionf* rotations, Eigen::Vector3f* translations) const {
+  for (size_t k = 0; k < constantRotationBones.size(); ++k) rotations[constantRotationBones[k]] = constantRotations[k];
+  for (size_t k = 0; k < constantTranslationBones.size(); ++k)
+    translations[constantTranslationBones[k]] = constantTranslations[k];
+  const size_t rotationCount = animatedRotationBones.size();
+  const std::uint16_t* rotationFrame = rotationData.data() + frame * rotationCount * 3;
+  for (size_t k = 0; k < rotationCount; ++k)
+    rotations[animatedRotationBones[k]] = unpackRotation(rotationFrame + 3 * k);
+  const size_t translationCount = animatedTranslationBones.size();
+  const std::uint16_t* translationFrame = translationData.data() + frame * translationCount * 3;
+  for (size_t k = 0; k < translationCount; ++k) {
+    Eigen::Vector3f quantized(translationFrame[3 * k], translationFrame[3 * k + 1], translationFrame[3 * k + 2]);
+    translations[animatedTranslationBones[k]] = translationMinimums[k] + quantized.cwiseProduct(translationSteps[k]);
+  }
+}
+
+void CompressedClip::decompress(int frame, Posture& posture) const {
+  posture.rotations.resize(_boneCount);
+  posture.translations.resize(_boneCount);
+  decompress(frame, posture.rotations.data(), posture.translations.data());
+}
+
+void CompressedClip::decompress(ClipBuffer& output) const {
+  output.resize(_frameCount, _boneCount);
+  WorkerPool::get().parallelFor(_frameCount, postureGrainSize, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) decompress(i, output.rotations(i), output.translations(i));
+  });
+}
+
+std::size_t CompressedClip::byteSize() const {
+  return (constantRotationBones.size() + constantTranslationBones.size() + animatedRotationBones.size() +
+          animatedTranslationBones.size()) *
+             sizeof(int) +
+         constantRotations.size() * sizeof(Eigen::Quaternionf) +
+         (constantTranslations.size() + translationMinimums.size() + translationSteps.size()) *
+             sizeof(Eigen::Vector3f) +
+         (rotationData.size() + translationData.size()) * sizeof(std::uint16_t);
+}
+
+void motionWarp(const CompressedClip& clip, const WarpTable& table, ClipBuffer& output) {
+  output.resize(table.size(), clip.boneCount());
+  WorkerPool::get().parallelFor(table.size(), postureGrainSize, [&](int begin, int end) {
+    // Neighbouring output frames mostly sample the same source frames, so the two last ones are kept.
+    FrameScratch scratch[2] = {FrameScratch(clip.boneCount()), FrameScratch(clip.boneCount())};
+    for (int i = begin; i < end; ++i) {
+      if (scratch[1].frame == table.frame[i]) std::swap(scratch[0], scratch[1]);
+      const FrameScratch& from = decompressInto(clip, table.frame[i], scratch[0]);
+      const FrameScratch& to = decompressInto(clip, table.nextFrame[i], scratch[1]);
+      interpolateFrame(from.view(), to.view(), table.ratio[i], clip.boneCount(), output.rotations(i),
+                       output.translations(i));
+    }
+  });
+}
+
+void motionBlend(const CompressedClip& clipA, const CompressedClip& clipB, const Transition& transition,
+                 int blendFrameCount, ClipBuffer& output) {
+  const int totalBones = clipA.boneCount();
+  const int tailCount = clipB.frameCount() - transition.frameB;
+  const float blendFactor = 1.0f / blendFrameCount;
+  FrameScratch startA(totalBones), startB(totalBones);
+  decompressInto(clipA, transition.frameA, startA);
+  decompressInto(clipB, transition.frameB, startB);
+  output.resize(transition.frameA + tailCount, totalBones);
+  WorkerPool::get().parallelFor(transition.frameA, postureGrainSize, [&](int begin, int end) {
+    for (int i = begin; i < end; ++i) clipA.decompress(i, output.rotations(i), output.translations(i));
+  });
+  WorkerPool::get().parallelFor(tailCount, postureGrainSize, [&](int begin, int end) {
+    FrameScratch a(totalBones), b(totalBones);
+    for (int i = begin; i < end; ++i) {
+      int frame = transition.frameA + i;
+      decompressInto(clipB, transition.frameB + i, b);
+      if (i >= blendFrameCount) {
+        offsetFrame(startA.view(), startB.view(), b.view(), totalBones, output.rotations(frame),
+                    output.translations(frame));
+      } else {
+        decompressInto(clipA, frame, a);
+        blendFrame(startA.view(), startB.view(), a.view(), b.view(), (i + 1) * blendFactor, totalBones,
+                   output.rotations(frame), output.translations(frame));
+      }
+    }
+  });
+}
+
+void forwardKinematics(const FlatSkeleton& skeleton, const CompressedClip& clip,
+                       std::vector<Eigen::Quaternionf>& rotations, std::vector<Eigen::Vector3f>& endPositions) {
+  const int frameCount = clip.frameCount();
+  const int boneCount = skeleton.size();
+  rotations.resize(static_cast<size_t>(frameCount) * boneCount);
+  endPositions.resize(static_cast<size_t>(frameCount) * boneCount);
+  WorkerPool::get().parallelFor(frameCount, postureGrainSize, [&](int begin, int end) {
+    Posture posture;
+    for (int frame = begin; frame < end; ++frame) {
+      clip.decompress(frame, posture);
+      posePosture(skeleton, posture, &rotations[frame * boneCount], &endPositions[frame * boneCount]);
+    }
+  });
 }
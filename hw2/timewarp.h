@@ -0,0 +1,36 @@
+#pragma once
+#include <vector>
+
+#include "kinematics.h"
+
+/**
+ * @brief Where each frame of a warped motion samples the original one.
+ * Output frame i blends source frames frame[i] and nextFrame[i] by ratio[i], all computed once by makeWarpTable.
+ */
+struct WarpTable {
+  std::vector<int> frame;
+  // frame + 1, clamped to the last source frame.
+  std::vector<int> nextFrame;
+  std::vector<float> ratio;
+  int size() const { return static_cast<int>(frame.size()); }
+};
+
+/**
+ * @brief Map the frames of a motion retimed from oldKeyframe to newKeyframe onto the source frames.
+ *
+ * @param frameCount Frames of the source motion.
+ * @param oldKeyframe Length of the source in keyframe units.
+ * @param newKeyframe Length of the output in the same units.
+ */
+WarpTable makeWarpTable(int frameCount, int oldKeyframe, int newKeyframe);
+
+/**
+ * @brief Warp a motion by a table into output, reusing the postures it already holds.
+ * Translations are lerped and rotations slerped, the frames are split across a thread pool. Nothing is allocated
+ * when output already has the table's size and the motion's bone count, e.g. when the same clip is warped again.
+ *
+ * @param motion The source motion, must outlive the call and not alias output.
+ * @param table From makeWarpTable(motion.size(), ...).
+ * @param output Resized to table.size() postures.
+ */
+void motionWarp(const Motion& motion, const WarpTable& table, Motion& output);
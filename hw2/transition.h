@@ -0,0 +1,90 @@
+#pragma once
+#include <limits>
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "kinematics.h"
+
+/**
+ * @brief A place to leave motion A for motion B: blending starts at frameA of A and frameB of B.
+ */
+struct Transition {
+  int frameA = 0;
+  int frameB = 0;
+  float cost = std::numeric_limits<float>::infinity();
+};
+
+/**
+ * @brief Pose distance: squared translation offsets plus rotationWeight * (1 - dot^2) of every bone's rotation.
+ * The root's horizontal translation is ignored, blending aligns it. Bones are compared a block at a time and the
+ * sum stops once it exceeds bound, the result is then only known to be above bound.
+ *
+ * @param bound Stop once the distance is larger.
+ */
+float postureDistance(const Posture& a, const Posture& b, float bound = std::numeric_limits<float>::infinity(),
+                      float rotationWeight = 1.0f);
+
+/**
+ * @brief The cheapest transition from frames [firstA, firstA + countA) of A into [firstB, firstB + countB) of B.
+ * Candidates are scanned with the best cost so far as the bound, so most of them stop after a few bones.
+ */
+Transition findTransition(const Motion& motionA, int firstA, int countA, const Motion& motionB, int firstB,
+                          int countB);
+
+/**
+ * @brief Distance of every pair of frames in the two windows, costs(i, k) for frame firstA + i of A and firstB + k
+ * of B. The rows are split across a thread pool.
+ *
+ * @param costs Resized to countA x countB, reused if it already is.
+ */
+void transitionCosts(const Motion& motionA, int firstA, int countA, const Motion& motionB, int firstB, int countB,
+                     Eigen::MatrixXf& costs);
+
+/**
+ * @brief Precomputed transitions between every ordered pair of clips, in the spirit of motion graphs.
+ * A transition is a local minimum of the cost matrix between A and the first entryWindow frames of B, leaving room
+ * for blendFrameCount frames in both. Blending at run time then looks a transition up instead of scanning.
+ * Within a clip, frames less than blendFrameCount apart are not paired, a frame always matches itself.
+ */
+class TransitionIndex {
+ public:
+  /**
+   * @brief Build the index, the clips are only read during construction.
+   *
+   * @param clips_ The clips, referred to by their position.
+   * @param entryWindow_ Frames at the start of a clip that may be entered.
+   * @param blendFrameCount_ Frames the blend will take.
+   * @param maxCost_ Minima above this are dropped.
+   */
+  TransitionIndex(const std::vector<const Motion*>& clips_, int entryWindow_, int blendFrameCount_,
+                  float maxCost_ = std::numeric_limits<float>::infinity());
+  /**
+   * @brief Transitions from clip `from` into clip `to`, by frameA.
+   *
+   */
+  const std::vector<Transition>& transitions(int from, int to) const { return table[from * clipCount + to]; }
+  /**
+   * @brief The first transition from `from` into `to` at or after frame, nullptr if there is none.
+   *
+   */
+  const Transition* next(int from, int to, int frame) const;
+  /**
+   * @brief The cheapest transition from `from` into `to`, nullptr if there is none.
+   *
+   */
+  const Transition* best(int from, int to) const;
+
+ private:
+  int clipCount;
+  // Transitions of (from, to) are table[from * clipCount + to].
+  std::vector<std::vector<Transition>> table;
+};
+
+/**
+ * @brief Blend A into B at a transition: A up to frameA, blendFrameCount blended frames, then the rest of B.
+ * B is moved by the translation offset between frameA of A and frameB of B.
+ *
+ * @param transition Needs frameA + blendFrameCount <= motionA.size() and frameB + blendFrameCount <= motionB.size().
+ */
+Motion motionBlend(const Motion& motionA, const Motion& motionB, const Transition& transition, int blendFrameCount);
@@ -0,0 +1,514 @@
+// Latency of the HW3 kinematics on synthetic skeletons and targets. Build it like the assignment, with bench.cpp in
+// place of the framework's main, e.g. g++ -O2 -std=c++17 -I<framework include> bench.cpp kinematics.cpp -lpthread
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <new>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "flatskeleton.h"
+#include "iksession.h"
+#include "kinematics.h"
+#include "multiik.h"
+
+namespace {
+std::atomic<std::size_t> allocationCount = 0;
+}  // namespace
+
+#ifdef __GLIBC__
+// Eigen allocates dense storage with malloc directly, and operator new calls malloc too, so count malloc itself.
+// The blocks come from glibc's own allocator, its free releases them.
+#define ALLOCATION_COLUMN "allocations_per_call"
+extern "C" {
+void* __libc_malloc(std::size_t size);
+void* __libc_calloc(std::size_t count, std::size_t size);
+void* __libc_realloc(void* pointer, std::size_t size);
+void* __libc_memalign(std::size_t alignment, std::size_t size);
+
+void* malloc(std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_malloc(size);
+}
+void* calloc(std::size_t count, std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_calloc(count, size);
+}
+void* realloc(void* pointer, std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_realloc(pointer, size);
+}
+void* aligned_alloc(std::size_t alignment, std::size_t size) noexcept {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  return __libc_memalign(alignment, size);
+}
+int posix_memalign(void** pointer, std::size_t alignment, std::size_t size) noexcept {
+  if (alignment % sizeof(void*) != 0 || (alignment & (alignment - 1)) != 0) return EINVAL;
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  *pointer = __libc_memalign(alignment, size);
+  return *pointer || size == 0 ? 0 : ENOMEM;
+}
+}
+#else
+// Without glibc's malloc to wrap only operator new is counted, Eigen's dense storage is not.
+#define ALLOCATION_COLUMN "std_allocations_per_call"
+void* operator new(std::size_t size) {
+  allocationCount.fetch_add(1, std::memory_order_relaxed);
+  if (void* pointer = std::malloc(size == 0 ? 1 : size)) return pointer;
+  throw std::bad_alloc();
+}
+// Inlined into the std allocators, GCC takes the free of memory from operator new for a mismatch.
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void operator delete(void* pointer) noexcept { std::free(pointer); }
+void operator delete(void* pointer, std::size_t) noexcept { std::free(pointer); }
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ >= 11
+#pragma GCC diagnostic pop
+#endif
+#endif
+
+namespace {
+enum BenchmarkCase { fk, fkFlat, leastSquare, ik, ikSession, ikMulti, benchmarkCaseCount };
+constexpr const char* caseNames[] = {"fk", "fk_flat", "least_square", "ik", "ik_session", "ik_multi"};
+// Solved like the IK itself, closer than its epsilon.
+constexpr float solvedDistance = 1E-3f;
+
+struct BenchmarkOptions {
+  std::vector<int> boneCounts{31, 62, 124};
+  std::vector<int> chainLengths{2, 4, 7, 10};
+  // Of the chain's reach, the IK cases move the target this far from the end. ik_session turns the chain's joints by
+  // up to this many radians instead, so its targets stay reachable.
+  std::vector<float> distances{0.1f, 0.5f, 0.9f, 1.5f};
+  std::vector<int> cases{fk, fkFlat, leastSquare, ik, ikSession, ikMulti};
+  int sampleCount = 1000;
+  int warmupCount = 50;
+  bool isJson = false;
+};
+
+struct BenchmarkResult {
+  int benchmarkCase;
+  int boneCount;
+  // 0 for the cases without a chain or a target.
+  int chainLength;
+  float distance;
+  int sampleCount;
+  double mean, p50, p90, p99, max;
+  double allocationsPerCall;
+  // Fraction of the IK calls that reached the target.
+  double solvedRatio;
+};
+
+// One bone of the body, a CMU ASF skeleton with its 31 bones.
+struct BodyBone {
+  int parent;
+  Eigen::Vector3f direction;
+  float length;
+  // Euler angles of the ASF axis, in radians.
+  Eigen::Vector3f axis;
+};
+
+// Indexed like the ASF skeleton of the CMU motion capture database.
+const BodyBone bodyBones[] = {
+    {-1, {0, 1, 0}, 0.0f, {0, 0, 0}},  // root
+    {0, {0.7f, -0.66f, 0.27f}, 2.4f, {0, 0, 0}},  // lhipjoint
+    {1, {0.34f, -0.94f, 0}, 7.2f, {0, 0, 0.35f}},  // lfemur
+    {2, {0.34f, -0.94f, 0}, 7.4f, {0, 0, 0.35f}},  // ltibia
+    {3, {0.1f, -0.2f, 0.97f}, 2.3f, {-1.57f, 0, 0.35f}},  // lfoot
+    {4, {0, 0, 1}, 1.2f, {-1.57f, 0, 0.35f}},  // ltoes
+    {0, {-0.7f, -0.66f, 0.27f}, 2.4f, {0, 0, 0}},  // rhipjoint
+    {6, {-0.34f, -0.94f, 0}, 7.2f, {0, 0, -0.35f}},  // rfemur
+    {7, {-0.34f, -0.94f, 0}, 7.4f, {0, 0, -0.35f}},  // rtibia
+    {8, {-0.1f, -0.2f, 0.97f}, 2.3f, {-1.57f, 0, -0.35f}},  // rfoot
+    {9, {0, 0, 1}, 1.2f, {-1.57f, 0, -0.35f}},  // rtoes
+    {0, {0, 1, -0.05f}, 2.0f, {0, 0, 0}},  // lowerback
+    {11, {0, 1, 0.05f}, 2.0f, {0, 0, 0}},  // upperback
+    {12, {0, 1, 0}, 2.0f, {0, 0, 0}},  // thorax
+    {13, {0, 1, 0.1f}, 1.6f, {0, 0, 0}},  // lowerneck
+    {14, {0, 1, -0.1f}, 1.6f, {0, 0, 0}},  // upperneck
+    {15, {0, 1, 0}, 1.6f, {0, 0, 0}},  // head
+    {13, {1, 0.2f, 0}, 3.5f, {0, 0, -0.5f}},  // lclavicle
+    {17, {1, 0, 0}, 5.0f, {0, 0, 1.57f}},  // lhumerus
+    {18, {1, 0, 0}, 3.4f, {0, 0, 1.57f}},  // lradius
+    {19, {1, 0, 0}, 1.7f, {0, 0, 1.57f}},  // lwrist
+    {20, {1, 0, 0}, 0.7f, {0, 0, 1.57f}},  // lhand
+    {21, {1, 0, 0}, 0.6f, {0, 0, 1.57f}},  // lfingers
+    {20, {0.7f, 0, 0.7f}, 0.8f, {-0.78f, 0, 1.57f}},  // lthumb
+    {13, {-1, 0.2f, 0}, 3.5f, {0, 0, 0.5f}},  // rclavicle
+    {24, {-1, 0, 0}, 5.0f, {0, 0, -1.57f}},  // rhumerus
+    {25, {-1, 0, 0}, 3.4f, {0, 0, -1.57f}},  // rradius
+    {26, {-1, 0, 0}, 1.7f, {0, 0, -1.57f}},  // rwrist
+    {27, {-1, 0, 0}, 0.7f, {0, 0, -1.57f}},  // rhand
+    {28, {-1, 0, 0}, 0.6f, {0, 0, -1.57f}},  // rfingers
+    {27, {-0.7f, 0, 0.7f}, 0.8f, {-0.78f, 0, -1.57f}},  // rthumb
+};
+constexpr int bodyBoneCount = static_cast<int>(std::size(bodyBones));
+// Bones past the body are more left arms on the thorax, the arm is bodyBones[17, 24).
+constexpr int thorax = 13;
+constexpr int firstArmBone = 17;
+constexpr int armBoneCount = 7;
+
+// The end effectors of ik_multi: both hands and both feet, the fingers end the longest chain.
+constexpr int effectorBones[] = {22, 29, 5, 10};
+
+void printUsage(const char* program) {
+  std::cerr << "Usage: " << program << " [--bones N,...] [--chains N,...] [--distances X,...]"
+            << " [--case NAME,...|all] [--samples N] [--warmup N] [--format csv|json]\n"
+            << "  cases: fk, fk_flat, least_square, ik, ik_session, ik_multi" << std::endl;
+  exit(EXIT_FAILURE);
+}
+
+std::vector<std::string> split(const char* list) {
+  std::vector<std::string> items;
+  std::string current;
+  for (const char* c = list; *c != '\0'; ++c) {
+    if (*c == ',') {
+      items.push_back(current);
+      current.clear();
+    } else {
+      current.push_back(*c);
+    }
+  }
+  items.push_back(current);
+  return items;
+}
+
+std::vector<int> parseCounts(const char* value, int minimum) {
+  std::vector<int> counts;
+  for (const auto& item : split(value)) counts.push_back(std::max(minimum, std::atoi(item.c_str())));
+  return counts;
+}
+
+std::vector<float> parseDistances(const char* value) {
+  std::vector<float> distances;
+  for (const auto& item : split(value)) distances.push_back(std::max(0.0f, std::strtof(item.c_str(), nullptr)));
+  return distances;
+}
+
+BenchmarkOptions parseArguments(int argc, char** argv) {
+  BenchmarkOptions options;
+  for (int i = 1; i < argc; ++i) {
+    if (i + 1 >= argc) printUsage(argv[0]);
+    const char* value = argv[++i];
+    if (std::strcmp(argv[i - 1], "--bones") == 0) {
+      // The effectors of ik_multi are in the body
+      options.boneCounts = parseCounts(value, bodyBoneCount);
+    } else if (std::strcmp(argv[i - 1], "--chains") == 0) {
+      options.chainLengths = parseCounts(value, 1);
+    } else if (std::strcmp(argv[i - 1], "--distances") == 0) {
+      options.distances = parseDistances(value);
+    } else if (std::strcmp(argv[i - 1], "--case") == 0) {
+      options.cases.clear();
+      for (const auto& item : split(value)) {
+        if (item == "all") {
+          for (int type = 0; type < benchmarkCaseCount; ++type) options.cases.push_back(type);
+          continue;
+        }
+        auto found = std::find_if(std::begin(caseNames), std::end(caseNames),
+                                  [&item](const char* name) { return item == name; });
+        if (found == std::end(caseNames)) printUsage(argv[0]);
+        options.cases.push_back(static_cast<int>(found - std::begin(caseNames)));
+      }
+    } else if (std::strcmp(argv[i - 1], "--samples") == 0) {
+      options.sampleCount = std::max(1, std::atoi(value));
+    } else if (std::strcmp(argv[i - 1], "--warmup") == 0) {
+      options.warmupCount = std::max(0, std::atoi(value));
+    } else if (std::strcmp(argv[i - 1], "--format") == 0) {
+      if (std::strcmp(value, "csv") != 0 && std::strcmp(value, "json") != 0) printUsage(argv[0]);
+      options.isJson = std::strcmp(value, "json") == 0;
+    } else {
+      printUsage(argv[0]);
+    }
+  }
+  return options;
+}
+
+// The body truncated or extended to boneCount bones, stored by Bone::idx with the tree links set.
+std::vector<Bone> makeSkeleton(int boneCount) {
+  std::vector<Bone> bones(boneCount);
+  for (int i = 0; i < boneCount; ++i) {
+    int armBone = (i - bodyBoneCount) % armBoneCount;
+    const BodyBone& source = i < bodyBoneCount ? bodyBones[i] : bodyBones[firstArmBone + armBone];
+    int parent = source.parent;
+    if (i >= bodyBoneCount) parent = armBone == 0 ? thorax : source.parent - firstArmBone + (i - armBone);
+    Bone& bone = bones[i];
+    bone.idx = i;
+    bone.direction = source.direction.normalized();
+    bone.length = source.length;
+    bone.axis = Eigen::AngleAxisf(source.axis[2], Eigen::Vector3f::UnitZ()) *
+                Eigen::AngleAxisf(source.axis[1], Eigen::Vector3f::UnitY()) *
+                Eigen::AngleAxisf(source.axis[0], Eigen::Vector3f::UnitX());
+    if (parent < 0) continue;
+    bone.parent = &bones[parent];
+    Bone** link = &bones[parent].child;
+    while (*link != nullptr) link = &(*link)->sibling;
+    *link = &bone;
+  }
+  return bones;
+}
+
+// Postures of a walk: every joint swings with its own phase, the root moves forward.
+std::vector<Posture> makePostures(int boneCount, int frameCount) {
+  std::mt19937 random(1);
+  std::uniform_real_distribution<float> phase(0.0f, 6.28f);
+  std::vector<Eigen::Vector3f> phases(boneCount);
+  for (auto& p : phases) p = {phase(random), phase(random), phase(random)};
+  std::vector<Posture> postures(frameCount);
+  for (int f = 0; f < frameCount; ++f) {
+    Posture& posture = postures[f];
+    posture.rotations.resize(boneCount);
+    posture.translations.assign(boneCount, Eigen::Vector3f::Zero());
+    posture.eulerAngle.resize(boneCount);
+    for (int i = 0; i < boneCount; ++i) {
+      Eigen::Vector3f angle = phases[i] + Eigen::Vector3f::Constant(0.1f * f);
+      Eigen::Vector3f euler(0.4f * std::sin(angle[0]), 0.2f * std::sin(angle[1]), 0.3f * std::sin(angle[2]));
+      posture.eulerAngle[i] = euler;
+      posture.rotations[i] = Eigen::AngleAxisf(euler[2], Eigen::Vector3f::UnitZ()) *
+                             Eigen::AngleAxisf(euler[1], Eigen::Vector3f::UnitY()) *
+                             Eigen::AngleAxisf(euler[0], Eigen::Vector3f::UnitX());
+    }
+    posture.translations[0] = {0.0f, 17.0f + 0.5f * std::sin(0.2f * f), 0.3f * f};
+  }
+  return postures;
+}
+
+// The bone chainLength - 1 above end, or the root if the chain is longer than the path to it.
+Bone* chainStart(Bone* end, int chainLength) {
+  Bone* start = end;
+  for (int i = 1; i < chainLength && start->parent != nullptr; ++i) start = start->parent;
+  return start;
+}
+
+float chainReach(const Bone* start, const Bone* end) {
+  float reach = 0.0f;
+  for (const Bone* bone = end;; bone = bone->parent) {
+    reach += bone->length;
+    if (bone == start || bone->parent == nullptr) break;
+  }
+  return reach;
+}
+
+// Where end is when the joints from start to end swing by up to amplitude radians, a frame apart per target. Every
+// target is reached by some posture of the chain, bones is posed at rest again afterwards.
+std::vector<Eigen::Vector3f> reachableTargets(const FlatSkeleton& skeleton, Bone* root, const Posture& rest,
+                                              Bone* start, Bone* end, float amplitude, int count) {
+  std::vector<Eigen::Vector3f> targets(count);
+  Posture posture = rest;
+  for (int i = 0; i < count; ++i) {
+    int joint = 0;
+    for (Bone* bone = end;; bone = bone->parent, ++joint) {
+      Eigen::Vector3f euler = rest.eulerAngle[bone->idx];
+      euler += amplitude * Eigen::Vector3f(std::sin(0.05f * i + joint), std::sin(0.03f * i + 2.0f * joint),
+                                           std::sin(0.04f * i + 3.0f * joint));
+      posture.eulerAngle[bone->idx] = euler;
+      posture.rotations[bone->idx] = Eigen::AngleAxisf(euler[2], Eigen::Vector3f::UnitZ()) *
+                                     Eigen::AngleAxisf(euler[1], Eigen::Vector3f::UnitY()) *
+                                     Eigen::AngleAxisf(euler[0], Eigen::Vector3f::UnitX());
+      if (bone == start || bone->parent == nullptr) break;
+    }
+    forwardKinematics(skeleton, posture, root);
+    targets[i] = end->endPosition;
+  }
+  forwardKinematics(skeleton, rest, root);
+  return targets;
+}
+
+// Time sampleCount calls of run after warmupCount untimed ones, prepare(i) and isSolved(i) are not timed.
+template <class Prepare, class Run, class IsSolved>
+BenchmarkResult measure(const BenchmarkOptions& options, BenchmarkResult result, Prepare&& prepare, Run&& run,
+                        IsSolved&& isSolved) {
+  for (int i = 0; i < options.warmupCount; ++i) {
+    prepare(i);
+    run(i);
+  }
+  std::vector<double> latencies(options.sampleCount);
+  int solvedCount = 0;
+  std::size_t allocations = 0;
+  for (int i = 0; i < options.sampleCount; ++i) {
+    const int sample = options.warmupCount + i;
+    prepare(sample);
+    std::size_t allocationStart = allocationCount.load(std::memory_order_relaxed);
+    auto start = std::chrono::steady_clock::now();
+    run(sample);
+    latencies[i] = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+    allocations += allocationCount.load(std::memory_order_relaxed) - allocationStart;
+    solvedCount += isSolved(sample) ? 1 : 0;
+  }
+  double mean = 0.0;
+  for (double latency : latencies) mean += latency;
+  std::sort(latencies.begin(), latencies.end());
+  auto percentile = [&latencies](double p) { return latencies[static_cast<int>(p * (latencies.size() - 1))]; };
+  result.sampleCount = options.sampleCount;
+  result.mean = mean / options.sampleCount;
+  result.p50 = percentile(0.5);
+  result.p90 = percentile(0.9);
+  result.p99 = percentile(0.99);
+  result.max = latencies.back();
+  result.allocationsPerCall = static_cast<double>(allocations) / options.sampleCount;
+  result.solvedRatio = static_cast<double>(solvedCount) / options.sampleCount;
+  return result;
+}
+
+void printResults(const std::vector<BenchmarkResult>& results, bool isJson) {
+  if (!isJson) {
+    std::printf(
+        "case,bones,chain,distance,samples,mean_us,p50_us,p90_us,p99_us,max_us," ALLOCATION_COLUMN
+        ",solved_ratio\n");
+  } else {
+    std::printf("[\n");
+  }
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchmarkResult& result = results[i];
+    const char* format =
+        isJson ? "  {\"case\": \"%s\", \"bones\": %d, \"chain\": %d, \"distance\": %.2f, \"samples\": %d, "
+                 "\"mean_us\": %.3f, \"p50_us\": %.3f, \"p90_us\": %.3f, \"p99_us\": %.3f, \"max_us\": %.3f, "
+                 "\"" ALLOCATION_COLUMN "\": %.2f, \"solved_ratio\": %.3f}%s\n"
+               : "%s,%d,%d,%.2f,%d,%.3f,%.3f,%.3f,%.3f,%.3f,%.2f,%.3f%s\n";
+    const char* separator = !isJson ? "" : (i + 1 < results.size() ? "," : "");
+    std::printf(format, caseNames[result.benchmarkCase], result.boneCount, result.chainLength, result.distance,
+                result.sampleCount, result.mean, result.p50, result.p90, result.p99, result.max,
+                result.allocationsPerCall, result.solvedRatio, separator);
+  }
+  if (isJson) std::printf("]\n");
+}
+}  // namespace
+
+int main(int argc, char** argv) {
+  BenchmarkOptions options = parseArguments(argc, argv);
+  // Every skeleton stays loaded for the run, like the framework's, forwardKinematics(posture, root) caches a few.
+  std::vector<std::vector<Bone>> skeletons;
+  skeletons.reserve(options.boneCounts.size());
+  // Keeps the compiler from dropping the results.
+  volatile float sink = 0.0f;
+  const int totalSamples = options.warmupCount + options.sampleCount;
+  auto noPrepare = [](int) {};
+  auto notSolving = [](int) { return false; };
+
+  std::vector<BenchmarkResult> results;
+  for (int boneCount : options.boneCounts) {
+    std::vector<Bone>& bones = skeletons.emplace_back(makeSkeleton(boneCount));
+    Bone* root = &bones[0];
+    FlatSkeleton skeleton = flattenSkeleton(root);
+    const std::vector<Posture> postures = makePostures(boneCount, 120);
+    const Posture& rest = postures[0];
+    Posture posture = rest;
+    forwardKinematics(skeleton, rest, root);
+    // Where the effectors are in the rest posture, the targets are offsets from there.
+    std::vector<Eigen::Vector3f> restPositions;
+    for (int effector : effectorBones) restPositions.push_back(bones[effector].endPosition);
+    std::mt19937 random(7);
+    std::normal_distribution<float> normal;
+    std::vector<Eigen::Vector3f> directions(totalSamples);
+    for (auto& direction : directions) direction = Eigen::Vector3f(normal(random), normal(random), normal(random));
+    for (auto& direction : directions) direction.normalize();
+    BenchmarkResult result{};
+    result.boneCount = boneCount;
+
+    for (int benchmarkCase : options.cases) {
+      result.benchmarkCase = benchmarkCase;
+      result.chainLength = 0;
+      result.distance = 0.0f;
+      switch (benchmarkCase) {
+        case fk:
+          results.push_back(measure(
+              options, result, noPrepare,
+              [&](int i) {
+                forwardKinematics(postures[i % postures.size()], root);
+                sink = bones.back().endPosition[0];
+              },
+              notSolving));
+          continue;
+        case fkFlat:
+          results.push_back(measure(
+              options, result, noPrepare,
+              [&](int i) {
+                forwardKinematics(skeleton, postures[i % postures.size()], root);
+                sink = bones.back().endPosition[0];
+              },
+              notSolving));
+          continue;
+        default:
+          break;
+      }
+      for (int chainLength : options.chainLengths) {
+        result.chainLength = chainLength;
+        if (benchmarkCase == leastSquare) {
+          // One IK iteration's system, distance does not matter.
+          std::vector<Eigen::Matrix3Xf> jacobians(totalSamples, Eigen::Matrix3Xf(3, 3 * chainLength));
+          for (auto& jacobian : jacobians) jacobian.setRandom();
+          results.push_back(measure(
+              options, result, noPrepare,
+              [&](int i) { sink = leastSquareSolver(jacobians[i], directions[i])[0]; }, notSolving));
+          continue;
+        }
+        Bone* end = &bones[effectorBones[0]];
+        Bone* start = chainStart(end, chainLength);
+        const float reach = chainReach(start, end);
+        std::vector<IKEffector> effectors;
+        std::vector<float> reaches;
+        for (int effector : effectorBones) {
+          Bone* effectorEnd = &bones[effector];
+          Bone* effectorStart = chainStart(effectorEnd, chainLength);
+          effectors.push_back({effectorStart, effectorEnd, Eigen::Vector3f::Zero(), 1.0f});
+          reaches.push_back(chainReach(effectorStart, effectorEnd));
+        }
+        for (float distance : options.distances) {
+          result.distance = distance;
+          switch (benchmarkCase) {
+            case ik:
+              results.push_back(measure(
+                  options, result, [&](int) { posture = rest; },
+                  [&](int i) { inverseKinematics(restPositions[0] + distance * reach * directions[i], start, end,
+                                                 posture); },
+                  [&](int i) {
+                    return (end->endPosition - (restPositions[0] + distance * reach * directions[i])).norm() <
+                           solvedDistance;
+                  }));
+              break;
+            case ikSession: {
+              // The target follows a swinging chain, a frame apart per call, so every one of them can be reached.
+              const std::vector<Eigen::Vector3f> targets =
+                  reachableTargets(skeleton, root, rest, start, end, distance, totalSamples);
+              IKSession session(start, end);
+              float error = 0.0f;
+              results.push_back(measure(
+                  options, result, [&](int) { posture = rest; },
+                  [&](int i) { error = session.solve(targets[i], posture); },
+                  [&](int) { return error < solvedDistance; }));
+              break;
+            }
+            case ikMulti: {
+              float error = 0.0f;
+              results.push_back(measure(
+                  options, result,
+                  [&](int i) {
+                    posture = rest;
+                    for (size_t e = 0; e < effectors.size(); ++e) {
+                      const Eigen::Vector3f& direction = directions[(i + e) % totalSamples];
+                      effectors[e].target = restPositions[e] + distance * reaches[e] * direction;
+                    }
+                  },
+                  [&](int) { error = inverseKinematics(effectors, posture); },
+                  [&](int) { return error < solvedDistance; }));
+              break;
+            }
+          }
+        }
+      }
+    }
+  }
+  printResults(results, options.isJson);
+  return 0;
+}
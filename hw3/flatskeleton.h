@@ -0,0 +1,39 @@
+#pragma once
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "kinematics.h"
+
+/**
+ * @brief A skeleton flattened into arrays in parent-before-child order, so forward kinematics is one loop.
+ * Everything that does not depend on the posture is computed once by flattenSkeleton.
+ */
+struct FlatSkeleton {
+  // Bone::idx of each slot, slot 0 is the root.
+  std::vector<int> boneIndex;
+  // Slot of the parent, always before the slot itself. -1 for the root.
+  std::vector<int> parentSlot;
+  // Rotation from the parent's axis frame into this bone's, the axis itself for the root.
+  std::vector<Eigen::Quaternionf> localAxis;
+  // direction.normalized() * length, in the bone's frame.
+  std::vector<Eigen::Vector3f> offset;
+
+  int size() const { return static_cast<int>(boneIndex.size()); }
+};
+
+/**
+ * @brief Flatten the bones under root, call once after loading the skeleton.
+ * Also sets Bone::rotationParentCurrent the same as the recursive forward kinematics did.
+ *
+ * @param root The root bone, the bones must be stored in an array indexed by Bone::idx.
+ */
+FlatSkeleton flattenSkeleton(Bone* root);
+
+/**
+ * @brief Forward kinematics of one posture written into the bones.
+ *
+ * @param skeleton The skeleton of root, from flattenSkeleton.
+ */
+void forwardKinematics(const FlatSkeleton& skeleton, const Posture& posture, Bone* root);
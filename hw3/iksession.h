@@ -0,0 +1,60 @@
+#pragma once
+#include <vector>
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+
+#include "flatskeleton.h"
+#include "kinematics.h"
+
+/**
+ * @brief Inverse kinematics of one chain solved frame after frame, e.g. a hand following a moving target.
+ * The chain is found once. Each solve starts from the previous solution with the previous damping, and reuses the
+ * previous Jacobian while its steps keep reducing the error, so a target that moved a little takes a few iterations.
+ * The damping is adapted as in Levenberg-Marquardt: lowered after a step that reduced the error, raised after one
+ * that did not, which is then undone.
+ */
+class IKSession {
+ public:
+  /**
+   * @brief Like inverseKinematics, the chain goes up to the root if start is not above end.
+   * The skeleton is flattened here, which also sets the bones' rotationParentCurrent the chain is posed with.
+   *
+   */
+  IKSession(Bone* start, Bone* end);
+  /**
+   * @brief Move end's end position to target, the chain's angles start from the last solve if there was one.
+   *
+   * @param posture Changed like inverseKinematics does, all bones are posed afterwards.
+   * @return The distance of end to target.
+   */
+  float solve(const Eigen::Vector3f& target, Posture& posture);
+  /**
+   * @brief Forget the previous solution, the next solve starts from its posture, e.g. after a cut in the motion.
+   *
+   */
+  void reset();
+  /**
+   * @brief Iterations of the last solve.
+   *
+   */
+  int iterationCount() const { return iterations; }
+
+ private:
+  Bone* root = nullptr;
+  Bone* end = nullptr;
+  FlatSkeleton skeleton;
+  // The bones above the chain from the root down, then the chain from end up.
+  std::vector<Bone*> anchorPath;
+  std::vector<Bone*> chain;
+  float maxStep = 0.0f;
+  float damping = 0.0f;
+  bool hasSolution = false;
+  bool hasJacobian = false;
+  int iterations = 0;
+  // The chain's angles of the last solve, and of the current iteration to undo a step.
+  std::vector<Eigen::Vector3f> solutionAngles, savedAngles;
+  std::vector<Eigen::Quaternionf> solutionRotations, savedRotations;
+  Eigen::Matrix3Xf jacobian;
+  Eigen::VectorXf dTheta;
+};
@@ -1,36 +1,343 @@
 #include "kinematics.h"
 
 #include <algorithm>
-#include <iostream>
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+
+#include <Eigen/Cholesky>
+#include <Eigen/SVD>
+
+#include "flatskeleton.h"
+#include "iksession.h"
+#include "multiik.h"
 #include "utils.h"
-void forwardKinematics(const Posture& posture, Bone* bone) {
-  // TODO (FK)
-  // Same as HW2, but have some minor change
-  // Hint:
-  //   1. If you don't use `axis` in this function, you can copy-paste your code
-  // Note:
-  //   1. bone.axis becomes quaternion instead of vector3f
 
-  if (bone->parent != nullptr) {
-    bone->startPosition = bone->parent->endPosition;
-    bone->rotation = bone->parent->rotation * bone->rotationParentCurrent * bone->axis * posture.rotations[bone->idx];
+namespace {
+// Damped least squares, dTheta = J^T (J J^T + damping^2 I)^-1 error, stays bounded near singular poses.
+constexpr float ikDamping = 0.1f;
+// Stop after this many iterations that got no closer than the best one by ikStallTolerance, the target is out of
+// reach. Far targets zigzag a little, so one bad iteration is not enough.
+constexpr int ikStallIterations = 8;
+constexpr float ikStallTolerance = 1E-6f;
+// A far target is approached in steps of this fraction of the chain's reach, the linearization holds that far.
+constexpr float ikStepFraction = 0.25f;
+// Range and factors of the damping IKSession adapts: lowered after a step that reduced the error, raised after one
+// that did not.
+constexpr float ikMinimumDamping = 1E-2f;
+constexpr float ikMaximumDamping = 1E1f;
+constexpr float ikDampingDecrease = 0.5f;
+constexpr float ikDampingIncrease = 4.0f;
+
+// Storage of inverseKinematics, reused by later calls so a solve stops allocating once its chain length was seen.
+struct IKWorkspace {
+  std::vector<Bone*> chain;
+  Eigen::Matrix3Xf jacobian;
+  Eigen::VectorXf dTheta;
+};
+
+// Forward kinematics of one bone whose parent is already posed.
+void poseBone(Bone& bone, const Posture& posture, const Bone* root) {
+  // The same products as forwardKinematics, rotationParentCurrent was set when the skeleton was flattened.
+  if (&bone == root) {
+    bone.startPosition = Eigen::Vector3f::Zero();
+    bone.rotation = bone.axis * posture.rotations[bone.idx];
   } else {
-    bone->startPosition = Eigen::Vector3f::Zero();
-    bone->rotation = bone->axis * posture.rotations[bone->idx];
+    bone.startPosition = bone.parent->endPosition;
+    bone.rotation = bone.parent->rotation * ((bone.rotationParentCurrent * bone.axis) * posture.rotations[bone.idx]);
+  }
+  bone.endPosition =
+      bone.startPosition + posture.translations[bone.idx] + bone.rotation * (bone.direction.normalized() * bone.length);
+}
+
+// Forward kinematics of a chain of bones from end to its top, the bones above the top do not move.
+void chainForwardKinematics(const std::vector<Bone*>& chain, const Posture& posture, const Bone* root) {
+  for (auto it = chain.rbegin(); it != chain.rend(); ++it) poseBone(**it, posture, root);
+}
+
+// How the effector moves per radian of the bone's Euler angles x, y and z.
+Eigen::Matrix3f eulerJacobian(const Bone& bone, const Posture& posture, const Eigen::Vector3f& effector) {
+  const Eigen::Vector3f& euler = posture.eulerAngle[bone.idx];
+  // The rotation is frame * Rz * Ry * Rx, so each angle turns about its axis after the ones applied before it.
+  Eigen::Quaternionf frame = bone.rotation * posture.rotations[bone.idx].conjugate();
+  Eigen::Quaternionf afterZ = frame * Eigen::AngleAxisf(euler[2], Eigen::Vector3f::UnitZ());
+  Eigen::Quaternionf afterY = afterZ * Eigen::AngleAxisf(euler[1], Eigen::Vector3f::UnitY());
+  Eigen::Vector3f lever = effector - (bone.startPosition + posture.translations[bone.idx]);
+  Eigen::Matrix3f columns;
+  columns.col(0) = (afterY * Eigen::Vector3f::UnitX()).cross(lever);
+  columns.col(1) = (afterZ * Eigen::Vector3f::UnitY()).cross(lever);
+  columns.col(2) = (frame * Eigen::Vector3f::UnitZ()).cross(lever);
+  return columns;
+}
+
+// Rebuild a bone's rotation from its Euler angles, Rz * Ry * Rx expanded from the half angles.
+void updateRotation(Posture& posture, int boneIndex) {
+  const Eigen::Vector3f& euler = posture.eulerAngle[boneIndex];
+  const float cx = std::cos(0.5f * euler[0]), sx = std::sin(0.5f * euler[0]);
+  const float cy = std::cos(0.5f * euler[1]), sy = std::sin(0.5f * euler[1]);
+  const float cz = std::cos(0.5f * euler[2]), sz = std::sin(0.5f * euler[2]);
+  posture.rotations[boneIndex] = Eigen::Quaternionf(cz * cy * cx + sz * sy * sx, cz * cy * sx - sz * sy * cx,
+                                                    cz * sy * cx + sz * cy * sx, sz * cy * cx - cz * sy * sx);
+}
+
+// Persistent workers for the independent IK chains. parallelFor splits [0, count) into chunks of at least grainSize and
+// blocks until all of them are done, the calling thread works too. Loops must not nest.
+class WorkerPool {
+ public:
+  static WorkerPool& get() {
+    static WorkerPool pool;
+    return pool;
+  }
+  ~WorkerPool() {
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      isStopping = true;
+    }
+    wakeCondition.notify_all();
+    for (auto& worker : workers) worker.join();
+  }
+  template <class Func>
+  void parallelFor(int count, int grainSize, Func&& func) {
+    using FuncType = std::remove_reference_t<Func>;
+    auto invoke = [](void* context, int begin, int end) { (*static_cast<FuncType*>(context))(begin, end); };
+    run(count, grainSize, invoke, const_cast<void*>(static_cast<const void*>(&func)));
+  }
+
+ private:
+  using Task = void (*)(void*, int, int);
+  WorkerPool() {
+    int count = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    for (int i = 0; i < count - 1; ++i) workers.emplace_back(&WorkerPool::workerLoop, this);
+  }
+  void run(int count, int grainSize, Task task_, void* context_) {
+    if (count <= 0) return;
+    int maxChunks = std::max(1, count / std::max(1, grainSize));
+    if (workers.empty() || maxChunks == 1) {
+      task_(context_, 0, count);
+      return;
+    }
+    // One loop at a time, a second caller waits for the first.
+    std::lock_guard<std::mutex> runLock(runMutex);
+    {
+      std::lock_guard<std::mutex> lock(mutex);
+      task = task_;
+      context = context_;
+      itemCount = count;
+      chunkCount = std::min(maxChunks, 4 * static_cast<int>(workers.size() + 1));
+      chunkSize = (count + chunkCount - 1) / chunkCount;
+      chunkCount = (count + chunkSize - 1) / chunkSize;
+      nextChunk.store(0, std::memory_order_relaxed);
+      activeWorkers = static_cast<int>(workers.size());
+      ++generation;
+    }
+    wakeCondition.notify_all();
+    work();
+    std::unique_lock<std::mutex> lock(mutex);
+    doneCondition.wait(lock, [this] { return activeWorkers == 0; });
+  }
+
+  void work() {
+    for (int chunk = nextChunk.fetch_add(1); chunk < chunkCount; chunk = nextChunk.fetch_add(1)) {
+      int begin = chunk * chunkSize;
+      task(context, begin, std::min(begin + chunkSize, itemCount));
+    }
   }
+  void workerLoop() {
+    unsigned int seenGeneration = 0;
+    std::unique_lock<std::mutex> lock(mutex);
+    while (true) {
+      wakeCondition.wait(lock, [&] { return isStopping || generation != seenGeneration; });
+      if (isStopping) return;
+      seenGeneration = generation;
+      lock.unlock();
+      work();
+      lock.lock();
+      if (--activeWorkers == 0) doneCondition.notify_one();
+    }
+  }
+
+  std::vector<std::thread> workers;
+  std::mutex runMutex;
+  std::mutex mutex;
+  std::condition_variable wakeCondition;
+  std::condition_variable doneCondition;
+  bool isStopping = false;
+  unsigned int generation = 0;
+  int activeWorkers = 0;
+  // Current loop, written under the mutex before waking the workers.
+  Task task = nullptr;
+  void* context = nullptr;
+  int itemCount = 0;
+  int chunkSize = 0;
+  int chunkCount = 0;
+  std::atomic<int> nextChunk = 0;
+};
+
+// Effectors whose chains move each other, solved as one system.
+struct IKGroup {
+  std::vector<int> effectors;
+  // The bones solved for, bone variables[c] has the columns 3c to 3c + 2.
+  std::vector<Bone*> variables;
+  // The bones forward kinematics has to update, parents first.
+  std::vector<Bone*> posed;
+  Eigen::MatrixXf jacobian;
+  Eigen::VectorXf error;
+  Eigen::VectorXf dTheta;
+  Eigen::MatrixXf system;
+  Eigen::LLT<Eigen::MatrixXf> solver;
+  // The solve of the system, evaluated here so the product with the Jacobian does not allocate a temporary.
+  Eigen::VectorXf multipliers;
+};
+
+// Storage of the multi effector inverseKinematics.
+struct MultiIKWorkspace {
+  std::vector<std::vector<Bone*>> chains;
+  // Largest error an effector moves toward per iteration.
+  std::vector<float> maxSteps;
+  // Union-find parents, then the representative of each effector.
+  std::vector<int> groupOf;
+  // Group of each representative.
+  std::vector<int> groupIndex;
+  // Column block of each bone in its group, -1 if it is not solved for.
+  std::vector<int> columnOf;
+  std::vector<char> isPosed;
+  std::vector<IKGroup> groups;
+};
+
+// The chain of an effector, from end up to start, or to the root if start is not above end.
+void collectChain(const IKEffector& effector, const Bone* root, std::vector<Bone*>& chain) {
+  chain.clear();
+  for (Bone* bone = effector.end;; bone = bone->parent) {
+    chain.push_back(bone);
+    if (bone == root || bone == effector.start) break;
+  }
+}
 
-  bone->endPosition = bone->startPosition + posture.translations[bone->idx] +
-                      bone->rotation * (bone->direction).normalized() * bone->length;
+// Number of bones above bone.
+int boneDepth(const Bone* bone) {
+  int depth = 0;
+  for (; bone->parent != nullptr; bone = bone->parent) ++depth;
+  return depth;
+}
+
+// What flattenSkeleton reads from a bone and writes into it, with the bones it links to.
+struct BoneRecord {
+  int index, child, sibling;
+  float axis[4];
+  float direction[3];
+  float length;
+  float rotationParentCurrent[4];
+
+  explicit BoneRecord(const Bone& bone) :
+      index(bone.idx), child(bone.child ? bone.child->idx : -1), sibling(bone.sibling ? bone.sibling->idx : -1) {
+    std::memcpy(axis, bone.axis.coeffs().data(), sizeof(axis));
+    std::memcpy(direction, bone.direction.data(), sizeof(direction));
+    length = bone.length;
+    std::memcpy(rotationParentCurrent, bone.rotationParentCurrent.coeffs().data(), sizeof(rotationParentCurrent));
+  }
+  bool operator==(const BoneRecord& other) const { return std::memcmp(this, &other, sizeof(BoneRecord)) == 0; }
+};
 
-  if (bone->child != nullptr) {
-    bone->child->rotationParentCurrent = bone->axis.inverse();
-    forwardKinematics(posture, bone->child);
+// The bones from bone on along its siblings, each followed by its children.
+template <class Visit>
+void visitBones(const Bone* bone, Visit& visit) {
+  for (; bone != nullptr; bone = bone->sibling) {
+    visit(*bone);
+    visitBones(bone->child, visit);
   }
+}
 
-  if (bone->sibling != nullptr) {
-    bone->sibling->rotationParentCurrent = bone->rotationParentCurrent;
-    forwardKinematics(posture, bone->sibling);
+// The flattened skeletons forwardKinematics(posture, root) was last called with. An entry is only used while the
+// bones still match what it was flattened from, so another skeleton loaded into the same storage is flattened again.
+const FlatSkeleton& cachedFlatSkeleton(Bone* root) {
+  struct Entry {
+    const Bone* root = nullptr;
+    std::vector<BoneRecord> bones;
+    FlatSkeleton skeleton;
+  };
+  // A few of them, alternating between two skeletons does not flatten on every call.
+  thread_local std::array<Entry, 4> cache;
+  thread_local int nextEntry = 0;
+  for (const Entry& entry : cache) {
+    if (entry.root != root) continue;
+    size_t next = 0;
+    bool isSame = true;
+    auto compare = [&](const Bone& bone) {
+      isSame = isSame && next < entry.bones.size() && entry.bones[next] == BoneRecord(bone);
+      ++next;
+    };
+    visitBones(root, compare);
+    if (isSame && next == entry.bones.size()) return entry.skeleton;
   }
+  Entry& entry = cache[nextEntry];
+  nextEntry = (nextEntry + 1) % static_cast<int>(cache.size());
+  entry.skeleton = flattenSkeleton(root);
+  entry.root = root;
+  // Recorded after flattenSkeleton has set rotationParentCurrent.
+  entry.bones.clear();
+  auto record = [&entry](const Bone& bone) { entry.bones.emplace_back(bone); };
+  visitBones(root, record);
+  return entry.skeleton;
+}
+}  // namespace
+
+FlatSkeleton flattenSkeleton(Bone* root) {
+  FlatSkeleton skeleton;
+  // Depth first with an explicit stack, a bone is pushed when its parent gets a slot.
+  std::vector<std::pair<Bone*, int>> stack;
+  for (Bone* bone = root; bone != nullptr; bone = bone->sibling) stack.emplace_back(bone, -1);
+  while (!stack.empty()) {
+    auto [bone, parentSlot] = stack.back();
+    stack.pop_back();
+    int slot = skeleton.size();
+    skeleton.boneIndex.push_back(bone->idx);
+    skeleton.parentSlot.push_back(parentSlot);
+    skeleton.localAxis.push_back(parentSlot < 0 ? bone->axis : bone->rotationParentCurrent * bone->axis);
+    skeleton.offset.push_back(bone->direction.normalized() * bone->length);
+    for (Bone* child = bone->child; child != nullptr; child = child->sibling) {
+      // Children are in the parent's axis frame.
+      child->rotationParentCurrent = bone->axis.inverse();
+      stack.emplace_back(child, slot);
+    }
+  }
+  return skeleton;
+}
+
+void forwardKinematics(const FlatSkeleton& skeleton, const Posture& posture, Bone* root) {
+  Bone* bones = root - root->idx;
+  for (int slot = 0; slot < skeleton.size(); ++slot) {
+    Bone& bone = bones[skeleton.boneIndex[slot]];
+    int parentSlot = skeleton.parentSlot[slot];
+    Eigen::Quaternionf local = skeleton.localAxis[slot] * posture.rotations[bone.idx];
+    if (parentSlot < 0) {
+      bone.startPosition = Eigen::Vector3f::Zero();
+      bone.rotation = local;
+    } else {
+      const Bone& parent = bones[skeleton.boneIndex[parentSlot]];
+      bone.startPosition = parent.endPosition;
+      bone.rotation = parent.rotation * local;
+    }
+    bone.endPosition = bone.startPosition + posture.translations[bone.idx] + bone.rotation * skeleton.offset[slot];
+  }
+}
+
+void forwardKinematics(const Posture& posture, Bone* bone) {
+  // TODO (FK)
+  // Same as HW2, but have some minor change
+  // Hint:
+  //   1. If you don't use `axis` in this function, you can copy-paste your code
+  // Note:
+  //   1. bone.axis becomes quaternion instead of vector3f
+
+  // Callers that pose often keep the FlatSkeleton themselves, this looks it up by the bones.
+  forwardKinematics(cachedFlatSkeleton(bone), posture, bone);
 }
 
 Eigen::VectorXf leastSquareSolver(const Eigen::Matrix3Xf& jacobian, const Eigen::Vector3f& target) {
@@ -41,18 +348,23 @@ Eigen::VectorXf leastSquareSolver(const Eigen::Matrix3Xf& jacobian, const Eigen:
   // Note:
   //   1. SVD or other pseudo-inverse method is useful
   //   2. Some of them have some limitation, if you use that method you should check it.
-  Eigen::VectorXf solution(jacobian.cols());
-  solution = jacobian.bdcSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(target);
+  // The pseudo-inverse of a 3 row matrix is J^T (J J^T)^+, so only a fixed size 3x3 system is decomposed and just the
+  // returned vector is allocated. The SVD of the square system keeps the pseudo-inverse when J has a lower rank.
+  const Eigen::Matrix3f system = jacobian * jacobian.transpose();
+  const Eigen::JacobiSVD<Eigen::Matrix3f, Eigen::NoQRPreconditioner> svd(system,
+                                                                         Eigen::ComputeFullU | Eigen::ComputeFullV);
+  Eigen::VectorXf solution = jacobian.transpose() * svd.solve(target);
   return solution;
 }
 
 void inverseKinematics(const Eigen::Vector3f& target, Bone* start, Bone* end, Posture& posture) {
   constexpr int maxIterations = 10000;
   constexpr float epsilon = 1E-3f;
-  constexpr float step = 0.1f;
   // Since bone stores in bones[i] that i == bone->idx, we can use bone - bone->idx to find bones[0] which is root.
   Bone* root = start - start->idx;
-  std::vector<Bone*> boneList;
+  thread_local IKWorkspace workspace;
+  std::vector<Bone*>& boneList = workspace.chain;
+  boneList.clear();
   // TODO
   // Hint:
   //   1. Traverse from end to start is easier than start to end (since there is only 1 parent)
@@ -66,14 +378,34 @@ void inverseKinematics(const Eigen::Vector3f& target, Bone* start, Bone* end, Po
     if (tmp == root || tmp == start) break;
   }
 
+  const int boneNum = static_cast<int>(boneList.size());
+  const int columnCount = 3 * boneNum;
+  if (workspace.jacobian.cols() < columnCount) {
+    workspace.jacobian.resize(3, columnCount);
+    workspace.dTheta.resize(columnCount);
+  }
+  auto jacobian = workspace.jacobian.leftCols(columnCount);
+  auto dTheta = workspace.dTheta.head(columnCount);
 
-  size_t boneNum = boneList.size();
-  std::cout << boneNum << std::endl;
-  Eigen::Matrix3Xf jacobian(3, 3 * boneNum);
-  jacobian.setZero();
+  float maxStep = 0.0f;
+  for (const Bone* bone : boneList) maxStep += ikStepFraction * bone->length;
 
+  // Only the chain moves, the rest of the skeleton is posed once here.
+  const FlatSkeleton& skeleton = cachedFlatSkeleton(root);
+  forwardKinematics(skeleton, posture, root);
+  float bestError = std::numeric_limits<float>::infinity();
+  int stallCount = 0;
   for (int i = 0; i < maxIterations; ++i) {
-    forwardKinematics(posture, root);
+    Eigen::Vector3f error = target - end->endPosition;
+    float errorNorm = error.norm();
+    if (errorNorm < epsilon) break;
+    if (errorNorm < bestError - ikStallTolerance) {
+      bestError = errorNorm;
+      stallCount = 0;
+    } else if (++stallCount == ikStallIterations) {
+      break;
+    }
+    if (errorNorm > maxStep) error *= maxStep / errorNorm;
     // TODO (compute jacobian)
     //   1. Compute jacobian columns
     //   2. Compute dTheta
@@ -83,27 +415,12 @@ void inverseKinematics(const Eigen::Vector3f& target, Bone* start, Bone* end, Po
     //   3. Call leastSquareSolver to compute dTheta
 
     // Write your code here.
-    Bone* tmp;
-    for (size_t j = 0; j < boneNum; j++) {
-      tmp = boneList[j];
-      Eigen::Matrix3f rotation = tmp->rotation.matrix();
-      Eigen::Vector3f r = tmp->startPosition;
-      Eigen::Vector3f p = end->endPosition;
-      for (int k = 0; k < 3; k += 1) {
-        Eigen::Vector3f a;
-        switch (k) {
-          case 0: 
-              a = (rotation * Eigen::Vector3f(1, 0, 0)).normalized(); break;
-          case 1: 
-              a = (rotation * Eigen::Vector3f(0, 1, 0)).normalized(); break;
-          case 2: 
-              a = (rotation * Eigen::Vector3f(0, 0, 1)).normalized(); break;
-        }
-        jacobian.col(j * 3 + k) = a.cross(p - r);
-      }
-    }
-    Eigen::VectorXf dTheta = step * leastSquareSolver(jacobian, (target - end->endPosition));
-    for (size_t j = 0; j < boneNum; j++) {
+    for (int j = 0; j < boneNum; j++)
+      jacobian.middleCols<3>(j * 3) = eulerJacobian(*boneList[j], posture, end->endPosition);
+    Eigen::Matrix3f system = jacobian * jacobian.transpose();
+    system.diagonal().array() += ikDamping * ikDamping;
+    dTheta.noalias() = jacobian.transpose() * system.llt().solve(error);
+    for (int j = 0; j < boneNum; j++) {
       const auto& bone = *boneList[j];
       // TODO (update rotation)
       //   1. Update posture's eulerAngle using deltaTheta
@@ -119,9 +436,292 @@ void inverseKinematics(const Eigen::Vector3f& target, Bone* start, Bone* end, Po
       posture.eulerAngle[bone.idx][1] += dTheta[j * 3 + 1];
       posture.eulerAngle[bone.idx][2] += dTheta[j * 3 + 2];
 
-      posture.rotations[bone.idx] = Eigen::AngleAxisf(posture.eulerAngle[bone.idx][2], Eigen::Vector3f::UnitZ()) *
-                                    Eigen::AngleAxisf(posture.eulerAngle[bone.idx][1], Eigen::Vector3f::UnitY()) *
-                                    Eigen::AngleAxisf(posture.eulerAngle[bone.idx][0], Eigen::Vector3f::UnitX());
+      updateRotation(posture, bone.idx);
+    }
+    chainForwardKinematics(boneList, posture, root);
+  }
+  // The bones below the chain follow it.
+  forwardKinematics(skeleton, posture, root);
+}
+
+float inverseKinematics(const std::vector<IKEffector>& effectors, Posture& posture, const IKJointLimits* limits) {
+  constexpr int maxIterations = 10000;
+  constexpr float epsilon = 1E-3f;
+  if (effectors.empty()) return 0.0f;
+  Bone* root = effectors[0].end - effectors[0].end->idx;
+  const int effectorCount = static_cast<int>(effectors.size());
+  const int boneCount = static_cast<int>(posture.rotations.size());
+  // Kept between calls, a whole body solve per frame stops allocating after the first one. Bound to references, the
+  // workers must see the caller's storage and not their own thread_local.
+  thread_local MultiIKWorkspace workspace;
+  std::vector<std::vector<Bone*>>& chains = workspace.chains;
+  std::vector<float>& maxSteps = workspace.maxSteps;
+  std::vector<int>& groupOf = workspace.groupOf;
+  std::vector<int>& groupIndex = workspace.groupIndex;
+  std::vector<int>& columnOf = workspace.columnOf;
+  std::vector<char>& isPosed = workspace.isPosed;
+  std::vector<IKGroup>& groups = workspace.groups;
+  chains.resize(effectorCount);
+  maxSteps.resize(effectorCount);
+  groupOf.resize(effectorCount);
+  groupIndex.resize(effectorCount);
+  for (int e = 0; e < effectorCount; ++e) {
+    chains[e].clear();
+    groupOf[e] = e;
+    if (effectors[e].weight <= 0.0f) continue;
+    collectChain(effectors[e], root, chains[e]);
+    maxSteps[e] = 0.0f;
+    for (const Bone* bone : chains[e]) maxSteps[e] += ikStepFraction * bone->length;
+  }
+
+  // Union-find on the effectors: a moves b if one of its bones is on the way from b's end to the root.
+  auto findGroup = [&](int e) {
+    while (groupOf[e] != e) e = groupOf[e] = groupOf[groupOf[e]];
+    return e;
+  };
+  auto moves = [&](int a, int b) {
+    for (const Bone* bone = effectors[b].end; bone != nullptr; bone = bone == root ? nullptr : bone->parent) {
+      if (std::find(chains[a].begin(), chains[a].end(), bone) != chains[a].end()) return true;
+    }
+    return false;
+  };
+  for (int a = 0; a < effectorCount; ++a) {
+    for (int b = a + 1; b < effectorCount; ++b) {
+      if (chains[a].empty() || chains[b].empty()) continue;
+      if (moves(a, b) || moves(b, a)) groupOf[findGroup(a)] = findGroup(b);
     }
   }
+
+  // Every effector points to its representative, the representatives are numbered.
+  for (int e = 0; e < effectorCount; ++e) groupOf[e] = findGroup(e);
+  int groupCount = 0;
+  for (int e = 0; e < effectorCount; ++e) {
+    if (!chains[e].empty() && groupOf[e] == e) groupIndex[e] = groupCount++;
+  }
+  if (static_cast<int>(groups.size()) < groupCount) groups.resize(groupCount);
+  for (int g = 0; g < groupCount; ++g) {
+    groups[g].effectors.clear();
+    groups[g].variables.clear();
+    groups[g].posed.clear();
+  }
+  for (int e = 0; e < effectorCount; ++e) {
+    if (!chains[e].empty()) groups[groupIndex[groupOf[e]]].effectors.push_back(e);
+  }
+
+  columnOf.assign(boneCount, -1);
+  isPosed.assign(boneCount, 0);
+  for (int g = 0; g < groupCount; ++g) {
+    IKGroup& group = groups[g];
+    for (int e : group.effectors) {
+      for (Bone* bone : chains[e]) {
+        if (columnOf[bone->idx] >= 0) continue;
+        columnOf[bone->idx] = static_cast<int>(group.variables.size());
+        group.variables.push_back(bone);
+      }
+    }
+    // Everything from an end up to the highest bone solved for above it moves.
+    for (int e : group.effectors) {
+      Bone* highest = effectors[e].end;
+      for (Bone* bone = effectors[e].end; bone != nullptr; bone = bone == root ? nullptr : bone->parent) {
+        if (columnOf[bone->idx] >= 0) highest = bone;
+      }
+      for (Bone* bone = effectors[e].end;; bone = bone->parent) {
+        if (!isPosed[bone->idx]) {
+          isPosed[bone->idx] = 1;
+          group.posed.push_back(bone);
+        }
+        if (bone == highest) break;
+      }
+    }
+    // Only parents before children matters, std::sort does not allocate like std::stable_sort.
+    std::sort(group.posed.begin(), group.posed.end(),
+              [](const Bone* a, const Bone* b) { return boneDepth(a) < boneDepth(b); });
+  }
+
+  auto solveGroup = [&](IKGroup& group) {
+    const int groupEffectorCount = static_cast<int>(group.effectors.size());
+    const int variableCount = static_cast<int>(group.variables.size());
+    const int rows = 3 * groupEffectorCount;
+    const int columns = 3 * variableCount;
+    group.jacobian.resize(rows, columns);
+    group.error.resize(rows);
+    group.dTheta.resize(columns);
+    group.multipliers.resize(rows);
+    float bestError = std::numeric_limits<float>::infinity();
+    int stallCount = 0;
+    for (int i = 0; i < maxIterations; ++i) {
+      float largestError = 0.0f;
+      float weightedError = 0.0f;
+      for (int k = 0; k < groupEffectorCount; ++k) {
+        int e = group.effectors[k];
+        Eigen::Vector3f error = effectors[e].target - effectors[e].end->endPosition;
+        float errorNorm = error.norm();
+        largestError = std::max(largestError, errorNorm);
+        weightedError += effectors[e].weight * errorNorm * errorNorm;
+        if (errorNorm > maxSteps[e]) error *= maxSteps[e] / errorNorm;
+        // Rows scaled by sqrt(weight) minimize the weighted sum of squared errors.
+        group.error.segment<3>(3 * k) = std::sqrt(effectors[e].weight) * error;
+      }
+      if (largestError < epsilon) break;
+      weightedError = std::sqrt(weightedError);
+      if (weightedError < bestError - ikStallTolerance) {
+        bestError = weightedError;
+        stallCount = 0;
+      } else if (++stallCount == ikStallIterations) {
+        break;
+      }
+
+      // Block sparse: an effector's rows only have the columns of the bones above its end.
+      group.jacobian.setZero();
+      for (int k = 0; k < groupEffectorCount; ++k) {
+        const IKEffector& effector = effectors[group.effectors[k]];
+        const float rowScale = std::sqrt(effector.weight);
+        for (Bone* bone = effector.end; bone != nullptr; bone = bone == root ? nullptr : bone->parent) {
+          int column = columnOf[bone->idx];
+          if (column < 0) continue;
+          group.jacobian.block<3, 3>(3 * k, 3 * column) =
+              rowScale * eulerJacobian(*bone, posture, effector.end->endPosition);
+        }
+      }
+      if (limits) {
+        for (int c = 0; c < variableCount; ++c) {
+          int boneIndex = group.variables[c]->idx;
+          for (int axis = 0; axis < 3; ++axis) {
+            if (limits->lower[boneIndex][axis] == limits->upper[boneIndex][axis])
+              group.jacobian.col(3 * c + axis).setZero();
+          }
+        }
+      }
+      group.system.noalias() = group.jacobian * group.jacobian.transpose();
+      group.system.diagonal().array() += ikDamping * ikDamping;
+      group.solver.compute(group.system);
+      group.multipliers = group.solver.solve(group.error);
+      group.dTheta.noalias() = group.jacobian.transpose() * group.multipliers;
+
+      for (int c = 0; c < variableCount; ++c) {
+        int boneIndex = group.variables[c]->idx;
+        Eigen::Vector3f& euler = posture.eulerAngle[boneIndex];
+        euler += group.dTheta.segment<3>(3 * c);
+        if (limits) euler = euler.cwiseMax(limits->lower[boneIndex]).cwiseMin(limits->upper[boneIndex]);
+        updateRotation(posture, boneIndex);
+      }
+      for (Bone* bone : group.posed) poseBone(*bone, posture, root);
+    }
+  };
+
+  const FlatSkeleton& skeleton = cachedFlatSkeleton(root);
+  forwardKinematics(skeleton, posture, root);
+  // Groups share no bone and no posture entry, so they are solved in parallel.
+  WorkerPool::get().parallelFor(groupCount, 1, [&](int begin, int end) {
+    for (int g = begin; g < end; ++g) solveGroup(groups[g]);
+  });
+  forwardKinematics(skeleton, posture, root);
+
+  float largestError = 0.0f;
+  for (int e = 0; e < effectorCount; ++e) {
+    if (effectors[e].weight > 0.0f)
+      largestError = std::max(largestError, (effectors[e].target - effectors[e].end->endPosition).norm());
+  }
+  return largestError;
+}
+
+IKSession::IKSession(Bone* start, Bone* end_) :
+    root(start - start->idx), end(end_), skeleton(flattenSkeleton(root)), damping(ikDamping) {
+  for (Bone* bone = end;; bone = bone->parent) {
+    chain.push_back(bone);
+    maxStep += ikStepFraction * bone->length;
+    if (bone == root || bone == start) break;
+  }
+  for (Bone* bone = chain.back()->parent; bone != nullptr; bone = bone->parent) anchorPath.push_back(bone);
+  std::reverse(anchorPath.begin(), anchorPath.end());
+  const int boneNum = static_cast<int>(chain.size());
+  solutionAngles.resize(boneNum);
+  savedAngles.resize(boneNum);
+  solutionRotations.resize(boneNum);
+  savedRotations.resize(boneNum);
+  jacobian.resize(3, 3 * boneNum);
+  dTheta.resize(3 * boneNum);
+}
+
+void IKSession::reset() {
+  damping = ikDamping;
+  hasSolution = false;
+  hasJacobian = false;
+}
+
+float IKSession::solve(const Eigen::Vector3f& target, Posture& posture) {
+  constexpr int maxIterations = 10000;
+  constexpr float epsilon = 1E-3f;
+  const int boneNum = static_cast<int>(chain.size());
+  if (hasSolution) {
+    for (int j = 0; j < boneNum; ++j) {
+      posture.eulerAngle[chain[j]->idx] = solutionAngles[j];
+      posture.rotations[chain[j]->idx] = solutionRotations[j];
+    }
+  }
+  // Only the chain and the bones it hangs from matter until the end.
+  for (Bone* bone : anchorPath) poseBone(*bone, posture, root);
+  chainForwardKinematics(chain, posture, root);
+
+  float errorNorm = (target - end->endPosition).norm();
+  float bestError = errorNorm;
+  int stallCount = 0;
+  // Whether the Jacobian was computed at the current angles, a stale one is refreshed before raising the damping.
+  bool isFresh = false;
+  for (iterations = 0; iterations < maxIterations && errorNorm >= epsilon && stallCount < ikStallIterations;
+       ++iterations) {
+    if (!hasJacobian) {
+      for (int j = 0; j < boneNum; ++j)
+        jacobian.middleCols<3>(j * 3) = eulerJacobian(*chain[j], posture, end->endPosition);
+      hasJacobian = isFresh = true;
+    }
+    Eigen::Vector3f error = target - end->endPosition;
+    if (errorNorm > maxStep) error *= maxStep / errorNorm;
+    Eigen::Matrix3f system = jacobian * jacobian.transpose();
+    system.diagonal().array() += damping * damping;
+    dTheta.noalias() = jacobian.transpose() * system.llt().solve(error);
+    for (int j = 0; j < boneNum; ++j) {
+      const int idx = chain[j]->idx;
+      savedAngles[j] = posture.eulerAngle[idx];
+      savedRotations[j] = posture.rotations[idx];
+      posture.eulerAngle[idx] += dTheta.segment<3>(j * 3);
+      updateRotation(posture, idx);
+    }
+    chainForwardKinematics(chain, posture, root);
+
+    float trialError = (target - end->endPosition).norm();
+    if (trialError < errorNorm) {
+      damping = std::max(damping * ikDampingDecrease, ikMinimumDamping);
+      // The Jacobian of the previous angles is good enough for another step while it halves the error.
+      hasJacobian = trialError < 0.5f * errorNorm;
+      isFresh = false;
+      if (trialError < bestError - ikStallTolerance) {
+        bestError = trialError;
+        stallCount = 0;
+      } else {
+        ++stallCount;
+      }
+      errorNorm = trialError;
+    } else {
+      for (int j = 0; j < boneNum; ++j) {
+        posture.eulerAngle[chain[j]->idx] = savedAngles[j];
+        posture.rotations[chain[j]->idx] = savedRotations[j];
+      }
+      chainForwardKinematics(chain, posture, root);
+      if (isFresh) {
+        damping = std::min(damping * ikDampingIncrease, ikMaximumDamping);
+        ++stallCount;
+      } else {
+        hasJacobian = false;
+      }
+    }
+  }
+  for (int j = 0; j < boneNum; ++j) {
+    solutionAngles[j] = posture.eulerAngle[chain[j]->idx];
+    solutionRotations[j] = posture.rotations[chain[j]->idx];
+  }
+  hasSolution = true;
+  // The bones below the chain follow it.
+  forwardKinematics(skeleton, posture, root);
+  return errorNorm;
 }
@@ -0,0 +1,40 @@
+#pragma once
+#include <vector>
+
+#include <Eigen/Core>
+
+#include "kinematics.h"
+
+/**
+ * @brief One end effector: the chain from start to end should bring end's end position to target.
+ * Like the single target inverseKinematics, the chain goes up to the root if start is not above end.
+ */
+struct IKEffector {
+  Bone* start = nullptr;
+  Bone* end = nullptr;
+  Eigen::Vector3f target = Eigen::Vector3f::Zero();
+  // Importance relative to the other effectors when they compete for the same bones, 0 ignores the effector.
+  float weight = 1.0f;
+};
+
+/**
+ * @brief Euler angle limits of the bones in radians, indexed by Bone::idx. A DoF whose limits are equal is locked.
+ */
+struct IKJointLimits {
+  std::vector<Eigen::Vector3f> lower;
+  std::vector<Eigen::Vector3f> upper;
+};
+
+/**
+ * @brief Move all effectors to their targets at once, e.g. both hands, both feet and the head of a body.
+ * Effectors whose chains share a bone, or where one chain moves the other's end, are solved together by damped least
+ * squares on their stacked weighted Jacobians. Groups that do not affect each other are solved in parallel. Each
+ * iteration runs forward kinematics once over the bones of a group, and the angles are clamped to the limits.
+ *
+ * @param effectors The effectors, all in the skeleton of posture.
+ * @param posture The posture to change, its eulerAngle and rotations are updated.
+ * @param limits Joint limits, or nullptr to ignore them.
+ * @return The largest distance of an effector with weight above 0 to its target.
+ */
+float inverseKinematics(const std::vector<IKEffector>& effectors, Posture& posture,
+                        const IKJointLimits* limits = nullptr);